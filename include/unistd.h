@@ -10,6 +10,8 @@
  */
 #include <kern/unistd.h>
 #include <kern/ioctl.h>
+#include <kern/schedstats.h>
+#include <kern/spawn.h>
 
 
 /*
@@ -122,6 +124,10 @@ time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
+int nanosleep(time_t seconds, unsigned long nanoseconds);
+int schedstats(pid_t pid, struct schedstats *buf);
+pid_t spawn(const char *path, char *const argv[],
+	    const struct spawn_fdaction *actions, int nactions);
 
 /*
  * These are not themselves system calls, but wrapper routines in libc.
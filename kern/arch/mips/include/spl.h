@@ -57,6 +57,25 @@ int splx(int);
 void cpu_idle(void);
 void cpu_halt(void);
 
+/*
+ * Optional interrupts-off profiling. While enabled, every stretch of
+ * time with interrupts off is timed and charged to the caller of the
+ * splhigh/splx that turned them off. Turning it on discards any
+ * previous profile. spl_printprofile prints the call sites with the
+ * longest stretches.
+ */
+void spl_setprofiling(int on);
+void spl_printprofile(void);
+
+/*
+ * Hooks that keep the profile right where curspl is changed without
+ * splx: on exception entry and return (and first entry to user mode),
+ * and on context switch.
+ */
+void spl_trapentry(int oldspl);
+void spl_trapreturn(int newspl);
+void spl_switch(void);
+
 /*
  * Integer spl level to use for "high".
  * This is traditionally 15. 
@@ -132,6 +132,9 @@ md_switch(struct pcb *old, struct pcb *nu)
 	curkstack = nu->pcb_kstack;
 	in_interrupt = nu->pcb_ininterrupt;
 
+	/* Interrupts-off profiling: the rest isn't OLD's doing */
+	spl_switch();
+
 	mips_switch(old, nu);
 
 	/*
@@ -2,6 +2,7 @@
 #include <lib.h>
 #include <machine/spl.h>
 #include <machine/specialreg.h>
+#include <clock.h>
 
 /*
  * Actual interrupt on/off functions.
@@ -63,9 +64,111 @@ interrupts_onoff(void)
 /* System starts out with interrupts off. */
 int curspl = SPL_HIGH;
 
-/* Set the spl level. */
+/*
+ * Interrupts-off profiling.
+ *
+ * When turned on, every stretch of time from interrupts going off
+ * (spl going from 0 to anything higher) to coming back on is timed,
+ * and charged to whoever turned them off - the caller of splhigh or
+ * splx. The longest stretch seen from each call site is kept for the
+ * SPLPROF_NSITES worst sites. Time spent in cpu_idle waiting for an
+ * interrupt doesn't count, since interrupts are taken there.
+ *
+ * Exceptions change curspl without going through splx, so mips_trap
+ * and md_switch tell us about it. Time in an exception taken with
+ * interrupts on is a stretch of its own, charged to mips_trap, and a
+ * stretch ends when the exception returns to a context that has them
+ * on. A stretch is cut at a context switch; the time from there until
+ * the next thread turns interrupts on is charged to md_switch.
+ *
+ * When turned off the cost is a couple of tests in splx.
+ */
+#define SPLPROF_NSITES  16
+
+struct splprof_site {
+	vaddr_t sp_caller;	/* 0 if slot unused */
+	unsigned sp_count;	/* stretches charged here */
+	u_int32_t sp_maxusecs;	/* longest of them */
+	u_int32_t sp_totusecs;
+};
+
+static int splprof_enabled;
+static vaddr_t splprof_caller;		/* who turned them off; 0 if on */
+static u_int32_t splprof_start;
+static struct splprof_site splprof_sites[SPLPROF_NSITES];
+static unsigned splprof_count, splprof_dropped;
+
+/*
+ * Charge a stretch of USECS to CALLER. Interrupts are off.
+ */
+static
+void
+splprof_record(vaddr_t caller, u_int32_t usecs)
+{
+	struct splprof_site *sp = NULL;
+	int i;
+
+	splprof_count++;
+
+	for (i=0; i<SPLPROF_NSITES; i++) {
+		if (splprof_sites[i].sp_caller == caller) {
+			sp = &splprof_sites[i];
+			break;
+		}
+		if (splprof_sites[i].sp_caller == 0) {
+			sp = &splprof_sites[i];
+			sp->sp_caller = caller;
+			break;
+		}
+	}
+	if (sp == NULL) {
+		/* Full; take the place of the least bad site, if we're worse */
+		for (i=0; i<SPLPROF_NSITES; i++) {
+			if (sp == NULL || splprof_sites[i].sp_maxusecs <
+			    sp->sp_maxusecs) {
+				sp = &splprof_sites[i];
+			}
+		}
+		if (usecs <= sp->sp_maxusecs) {
+			splprof_dropped++;
+			return;
+		}
+		splprof_dropped += sp->sp_count;
+		bzero(sp, sizeof(*sp));
+		sp->sp_caller = caller;
+	}
+
+	sp->sp_count++;
+	sp->sp_totusecs += usecs;
+	if (usecs > sp->sp_maxusecs) {
+		sp->sp_maxusecs = usecs;
+	}
+}
+
+/* Start timing a stretch for CALLER. Interrupts are off. */
+static
+void
+splprof_open(vaddr_t caller)
+{
+	splprof_caller = caller;
+	splprof_start = clock_getusecs();
+}
+
+/* Finish the stretch being timed, if any. Interrupts are off. */
+static
+void
+splprof_close(void)
+{
+	if (splprof_caller != 0) {
+		splprof_record(splprof_caller,
+			       clock_getusecs() - splprof_start);
+		splprof_caller = 0;
+	}
+}
+
+static
 int
-splx(int newspl)
+spl_set(int newspl, vaddr_t caller)
 {
 	int oldspl;
 	
@@ -94,6 +197,11 @@ splx(int newspl)
 	 * minimize the consequences if we slip up accounting for
 	 * interrupts being turned off by exceptions.
 	 */
+	/* Profiling: close the stretch before interrupts come on */
+	if (newspl==0) {
+		splprof_close();
+	}
+
 	if (newspl>0) {
 		interrupts_off();
 	}
@@ -104,20 +212,118 @@ splx(int newspl)
 	oldspl = curspl;
 	curspl = newspl;
 
+	/* Profiling: open a stretch once they're off */
+	if (splprof_enabled && oldspl==0 && newspl>0) {
+		splprof_open(caller);
+	}
+
 	return oldspl;
 }
 
+/*
+ * Profiling hooks for code that sets curspl directly.
+ */
+
+/* An exception came in, and OLDSPL is what curspl was before it. */
+void
+spl_trapentry(int oldspl)
+{
+	if (splprof_enabled && oldspl==0) {
+		splprof_open((vaddr_t) __builtin_return_address(0));
+	}
+}
+
+/* About to return from an exception, or go to user mode, at NEWSPL. */
+void
+spl_trapreturn(int newspl)
+{
+	if (newspl==0) {
+		splprof_close();
+	}
+}
+
+/* About to switch to another thread, with interrupts off. */
+void
+spl_switch(void)
+{
+	if (splprof_caller != 0) {
+		splprof_close();
+		splprof_open((vaddr_t) __builtin_return_address(0));
+	}
+}
+
+/* Set the spl level. */
+int
+splx(int newspl)
+{
+	return spl_set(newspl, (vaddr_t) __builtin_return_address(0));
+}
+
 /* Set spl level to "high". */
 int 
 splhigh(void)
 {
-	return splx(SPL_HIGH);
+	return spl_set(SPL_HIGH, (vaddr_t) __builtin_return_address(0));
 }
 
 int
 spl0(void)
 {
-	return splx(0);
+	return spl_set(0, (vaddr_t) __builtin_return_address(0));
+}
+
+void
+spl_setprofiling(int on)
+{
+	int spl = splhigh();
+
+	if (on && !splprof_enabled) {
+		bzero(splprof_sites, sizeof(splprof_sites));
+		splprof_count = splprof_dropped = 0;
+	}
+	/* our own splhigh above isn't being timed */
+	splprof_caller = 0;
+	splprof_enabled = on;
+
+	splx(spl);
+}
+
+void
+spl_printprofile(void)
+{
+	struct splprof_site *a, *b, tmp;
+	struct splprof_site sites[SPLPROF_NSITES];
+	int i, j;
+
+	int spl = splhigh();
+	memcpy(sites, splprof_sites, sizeof(sites));
+	kprintf("interrupts-off profile (%s): %u stretches, %u dropped\n",
+		splprof_enabled ? "on" : "off", splprof_count,
+		splprof_dropped);
+	splx(spl);
+
+	/* Worst first */
+	for (i=1; i<SPLPROF_NSITES; i++) {
+		for (j=i; j>0; j--) {
+			a = &sites[j-1];
+			b = &sites[j];
+			if (a->sp_maxusecs >= b->sp_maxusecs) {
+				break;
+			}
+			tmp = *a;
+			*a = *b;
+			*b = tmp;
+		}
+	}
+
+	kprintf("  %-10s %8s %10s %10s\n", "caller", "count", "max us",
+		"avg us");
+	for (i=0; i<SPLPROF_NSITES && sites[i].sp_caller != 0; i++) {
+		kprintf("  0x%08lx %8u %10u %10u\n",
+			(unsigned long) sites[i].sp_caller, sites[i].sp_count,
+			sites[i].sp_maxusecs,
+			sites[i].sp_totusecs / sites[i].sp_count);
+	}
 }
 
 /*
@@ -153,6 +359,11 @@ cpu_idle(void)
 	__asm volatile(".long 0x42000020");
 
 	interrupts_onoff();
+
+	/* Waiting in here doesn't keep anyone's interrupts off */
+	if (splprof_caller != 0) {
+		splprof_start = clock_getusecs();
+	}
 }
 
 /*
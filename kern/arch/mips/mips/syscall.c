@@ -125,6 +125,24 @@ mips_syscall(struct trapframe *tf)
 		case SYS_getpid:
 			err = sys_getpid(&retval);
 			break;
+
+		case SYS_nanosleep:
+			err = sys_nanosleep((time_t) tf->tf_a0,
+								tf->tf_a1);
+			break;
+
+		case SYS_schedstats:
+			err = sys_schedstats((pid_t) tf->tf_a0,
+								(userptr_t) tf->tf_a1);
+			break;
+
+		case SYS_spawn:
+			err = sys_spawn((const_userptr_t) tf->tf_a0,
+							(userptr_t) tf->tf_a1,
+							(const_userptr_t) tf->tf_a2,
+							tf->tf_a3,
+							&retval);
+			break;
 	    #endif /* OPT_A2 */
 
 	    default:
@@ -74,6 +74,7 @@ mips_trap(struct trapframe *tf)
 
 	/* Right now, interrupts should be off. */
 	curspl = SPL_HIGH;
+	spl_trapentry(savespl);
 
 	/*
 	 * Extract the exception code info from the register fields.
@@ -213,6 +214,7 @@ mips_trap(struct trapframe *tf)
 	 * The previous context's actual interrupt status flag will
 	 * be restored by the RFE instruction at the end of trap return.
 	 */
+	spl_trapreturn(savespl);
 	curspl = savespl;
 
 	/*
@@ -254,6 +256,7 @@ mips_usermode(struct trapframe *tf)
 	 * explicitly to 0.
 	 */
 	splhigh();
+	spl_trapreturn(0);
 	curspl = 0;
 
 	/*
@@ -102,7 +102,7 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
+	P_io(cs->cs_wsem);
 	cs->cs_send(cs->cs_devdata, ch);
 }
 
@@ -114,7 +114,7 @@ static
 int
 getch_intr(struct con_softc *cs)
 {
-	P(cs->cs_rsem);
+	P_io(cs->cs_rsem);
 	return cs->cs_gotchar;
 }
 
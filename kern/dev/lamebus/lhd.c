@@ -7,6 +7,9 @@
 #include <synch.h>
 #include <kern/errno.h>
 #include <machine/bus.h>
+#include <machine/spl.h>
+#include <clock.h>
+#include <thread.h>
 #include <uio.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -30,6 +33,37 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/* Most sectors to stage through one bounce buffer for user I/O */
+#define LHD_MAXBOUNCE   16
+
+/*
+ * A request for a run of sectors. These live on the stack of the
+ * thread that wants the I/O, which sleeps on the request until the
+ * interrupt handler has done all of it.
+ *
+ * Waiting requests are kept sorted by sector and served in C-SCAN
+ * order: the next one at or past where the head last was, or else
+ * the lowest one, so the arm sweeps one way across the disk. A new
+ * request that continues or precedes a waiting one in the same
+ * direction is merged with it and the two are done back to back.
+ */
+struct lhd_req {
+	u_int32_t lr_sector;		/* first sector */
+	u_int32_t lr_nsect;		/* how many */
+	u_int32_t lr_end;		/* end of the merged run */
+	u_int32_t lr_done;		/* how many done so far */
+	int lr_write;
+	char *lr_data;			/* kernel buffer */
+	int lr_result;
+	int lr_finished;
+	u_int32_t lr_queued;		/* clock_getusecs() when queued */
+	struct lhd_req *lr_next;	/* in lh_queue */
+	struct lhd_req *lr_merged;	/* to do right after this one */
+};
+
+/* All the lhds, for lhd_printstats */
+static struct lhd_softc *lhd_all;
+
 /*
  * Shortcut for reading a register.
  */
@@ -66,15 +100,164 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the next sector of the current request. Interrupts must be
+ * off.
+ */
+static
+void
+lhd_start(struct lhd_softc *lh)
+{
+	struct lhd_req *r = lh->lh_cur;
+	u_int32_t statval = LHD_WORKING;
+
+	assert(curspl>0);
+	assert(r != NULL && r->lr_done < r->lr_nsect);
+
+	if (r->lr_write) {
+		memcpy(lh->lh_buf, r->lr_data + r->lr_done*LHD_SECTSIZE,
+		       LHD_SECTSIZE);
+		statval |= LHD_ISWRITE;
+	}
+
+	lh->lh_headpos = r->lr_sector + r->lr_done;
+	lhd_wreg(lh, LHD_REG_SECT, lh->lh_headpos);
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Take the next request off the queue, in C-SCAN order, and make it
+ * current. Interrupts must be off.
+ */
+static
+void
+lhd_next(struct lhd_softc *lh)
+{
+	struct lhd_req **rp;
+
+	assert(curspl>0);
+	assert(lh->lh_cur == NULL);
+
+	for (rp = &lh->lh_queue; *rp != NULL; rp = &(*rp)->lr_next) {
+		if ((*rp)->lr_sector >= lh->lh_headpos) {
+			break;
+		}
+	}
+	if (*rp == NULL) {
+		/* nothing further on; go back to the start */
+		rp = &lh->lh_queue;
+	}
+
+	lh->lh_cur = *rp;
+	if (lh->lh_cur != NULL) {
+		*rp = lh->lh_cur->lr_next;
+		lh->lh_cur->lr_next = NULL;
+	}
+}
+
+/*
+ * Add a request to the queue, merging it with a waiting request it
+ * runs on from or into if possible. Interrupts must be off.
+ */
+static
+void
+lhd_enqueue(struct lhd_softc *lh, struct lhd_req *r)
+{
+	struct lhd_req **rp, *q;
+
+	assert(curspl>0);
+
+	r->lr_end = r->lr_sector + r->lr_nsect;
+	r->lr_next = NULL;
+	r->lr_merged = NULL;
+
+	lh->lh_depth++;
+	lh->lh_depthsum += lh->lh_depth;
+	if (lh->lh_depth > lh->lh_maxdepth) {
+		lh->lh_maxdepth = lh->lh_depth;
+	}
+
+	for (rp = &lh->lh_queue; *rp != NULL; rp = &(*rp)->lr_next) {
+		q = *rp;
+		if (q->lr_write == r->lr_write && q->lr_end == r->lr_sector) {
+			/* goes on the end of Q's run */
+			while (q->lr_merged != NULL) {
+				q = q->lr_merged;
+			}
+			q->lr_merged = r;
+			(*rp)->lr_end = r->lr_end;
+			lh->lh_nmerged++;
+			return;
+		}
+		if (q->lr_write == r->lr_write && r->lr_end == q->lr_sector) {
+			/* goes in front of Q, and takes its place */
+			r->lr_merged = q;
+			r->lr_end = q->lr_end;
+			r->lr_next = q->lr_next;
+			q->lr_next = NULL;
+			*rp = r;
+			lh->lh_nmerged++;
+			return;
+		}
+		if (q->lr_sector > r->lr_sector) {
+			break;
+		}
+	}
+
+	r->lr_next = *rp;
+	*rp = r;
+}
+
+/*
+ * Record that a sector has completed. Move on to the next sector, or
+ * if the current request is finished, wake up whoever is waiting for
+ * it and start on the next one.
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct lhd_req *r = lh->lh_cur;
+	u_int32_t usecs;
+
+	if (r == NULL) {
+		kprintf("lhd%d: Spurious completion\n", lh->lh_unit);
+		return;
+	}
+
+	if (err) {
+		r->lr_result = err;
+	}
+	else {
+		if (!r->lr_write) {
+			memcpy(r->lr_data + r->lr_done*LHD_SECTSIZE,
+			       lh->lh_buf, LHD_SECTSIZE);
+		}
+		r->lr_done++;
+	}
+
+	if (err || r->lr_done == r->lr_nsect) {
+		/* R may go away once woken, so finish with it first */
+		lh->lh_cur = r->lr_merged;
+
+		usecs = clock_getusecs() - r->lr_queued;
+		lh->lh_svcusecs += usecs;
+		if (usecs > lh->lh_maxsvcusecs) {
+			lh->lh_maxsvcusecs = usecs;
+		}
+		lh->lh_nreqs++;
+		lh->lh_depth--;
+
+		r->lr_finished = 1;
+		thread_wakeup(r);
+
+		if (lh->lh_cur == NULL) {
+			lhd_next(lh);
+		}
+	}
+
+	if (lh->lh_cur != NULL) {
+		lhd_start(lh);
+	}
 }
 
 /*
@@ -164,8 +347,54 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Queue a request for NSECT sectors starting at SECTOR, to or from
+ * kernel buffer DATA, and wait for it. Returns how many sectors were
+ * done in *DONE.
+ */
+static
+int
+lhd_doreq(struct lhd_softc *lh, u_int32_t sector, u_int32_t nsect,
+	  int write, char *data, u_int32_t *done)
+{
+	struct lhd_req r;
+	int spl;
+
+	r.lr_sector = sector;
+	r.lr_nsect = nsect;
+	r.lr_done = 0;
+	r.lr_write = write;
+	r.lr_data = data;
+	r.lr_result = 0;
+	r.lr_finished = 0;
+
+	spl = splhigh();
+
+	r.lr_queued = clock_getusecs();
+	lhd_enqueue(lh, &r);
+
+	/* If the disk was idle, get it going */
+	if (lh->lh_cur == NULL) {
+		lhd_next(lh);
+		lhd_start(lh);
+	}
+
+	while (!r.lr_finished) {
+		thread_sleep_io(&r);
+	}
+
+	splx(spl);
+
+	*done = r.lr_done;
+	return r.lr_result;
+}
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * Kernel buffers are handed to the disk queue as they are. For user
+ * buffers the interrupt handler can't get at, the data is staged
+ * through a kernel bounce buffer, LHD_MAXBOUNCE sectors at a time.
  */
 static
 int
@@ -177,9 +406,11 @@ lhd_io(struct device *d, struct uio *uio)
 	u_int32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	u_int32_t len = uio->uio_resid / LHD_SECTSIZE;
 	u_int32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	u_int32_t i;
-	u_int32_t statval = LHD_WORKING;
-	int result;
+	int write = (uio->uio_rw == UIO_WRITE);
+	u_int32_t n, done;
+	size_t bytes;
+	char *buf;
+	int result = 0;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -191,59 +422,93 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		result = lhd_doreq(lh, sector, len, write,
+				   uio->uio_iovec.iov_kbase, &done);
+
+		/* Account for what got done, as uiomove would have */
+		bytes = done * LHD_SECTSIZE;
+		uio->uio_iovec.iov_kbase =
+			(char *)uio->uio_iovec.iov_kbase + bytes;
+		uio->uio_iovec.iov_len -= bytes;
+		uio->uio_offset += bytes;
+		uio->uio_resid -= bytes;
+		return result;
+	}
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	buf = kmalloc((len < LHD_MAXBOUNCE ? len : LHD_MAXBOUNCE)
+		      * LHD_SECTSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	while (len > 0) {
+		n = len < LHD_MAXBOUNCE ? len : LHD_MAXBOUNCE;
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		if (write) {
+			result = uiomove(buf, n*LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
 
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
+		result = lhd_doreq(lh, sector, n, write, buf, &done);
 
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		if (!write && done > 0) {
+			int result2 = uiomove(buf, done*LHD_SECTSIZE, uio);
+			if (result == 0) {
+				result = result2;
+			}
 		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
 		if (result) {
-			return result;
+			break;
 		}
+
+		sector += n;
+		len -= n;
 	}
 
-	return 0;
+	kfree(buf);
+	return result;
+}
+
+/*
+ * Print the queue statistics.
+ */
+void
+lhd_printstats(void)
+{
+	struct lhd_softc *lh;
+	u_int32_t nreqs, nmerged, depth, maxdepth, depthsum;
+	u_int32_t svcusecs, maxsvcusecs, avgdepth, arrivals;
+	int spl;
+
+	for (lh = lhd_all; lh != NULL; lh = lh->lh_next) {
+		spl = splhigh();
+		nreqs = lh->lh_nreqs;
+		nmerged = lh->lh_nmerged;
+		depth = lh->lh_depth;
+		maxdepth = lh->lh_maxdepth;
+		depthsum = lh->lh_depthsum;
+		svcusecs = lh->lh_svcusecs;
+		maxsvcusecs = lh->lh_maxsvcusecs;
+		splx(spl);
+
+		/* hundredths */
+		arrivals = nreqs + depth;
+		avgdepth = arrivals > 0 ? depthsum * 100 / arrivals : 0;
+
+		kprintf("lhd%d: %u requests, %u merged\n", lh->lh_unit,
+			nreqs, nmerged);
+		kprintf("    queue depth: %u now, %u max, %u.%02u avg\n",
+			depth, maxdepth, avgdepth / 100, avgdepth % 100);
+		kprintf("    service time: %u us max, %u us avg\n",
+			maxsvcusecs, nreqs > 0 ? svcusecs / nreqs : 0);
+	}
 }
 
 /*
@@ -253,6 +518,7 @@ int
 config_lhd(struct lhd_softc *lh, int lhdno)
 {
 	char name[32];
+	int result;
 
 	/* Figure out what our name is. */
 	snprintf(name, sizeof(name), "lhd%d", lhdno);
@@ -260,17 +526,18 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
-	}
+	/* Nothing queued yet. */
+	lh->lh_queue = NULL;
+	lh->lh_cur = NULL;
+	lh->lh_headpos = 0;
+
+	lh->lh_nreqs = 0;
+	lh->lh_nmerged = 0;
+	lh->lh_depth = 0;
+	lh->lh_maxdepth = 0;
+	lh->lh_depthsum = 0;
+	lh->lh_svcusecs = 0;
+	lh->lh_maxsvcusecs = 0;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_open = lhd_open;
@@ -283,5 +550,12 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	lh->lh_dev.d_data = lh;
 
 	/* Add the VFS device structure to the VFS device list. */
-	return vfs_adddev(name, &lh->lh_dev, 1);
+	result = vfs_adddev(name, &lh->lh_dev, 1);
+	if (result) {
+		return result;
+	}
+
+	lh->lh_next = lhd_all;
+	lhd_all = lh;
+	return 0;
 }
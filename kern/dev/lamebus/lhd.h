@@ -8,6 +8,8 @@
  */
 #define LHD_SECTSIZE  512
 
+struct lhd_req;	/* Opaque. */
+
 /*
  * Hardware device data associated with lhd (LAMEbus hard disk)
  */
@@ -22,9 +24,25 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+
+	/*
+	 * Request queue. Protected by disabling interrupts; the
+	 * interrupt handler starts each request when the last finishes.
+	 */
+	struct lhd_req *lh_queue;	/* waiting, in order of sector */
+	struct lhd_req *lh_cur;		/* being done now, or NULL */
+	u_int32_t lh_headpos;		/* sector last started */
+
+	/* Statistics */
+	u_int32_t lh_nreqs;		/* requests completed */
+	u_int32_t lh_nmerged;		/* ...that were merged into another */
+	u_int32_t lh_depth;		/* requests outstanding now */
+	u_int32_t lh_maxdepth;
+	u_int32_t lh_depthsum;		/* lh_depth seen by each arrival */
+	u_int32_t lh_svcusecs;		/* total time from queue to done */
+	u_int32_t lh_maxsvcusecs;
+
+	struct lhd_softc *lh_next;	/* all lhds, for lhd_printstats */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -32,4 +50,7 @@ struct lhd_softc {
 /* Functions called by lower-level drivers */
 void lhd_irq(/*struct lhd_softc*/ void *);	/* Interrupt handler */
 
+/* Print request queue statistics for every lhd */
+void lhd_printstats(void);
+
 #endif /* _LAMEBUS_LHD_H_ */
@@ -22,6 +22,19 @@
 
 static int haveclock=0;
 
+/*
+ * Set the hardclock countdown. With restart-on-expiry set it keeps
+ * going off every USECS until set again.
+ */
+static
+void
+ltimer_arm(void *vlt, u_int32_t usecs)
+{
+	struct ltimer_softc *lt = vlt;
+
+	bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT, usecs);
+}
+
 /*
  * Setup routine called by autoconf stuff when an ltimer is found.
  */
@@ -38,13 +51,14 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 
 		/*
 		 * Arm the timer to go off HZ times a second, and set
-		 * it to autoreload (so we don't need to pay any more
-		 * attention to it)
+		 * it to autoreload. hardclock sets it for longer
+		 * whenever there's nothing to do for a while.
 		 */
 
 		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 1);
 		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
 				   LT_GRANULARITY/HZ);
+		hardclock_attach(lt, ltimer_arm, ltimer_gettime);
 
 		kprintf("\nhardclock on ltimer%d (%u hz)", ltimerno, HZ);
 	}
@@ -0,0 +1,768 @@
+/*
+ * SFS filesystem
+ *
+ * Buffer cache. See sfs.h for the interface.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <synch.h>
+#include <thread.h>
+#include <curthread.h>
+#include <uio.h>
+#include <sfs.h>
+
+#define SFS_BUFHASHFN(block)  ((block) & (SFS_BUFHASH-1))
+
+/*
+ * Read-ahead queue, shared by all volumes: a ring of blocks for the
+ * read-ahead thread to bring into the cache.
+ */
+struct sfs_rareq {
+	struct sfs_fs *ra_sfs;
+	u_int32_t ra_block;
+};
+
+static struct lock *ra_lock;
+static struct cv *ra_work;		/* something was queued */
+static struct cv *ra_idle;		/* a thread finished a request */
+static struct sfs_rareq ra_queue[SFS_RAQUEUE];
+static int ra_head, ra_count;
+static struct sfs_rareq ra_busy[SFS_RATHREADS]; /* what each thread is */
+						/*   reading; ra_sfs NULL if idle */
+
+////////////////////////////////////////////////////////////
+//
+// List maintenance. The cache lock must be held.
+
+static
+struct sfs_buf *
+sfs_bfind(struct sfs_bufcache *bc, u_int32_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = bc->bc_hash[SFS_BUFHASHFN(block)]; b != NULL;
+	     b = b->sb_hashnext) {
+		if (b->sb_block == block) {
+			assert(b->sb_inuse);
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+sfs_bhash(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	struct sfs_buf **bucket = &bc->bc_hash[SFS_BUFHASHFN(b->sb_block)];
+
+	b->sb_hashnext = *bucket;
+	*bucket = b;
+}
+
+static
+void
+sfs_bunhash(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	struct sfs_buf **bp;
+
+	for (bp = &bc->bc_hash[SFS_BUFHASHFN(b->sb_block)]; *bp != b;
+	     bp = &(*bp)->sb_hashnext) {
+		assert(*bp != NULL);
+	}
+	*bp = b->sb_hashnext;
+	b->sb_hashnext = NULL;
+}
+
+static
+void
+sfs_blruremove(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	if (b->sb_lruprev != NULL) {
+		b->sb_lruprev->sb_lrunext = b->sb_lrunext;
+	}
+	else {
+		bc->bc_lruhead = b->sb_lrunext;
+	}
+	if (b->sb_lrunext != NULL) {
+		b->sb_lrunext->sb_lruprev = b->sb_lruprev;
+	}
+	else {
+		bc->bc_lrutail = b->sb_lruprev;
+	}
+}
+
+/* Make B the most recently used. */
+static
+void
+sfs_blrutouch(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	sfs_blruremove(bc, b);
+	b->sb_lruprev = NULL;
+	b->sb_lrunext = bc->bc_lruhead;
+	if (bc->bc_lruhead != NULL) {
+		bc->bc_lruhead->sb_lruprev = b;
+	}
+	bc->bc_lruhead = b;
+	if (bc->bc_lrutail == NULL) {
+		bc->bc_lrutail = b;
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Buffer management. The cache lock must be held. Anything that does
+// device I/O marks the buffer busy and drops the lock meanwhile.
+
+/* Done with I/O on B; let anyone waiting for it go. */
+static
+void
+sfs_bunbusy(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	assert(b->sb_busy);
+	b->sb_busy = 0;
+	cv_broadcast(bc->bc_iodone, bc->bc_lock);
+}
+
+static
+int
+sfs_bwriteback(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	struct sfs_bufcache *bc = &sfs->sfs_bufcache;
+	int result;
+
+	assert(b->sb_inuse && b->sb_dirty && !b->sb_busy);
+
+	/* If it's pinned, it may be dirtied again while we write */
+	b->sb_busy = 1;
+	b->sb_dirty = 0;
+
+	lock_release(bc->bc_lock);
+	result = sfs_wblock(sfs, b->sb_data, b->sb_block);
+	lock_acquire(bc->bc_lock);
+
+	sfs_bunbusy(bc, b);
+	if (result) {
+		b->sb_dirty = 1;
+		return result;
+	}
+	bc->bc_writebacks++;
+	return 0;
+}
+
+/*
+ * Read B's block into it. On failure B goes back to holding nothing.
+ */
+static
+int
+sfs_bfill(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	struct sfs_bufcache *bc = &sfs->sfs_bufcache;
+	int result;
+
+	assert(b->sb_inuse && !b->sb_dirty && !b->sb_busy);
+
+	b->sb_busy = 1;
+
+	lock_release(bc->bc_lock);
+	result = sfs_rblock(sfs, b->sb_data, b->sb_block);
+	lock_acquire(bc->bc_lock);
+
+	sfs_bunbusy(bc, b);
+	if (result) {
+		sfs_bunhash(bc, b);
+		b->sb_inuse = 0;
+	}
+	return result;
+}
+
+/*
+ * Find BLOCK in the cache, waiting out any I/O on it first.
+ */
+static
+struct sfs_buf *
+sfs_bfindidle(struct sfs_bufcache *bc, u_int32_t block)
+{
+	struct sfs_buf *b;
+
+	while ((b = sfs_bfind(bc, block)) != NULL && b->sb_busy) {
+		cv_wait(bc->bc_iodone, bc->bc_lock);
+	}
+	return b;
+}
+
+/*
+ * Find a buffer to hold a block we don't have: the least recently
+ * used one that isn't pinned or busy. If it's dirty it gets written
+ * back, or if all the unpinned ones are busy we wait for one; either
+ * way the cache was unlocked, so *RET is NULL and the caller has to
+ * look for its block again.
+ *
+ * If every buffer is pinned, that only lasts until someone calls
+ * sfs_brelse, so wait for that too if CANWAIT is set; read-ahead
+ * would rather give up (EAGAIN). It's only hopeless if the pins are
+ * all our own.
+ */
+static
+int
+sfs_bvictim(struct sfs_fs *sfs, int canwait, struct sfs_buf **ret)
+{
+	struct sfs_bufcache *bc = &sfs->sfs_bufcache;
+	struct sfs_buf *b;
+	int sawbusy = 0;
+
+	*ret = NULL;
+
+	for (b = bc->bc_lrutail; b != NULL; b = b->sb_lruprev) {
+		if (b->sb_refcount == 0 && !b->sb_busy) {
+			break;
+		}
+		if (b->sb_refcount == 0) {
+			sawbusy = 1;
+		}
+	}
+	if (b == NULL && sawbusy) {
+		cv_wait(bc->bc_iodone, bc->bc_lock);
+		return 0;
+	}
+	if (b == NULL) {
+		/* Everything is pinned */
+		if (!canwait) {
+			return EAGAIN;
+		}
+		if (curthread->t_bufpins >= bc->bc_nbufs) {
+			panic("sfs: %s has all %d buffers pinned\n",
+			      curthread->t_name, bc->bc_nbufs);
+		}
+		bc->bc_pinwaits++;
+		cv_wait(bc->bc_unpinned, bc->bc_lock);
+		return 0;
+	}
+
+	if (b->sb_inuse && b->sb_dirty) {
+		return sfs_bwriteback(sfs, b);
+	}
+	if (b->sb_inuse) {
+		sfs_bunhash(bc, b);
+		b->sb_inuse = 0;
+	}
+
+	*ret = b;
+	return 0;
+}
+
+/* Make B, from sfs_bvictim, hold BLOCK. Its contents are undefined. */
+static
+void
+sfs_bclaim(struct sfs_bufcache *bc, struct sfs_buf *b, u_int32_t block)
+{
+	b->sb_block = block;
+	b->sb_inuse = 1;
+	b->sb_dirty = 0;
+	sfs_bhash(bc, b);
+}
+
+/*
+ * Common code for sfs_bread and sfs_bget.
+ */
+static
+int
+sfs_bgetbuf(struct sfs_fs *sfs, u_int32_t block, int doread,
+	    struct sfs_buf **ret)
+{
+	struct sfs_bufcache *bc = &sfs->sfs_bufcache;
+	struct sfs_buf *b;
+	int result;
+
+	assert(block != SFS_SB_LOCATION);
+	assert(block < sfs->sfs_super.sp_nblocks);
+
+	lock_acquire(bc->bc_lock);
+
+	for (;;) {
+		b = sfs_bfindidle(bc, block);
+		if (b != NULL) {
+			bc->bc_hits++;
+			break;
+		}
+
+		result = sfs_bvictim(sfs, 1, &b);
+		if (result) {
+			lock_release(bc->bc_lock);
+			return result;
+		}
+		if (b == NULL) {
+			/* The cache was unlocked; someone may have read it */
+			continue;
+		}
+
+		bc->bc_misses++;
+		sfs_bclaim(bc, b, block);
+		if (doread) {
+			result = sfs_bfill(sfs, b);
+			if (result) {
+				lock_release(bc->bc_lock);
+				return result;
+			}
+		}
+		break;
+	}
+
+	b->sb_refcount++;
+	curthread->t_bufpins++;
+	sfs_blrutouch(bc, b);
+
+	lock_release(bc->bc_lock);
+
+	*ret = b;
+	return 0;
+}
+
+int
+sfs_bread(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret)
+{
+	return sfs_bgetbuf(sfs, block, 1, ret);
+}
+
+int
+sfs_bget(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret)
+{
+	return sfs_bgetbuf(sfs, block, 0, ret);
+}
+
+struct sfs_buf *
+sfs_bpeek(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_bufcache *bc = &sfs->sfs_bufcache;
+	struct sfs_buf *b;
+
+	lock_acquire(bc->bc_lock);
+	b = sfs_bfindidle(bc, block);
+	if (b != NULL) {
+		bc->bc_hits++;
+		b->sb_refcount++;
+		curthread->t_bufpins++;
+		sfs_blrutouch(bc, b);
+	}
+	lock_release(bc->bc_lock);
+
+	return b;
+}
+
+/*
+ * BLOCK was just written around the cache. If a copy got read in
+ * meanwhile (by read-ahead, say), it's out of date; drop it. If it's
+ * pinned, take it out of the hash so nobody else finds it, and let
+ * sfs_brelse free it when the last pin goes.
+ */
+void
+sfs_bforget(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_bufcache *bc = &sfs->sfs_bufcache;
+	struct sfs_buf *b;
+
+	lock_acquire(bc->bc_lock);
+	b = sfs_bfindidle(bc, block);
+	if (b != NULL && !b->sb_dirty) {
+		sfs_bunhash(bc, b);
+		if (b->sb_refcount == 0) {
+			b->sb_inuse = 0;
+		}
+		else {
+			b->sb_stale = 1;
+		}
+	}
+	lock_release(bc->bc_lock);
+}
+
+void
+sfs_bdirty(struct sfs_buf *b)
+{
+	assert(b->sb_refcount > 0);
+	b->sb_dirty = 1;
+}
+
+void
+sfs_brelse(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	struct sfs_bufcache *bc = &sfs->sfs_bufcache;
+
+	lock_acquire(bc->bc_lock);
+	assert(b->sb_refcount > 0);
+	assert(curthread->t_bufpins > 0);
+	b->sb_refcount--;
+	curthread->t_bufpins--;
+	if (b->sb_refcount == 0) {
+		if (b->sb_stale) {
+			/*
+			 * Already unhashed by sfs_bforget. If a holder
+			 * wrote to it meanwhile, it lost the race with
+			 * the direct write.
+			 */
+			b->sb_stale = 0;
+			b->sb_dirty = 0;
+			b->sb_inuse = 0;
+		}
+		cv_broadcast(bc->bc_unpinned, bc->bc_lock);
+	}
+	lock_release(bc->bc_lock);
+}
+
+/*
+ * Write back every dirty buffer, in block order so the disk sweeps
+ * across once.
+ */
+int
+sfs_bsync(struct sfs_fs *sfs)
+{
+	struct sfs_bufcache *bc = &sfs->sfs_bufcache;
+	struct sfs_buf *b, *next;
+	u_int32_t last = 0;
+	int i, result = 0;
+
+	lock_acquire(bc->bc_lock);
+	for (;;) {
+		/* lowest dirty block past the last one written */
+		next = NULL;
+		for (i=0; i<bc->bc_nbufs; i++) {
+			b = &bc->bc_bufs[i];
+			if (b->sb_inuse && b->sb_dirty && !b->sb_stale &&
+			    b->sb_block > last &&
+			    (next == NULL || b->sb_block < next->sb_block)) {
+				next = b;
+			}
+		}
+		if (next == NULL) {
+			break;
+		}
+		if (next->sb_busy) {
+			/* dirtied again while being written; wait and see */
+			cv_wait(bc->bc_iodone, bc->bc_lock);
+			continue;
+		}
+		result = sfs_bwriteback(sfs, next);
+		if (result) {
+			break;
+		}
+		last = next->sb_block;
+	}
+	lock_release(bc->bc_lock);
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Read-ahead
+
+/*
+ * Bring BLOCK into the cache if it isn't there already. Unlike
+ * sfs_bread, this leaves the buffer unpinned and the hit count alone.
+ * The buffer is hashed (and busy) while the read is going, so a read
+ * of the same block meanwhile waits for it instead of reading again.
+ */
+static
+void
+sfs_bfetch(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_bufcache *bc = &sfs->sfs_bufcache;
+	struct sfs_buf *b;
+
+	lock_acquire(bc->bc_lock);
+	for (;;) {
+		if (sfs_bfind(bc, block) != NULL) {
+			break;
+		}
+		if (sfs_bvictim(sfs, 0, &b)) {
+			break;
+		}
+		if (b == NULL) {
+			continue;
+		}
+		sfs_bclaim(bc, b, block);
+		if (sfs_bfill(sfs, b) == 0) {
+			sfs_blrutouch(bc, b);
+			bc->bc_prefetches++;
+		}
+		break;
+	}
+	lock_release(bc->bc_lock);
+}
+
+static
+void
+sfs_radaemon(void *unused, unsigned long me)
+{
+	struct sfs_rareq req;
+
+	(void)unused;
+
+	lock_acquire(ra_lock);
+	for (;;) {
+		while (ra_count == 0) {
+			cv_wait(ra_work, ra_lock);
+		}
+		req = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % SFS_RAQUEUE;
+		ra_count--;
+		ra_busy[me] = req;
+		lock_release(ra_lock);
+
+		sfs_bfetch(req.ra_sfs, req.ra_block);
+
+		lock_acquire(ra_lock);
+		ra_busy[me].ra_sfs = NULL;
+		cv_broadcast(ra_idle, ra_lock);
+	}
+}
+
+void
+sfs_bprefetch(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_rareq *req;
+
+	lock_acquire(ra_lock);
+	if (ra_count < SFS_RAQUEUE) {
+		req = &ra_queue[(ra_head + ra_count) % SFS_RAQUEUE];
+		req->ra_sfs = sfs;
+		req->ra_block = block;
+		ra_count++;
+		cv_signal(ra_work, ra_lock);
+	}
+	lock_release(ra_lock);
+}
+
+/*
+ * A read is about to go to the disk for BLOCK. If read-ahead has it
+ * queued, or is reading it now, take it off the queue and return 1:
+ * the caller should read it through the cache, so that it's only read
+ * once. Otherwise return 0.
+ */
+int
+sfs_bprefetch_pending(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_rareq *req;
+	int i, found = 0;
+
+	lock_acquire(ra_lock);
+	for (i=0; i<SFS_RATHREADS; i++) {
+		if (ra_busy[i].ra_sfs == sfs && ra_busy[i].ra_block == block) {
+			found = 1;
+		}
+	}
+	for (i=0; i<ra_count && !found; i++) {
+		req = &ra_queue[(ra_head+i) % SFS_RAQUEUE];
+		if (req->ra_sfs == sfs && req->ra_block == block) {
+			/* close up the gap */
+			for (; i<ra_count-1; i++) {
+				ra_queue[(ra_head+i) % SFS_RAQUEUE] =
+					ra_queue[(ra_head+i+1) % SFS_RAQUEUE];
+			}
+			ra_count--;
+			found = 1;
+		}
+	}
+	lock_release(ra_lock);
+
+	return found;
+}
+
+/*
+ * Forget any read-ahead for SFS, and wait out any in progress.
+ */
+void
+sfs_bprefetch_cancel(struct sfs_fs *sfs)
+{
+	int i, n, keep, busy;
+
+	lock_acquire(ra_lock);
+
+	n = ra_count;
+	keep = 0;
+	for (i=0; i<n; i++) {
+		struct sfs_rareq *req = &ra_queue[(ra_head+i) % SFS_RAQUEUE];
+		if (req->ra_sfs != sfs) {
+			ra_queue[(ra_head+keep) % SFS_RAQUEUE] = *req;
+			keep++;
+		}
+	}
+	ra_count = keep;
+
+	do {
+		busy = 0;
+		for (i=0; i<SFS_RATHREADS; i++) {
+			if (ra_busy[i].ra_sfs == sfs) {
+				busy = 1;
+			}
+		}
+		if (busy) {
+			cv_wait(ra_idle, ra_lock);
+		}
+	} while (busy);
+
+	lock_release(ra_lock);
+}
+
+/*
+ * Start the read-ahead threads. Called on every mount; only the first
+ * one does anything.
+ */
+int
+sfs_readahead_init(void)
+{
+	int i, result;
+
+	if (ra_lock != NULL) {
+		return 0;
+	}
+
+	ra_work = cv_create("sfs readahead");
+	ra_idle = cv_create("sfs readahead idle");
+	ra_lock = lock_create("sfs readahead");
+	if (ra_work == NULL || ra_idle == NULL || ra_lock == NULL) {
+		goto fail;
+	}
+	ra_head = ra_count = 0;
+	for (i=0; i<SFS_RATHREADS; i++) {
+		ra_busy[i].ra_sfs = NULL;
+	}
+
+	for (i=0; i<SFS_RATHREADS; i++) {
+		result = thread_fork("sfs readahead", NULL, i, sfs_radaemon,
+				     NULL);
+		if (result && i == 0) {
+			goto fail;
+		}
+		if (result) {
+			/* make do with the ones we have */
+			break;
+		}
+	}
+	return 0;
+
+ fail:
+	if (ra_lock != NULL) {
+		lock_destroy(ra_lock);
+		ra_lock = NULL;
+	}
+	if (ra_idle != NULL) {
+		cv_destroy(ra_idle);
+		ra_idle = NULL;
+	}
+	if (ra_work != NULL) {
+		cv_destroy(ra_work);
+		ra_work = NULL;
+	}
+	return ENOMEM;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Setup and teardown
+
+int
+sfs_bcache_init(struct sfs_fs *sfs)
+{
+	struct sfs_bufcache *bc = &sfs->sfs_bufcache;
+	struct sfs_buf *b;
+	int i;
+
+	bc->bc_lock = lock_create("sfs bufcache");
+	if (bc->bc_lock == NULL) {
+		return ENOMEM;
+	}
+	bc->bc_iodone = cv_create("sfs bufcache io");
+	if (bc->bc_iodone == NULL) {
+		lock_destroy(bc->bc_lock);
+		return ENOMEM;
+	}
+	bc->bc_unpinned = cv_create("sfs bufcache unpin");
+	if (bc->bc_unpinned == NULL) {
+		cv_destroy(bc->bc_iodone);
+		lock_destroy(bc->bc_lock);
+		return ENOMEM;
+	}
+
+	bc->bc_nbufs = SFS_CACHESIZE / sfs->sfs_blocksize;
+	if (bc->bc_nbufs < SFS_MINBUFS) {
+		bc->bc_nbufs = SFS_MINBUFS;
+	}
+
+	bc->bc_bufs = kmalloc(bc->bc_nbufs * sizeof(struct sfs_buf));
+	if (bc->bc_bufs == NULL) {
+		cv_destroy(bc->bc_unpinned);
+		cv_destroy(bc->bc_iodone);
+		lock_destroy(bc->bc_lock);
+		return ENOMEM;
+	}
+
+	for (i=0; i<SFS_BUFHASH; i++) {
+		bc->bc_hash[i] = NULL;
+	}
+	bc->bc_lruhead = bc->bc_lrutail = NULL;
+	bc->bc_hits = bc->bc_misses = bc->bc_writebacks = 0;
+	bc->bc_prefetches = bc->bc_pinwaits = 0;
+
+	for (i=0; i<bc->bc_nbufs; i++) {
+		b = &bc->bc_bufs[i];
+		b->sb_block = 0;
+		b->sb_inuse = 0;
+		b->sb_dirty = 0;
+		b->sb_refcount = 0;
+		b->sb_busy = 0;
+		b->sb_stale = 0;
+		b->sb_hashnext = NULL;
+		b->sb_data = kmalloc(sfs->sfs_blocksize);
+		if (b->sb_data == NULL) {
+			while (--i >= 0) {
+				kfree(bc->bc_bufs[i].sb_data);
+			}
+			kfree(bc->bc_bufs);
+			cv_destroy(bc->bc_unpinned);
+			cv_destroy(bc->bc_iodone);
+			lock_destroy(bc->bc_lock);
+			return ENOMEM;
+		}
+
+		/* all unused, so order doesn't matter */
+		b->sb_lruprev = bc->bc_lrutail;
+		b->sb_lrunext = NULL;
+		if (bc->bc_lrutail != NULL) {
+			bc->bc_lrutail->sb_lrunext = b;
+		}
+		else {
+			bc->bc_lruhead = b;
+		}
+		bc->bc_lrutail = b;
+	}
+
+	return 0;
+}
+
+/*
+ * Throw the cache away. Everything should have been synced.
+ */
+void
+sfs_bcache_destroy(struct sfs_fs *sfs)
+{
+	struct sfs_bufcache *bc = &sfs->sfs_bufcache;
+	int i;
+
+	DEBUG(DB_SFS, "sfs: buffer cache: %u hits, %u misses, "
+	      "%u writebacks, %u read ahead, %u waits for a pin\n",
+	      bc->bc_hits, bc->bc_misses, bc->bc_writebacks,
+	      bc->bc_prefetches, bc->bc_pinwaits);
+
+	for (i=0; i<bc->bc_nbufs; i++) {
+		assert(bc->bc_bufs[i].sb_refcount == 0);
+		assert(bc->bc_bufs[i].sb_dirty == 0);
+		assert(bc->bc_bufs[i].sb_busy == 0);
+		kfree(bc->bc_bufs[i].sb_data);
+	}
+	kfree(bc->bc_bufs);
+	cv_destroy(bc->bc_unpinned);
+	cv_destroy(bc->bc_iodone);
+	lock_destroy(bc->bc_lock);
+}
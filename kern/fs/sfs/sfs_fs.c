@@ -7,7 +7,6 @@
 #include <types.h>
 #include <lib.h>
 #include <kern/errno.h>
-#include <array.h>
 #include <bitmap.h>
 #include <uio.h>
 #include <dev.h>
@@ -15,24 +14,29 @@
 #include <vfs.h>
 
 /* Shortcuts for the size macros in kern/sfs.h */
-#define SFS_FS_BITMAPSIZE(sfs)  SFS_BITMAPSIZE((sfs)->sfs_super.sp_nblocks)
-#define SFS_FS_BITBLOCKS(sfs)   SFS_BITBLOCKS((sfs)->sfs_super.sp_nblocks)
+#define SFS_FS_BITMAPSIZE(sfs) \
+	SFS_BITMAPSIZE((sfs)->sfs_super.sp_nblocks, (sfs)->sfs_blocksize)
+#define SFS_FS_BITBLOCKS(sfs) \
+	SFS_BITBLOCKS((sfs)->sfs_super.sp_nblocks, (sfs)->sfs_blocksize)
+
+/* Superblock features this code understands */
+#define SFS_FEATURES_KNOWN      SFS_FEATURE_DIRHASH
 
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
  * We always do the whole bitmap at once; writing individual sectors
  * might or might not be a worthwhile optimization.
  *
- * The free block bitmap consists of SFS_BITBLOCKS 512-byte sectors of
- * bits, one bit for each sector on the filesystem. The number of
- * blocks in the bitmap is thus rounded up to the nearest multiple of
- * 512*8 = 4096. (This rounded number is SFS_BITMAPSIZE.) This means
- * that the bitmap will (in general) contain space for some number of
- * invalid sectors that are actually beyond the end of the disk
- * device. This is ok. These sectors are supposed to be marked "in
- * use" by mksfs and never get marked "free".
+ * The free block bitmap consists of SFS_BITBLOCKS blocks of bits, one
+ * bit for each block on the filesystem. The number of blocks in the
+ * bitmap is thus rounded up to the nearest multiple of the bits in a
+ * block (4096 for 512-byte blocks). (This rounded number is
+ * SFS_BITMAPSIZE.) This means that the bitmap will (in general)
+ * contain space for some number of invalid blocks that are actually
+ * beyond the end of the disk device. This is ok. These blocks are
+ * supposed to be marked "in use" by mksfs and never get marked "free".
  *
- * The sectors used by the superblock and the bitmap itself are
+ * The blocks used by the superblock and the bitmap itself are
  * likewise marked in use by mksfs.
  */
 
@@ -50,13 +54,13 @@ sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 	/* Pointer to our bitmap data in memory. */
 	bitdata = bitmap_getdata(sfs->sfs_freemap);
 	
-	/* For each sector in the bitmap... */
+	/* For each block in the bitmap... */
 	for (j=0; j<mapsize; j++) {
 
 		/* Get a pointer to its data */
-		void *ptr = bitdata + j*SFS_BLOCKSIZE;
+		void *ptr = bitdata + j*sfs->sfs_blocksize;
 
-		/* and read or write it. The bitmap starts at sector 2. */ 
+		/* and read or write it. The bitmap starts at block 2. */ 
 		if (rw == UIO_READ) {
 			result = sfs_rblock(sfs, ptr, SFS_MAP_LOCATION+j);
 		}
@@ -82,7 +86,8 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs; 
-	int i, num, result;
+	struct sfs_vnode *sv;
+	int i, result;
 
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
@@ -116,11 +121,17 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = array_getnum(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct sfs_vnode *sv = array_getguy(sfs->sfs_vnodes, i);
-		VOP_FSYNC(&sv->sv_v);
+	/* Go over the table of loaded vnodes, syncing as we go. */
+	for (i=0; i<SFS_VNHASH; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL; sv = sv->sv_hashnext) {
+			VOP_FSYNC(&sv->sv_v);
+		}
+	}
+
+	/* Write back whatever is still dirty in the buffer cache */
+	result = sfs_bsync(sfs);
+	if (result) {
+		return result;
 	}
 
 	/* If the free block map needs to be written, write it. */
@@ -134,7 +145,7 @@ sfs_sync(struct fs *fs)
 
 	/* If the superblock needs to be written, write it. */
 	if (sfs->sfs_superdirty) {
-		result = sfs_wblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
+		result = sfs_rwsuper(sfs, UIO_WRITE);
 		if (result) {
 			return result;
 		}
@@ -169,7 +180,7 @@ sfs_unmount(struct fs *fs)
 	struct sfs_fs *sfs = fs->fs_data;
 	
 	/* Do we have any files open? If so, can't unmount. */
-	if (array_getnum(sfs->sfs_vnodes)>0) {
+	if (sfs->sfs_nvnodes>0) {
 		return EBUSY;
 	}
 
@@ -178,8 +189,9 @@ sfs_unmount(struct fs *fs)
 	assert(sfs->sfs_freemapdirty==0);
 
 	/* Once we start nuking stuff we can't fail. */
-	array_destroy(sfs->sfs_vnodes);
+	sfs_bprefetch_cancel(sfs);
 	bitmap_destroy(sfs->sfs_freemap);
+	sfs_bcache_destroy(sfs);
 	
 	/* The vfs layer takes care of the device for us */
 	(void)sfs->sfs_device;
@@ -209,7 +221,7 @@ static
 int
 sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
-	int result;
+	int i, result;
 	struct sfs_fs *sfs;
 
 	/* We don't pass any options through mount */
@@ -218,42 +230,48 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/*
 	 * Make sure our on-disk structures aren't messed up
 	 */
-	assert(sizeof(struct sfs_super)==SFS_BLOCKSIZE);
-	assert(sizeof(struct sfs_inode)==SFS_BLOCKSIZE);
-	assert(SFS_BLOCKSIZE % sizeof(struct sfs_dir) == 0);
+	assert(sizeof(struct sfs_super)==SFS_MINBLOCKSIZE);
+	assert(sizeof(struct sfs_inode)==SFS_MINBLOCKSIZE);
+	assert(SFS_MINBLOCKSIZE % sizeof(struct sfs_dir) == 0);
 
 	/*
-	 * We can't mount on devices with the wrong sector size.
-	 *
-	 * (Note: for all intents and purposes here, "sector" and
-	 * "block" are interchangeable terms. Technically a filesystem
-	 * block may be composed of several hardware sectors, but we
-	 * don't do that in sfs.)
+	 * We can't mount on devices whose sectors don't fit evenly in
+	 * our smallest block, as then we couldn't read the superblock.
+	 * A filesystem block may be several sectors; that's checked
+	 * once we know the block size.
 	 */
-	if (dev->d_blocksize != SFS_BLOCKSIZE) {
+	if (dev->d_blocksize == 0 || SFS_MINBLOCKSIZE % dev->d_blocksize) {
 		return ENXIO;
 	}
 
+	result = sfs_vnodecache_init();
+	if (result) {
+		return result;
+	}
+	result = sfs_readahead_init();
+	if (result) {
+		return result;
+	}
+
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
 	if (sfs==NULL) {
 		return ENOMEM;
 	}
 
-	/* Allocate array */
-	sfs->sfs_vnodes = array_create();
-	if (sfs->sfs_vnodes == NULL) {
-		kfree(sfs);
-		return ENOMEM;
+	/* No vnodes loaded yet */
+	for (i=0; i<SFS_VNHASH; i++) {
+		sfs->sfs_vnhash[i] = NULL;
 	}
+	sfs->sfs_nvnodes = 0;
 
-	/* Set the device so we can use sfs_rblock() */
+	/* Set the device so we can use sfs_rwsuper() */
 	sfs->sfs_device = dev;
+	sfs->sfs_blocksize = SFS_MINBLOCKSIZE;
 
 	/* Load superblock */
-	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
+	result = sfs_rwsuper(sfs, UIO_READ);
 	if (result) {
-		array_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		return result;
 	}
@@ -265,14 +283,36 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			"(0x%x, should be 0x%x)\n", 
 			sfs->sfs_super.sp_magic,
 			SFS_MAGIC);
-		array_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return EINVAL;
+	}
+
+	if (sfs->sfs_super.sp_features & ~SFS_FEATURES_KNOWN) {
+		kprintf("sfs: Unknown features 0x%x in superblock\n",
+			sfs->sfs_super.sp_features & ~SFS_FEATURES_KNOWN);
 		kfree(sfs);
 		return EINVAL;
 	}
 	
-	if (sfs->sfs_super.sp_nblocks > dev->d_blocks) {
-		kprintf("sfs: warning - fs has %u blocks, device has %u\n",
-			sfs->sfs_super.sp_nblocks, dev->d_blocks);
+	/* Volumes from before sp_blocksize have zero there */
+	if (sfs->sfs_super.sp_blocksize != 0) {
+		sfs->sfs_blocksize = sfs->sfs_super.sp_blocksize;
+	}
+	if (sfs->sfs_blocksize < SFS_MINBLOCKSIZE ||
+	    sfs->sfs_blocksize > SFS_MAXBLOCKSIZE ||
+	    (sfs->sfs_blocksize & (sfs->sfs_blocksize - 1)) != 0 ||
+	    sfs->sfs_blocksize % dev->d_blocksize != 0) {
+		kprintf("sfs: Unusable block size %u\n", sfs->sfs_blocksize);
+		kfree(sfs);
+		return EINVAL;
+	}
+
+	if (sfs->sfs_super.sp_nblocks >
+	    dev->d_blocks / (sfs->sfs_blocksize / dev->d_blocksize)) {
+		kprintf("sfs: warning - fs has %u blocks of %u bytes, "
+			"device has %u of %u\n",
+			sfs->sfs_super.sp_nblocks, sfs->sfs_blocksize,
+			dev->d_blocks, dev->d_blocksize);
 	}
 
 	/* Ensure null termination of the volume name */
@@ -281,14 +321,20 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
-		array_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		return ENOMEM;
 	}
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
 		bitmap_destroy(sfs->sfs_freemap);
-		array_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return result;
+	}
+
+	/* Set up the buffer cache */
+	result = sfs_bcache_init(sfs);
+	if (result) {
+		bitmap_destroy(sfs->sfs_freemap);
 		kfree(sfs);
 		return result;
 	}
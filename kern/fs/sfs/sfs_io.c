@@ -9,10 +9,10 @@
 //
 // Basic block-level I/O routines
 //
-// Note: sfs_rblock is used to read the superblock
+// Note: sfs_rwsuper is used to read the superblock
 // early in mount, before sfs is fully (or even mostly)
 // initialized, and so may not use anything from sfs
-// except sfs_device.
+// except sfs_device and sfs_blocksize.
 
 int
 sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
@@ -22,7 +22,7 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 
 	DEBUG(DB_SFS, "sfs: %s %u\n", 
 	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
+	      uio->uio_offset / sfs->sfs_blocksize);
 
  retry:
 	result = sfs->sfs_device->d_io(sfs->sfs_device, uio);
@@ -38,7 +38,7 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 		if (tries == 0) {
 			tries++;
 			kprintf("sfs: block %u I/O error, retrying\n",
-				uio->uio_offset / SFS_BLOCKSIZE);
+				uio->uio_offset / sfs->sfs_blocksize);
 			goto retry;
 		}
 		else if (tries < 10) {
@@ -48,7 +48,7 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 		else {
 			kprintf("sfs: block %u I/O error, giving up after "
 				"%d retries\n",
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
+				uio->uio_offset / sfs->sfs_blocksize, tries);
 		}
 	}
 	return result;
@@ -58,7 +58,7 @@ int
 sfs_rblock(struct sfs_fs *sfs, void *data, u_int32_t block)
 {
 	struct uio ku;
-	SFSUIO(&ku, data, block, UIO_READ);
+	SFSUIO(sfs, &ku, data, block, UIO_READ);
 	return sfs_rwblock(sfs, &ku);
 }
 
@@ -66,6 +66,20 @@ int
 sfs_wblock(struct sfs_fs *sfs, void *data, u_int32_t block)
 {
 	struct uio ku;
-	SFSUIO(&ku, data, block, UIO_WRITE);
+	SFSUIO(sfs, &ku, data, block, UIO_WRITE);
+	return sfs_rwblock(sfs, &ku);
+}
+
+/*
+ * Read or write the superblock. It's the first SFS_MINBLOCKSIZE
+ * bytes of the disk whatever the block size, so this works before
+ * the block size is known.
+ */
+int
+sfs_rwsuper(struct sfs_fs *sfs, enum uio_rw rw)
+{
+	struct uio ku;
+	mk_kuio(&ku, &sfs->sfs_super, sizeof(struct sfs_super),
+		SFS_SB_LOCATION, rw);
 	return sfs_rwblock(sfs, &ku);
 }
@@ -6,7 +6,6 @@
 #include <types.h>
 #include <lib.h>
 #include <synch.h>
-#include <array.h>
 #include <bitmap.h>
 #include <kern/stat.h>
 #include <kern/errno.h>
@@ -14,6 +13,15 @@
 #include <uio.h>
 #include <dev.h>
 #include <sfs.h>
+#include <objcache.h>
+#include "opt-sfsdebug.h"
+
+/*
+ * In-memory vnodes come from an object cache shared by all mounted
+ * sfs volumes. Opening and closing files churns through these.
+ */
+#define SFS_VNODE_CACHE_LIMIT 16
+static struct objcache *sfs_vnode_cache;
 
 /* At bottom of file */
 static int 
@@ -24,27 +32,42 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int type,
 //
 // Simple stuff
 
-/* Zero out a disk block. */
+/* Zero out a disk block. (In the buffer cache; it gets written later.) */
 static
 int
 sfs_clearblock(struct sfs_fs *sfs, u_int32_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
-	return sfs_wblock(sfs, zeros, block);
+	struct sfs_buf *buf;
+	int result;
+
+	result = sfs_bget(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	bzero(buf->sb_data, sfs->sfs_blocksize);
+	sfs_bdirty(buf);
+	sfs_brelse(sfs, buf);
+	return 0;
 }
 
-/* Write an on-disk inode structure back out to disk. */
+/* Write an on-disk inode structure back to its buffer. */
 static
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	if (sv->sv_dirty) {
 		struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-		int result = sfs_wblock(sfs, &sv->sv_i, sv->sv_ino);
+		struct sfs_buf *buf;
+		int result = sfs_bget(sfs, sv->sv_ino, &buf);
 		if (result) {
 			return result;
 		}
+		/* The inode is the start of its block; zero the rest */
+		memcpy(buf->sb_data, &sv->sv_i, sizeof(sv->sv_i));
+		bzero((char *)buf->sb_data + sizeof(sv->sv_i),
+		      sfs->sfs_blocksize - sizeof(sv->sv_i));
+		sfs_bdirty(buf);
+		sfs_brelse(sfs, buf);
 		sv->sv_dirty = 0;
 	}
 	return 0;
@@ -55,15 +78,27 @@ sfs_sync_inode(struct sfs_vnode *sv)
 // Space allocation
 
 /*
- * Allocate a block.
+ * Allocate a block, preferably GOAL, or the first free one after it,
+ * so a file's blocks end up next to each other on disk. With no GOAL
+ * (0, which is always the superblock) just take the next free block
+ * after the last one handed out.
+ *
+ * The block is zeroed unless DOCLEAR is 0, in which case the caller
+ * must fill all of it before anyone can read it.
  */
 static
 int
-sfs_balloc(struct sfs_fs *sfs, u_int32_t *diskblock)
+sfs_balloc(struct sfs_fs *sfs, u_int32_t goal, int doclear,
+	   u_int32_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	if (goal == 0 || goal >= sfs->sfs_super.sp_nblocks) {
+		result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	}
+	else {
+		result = bitmap_alloc_near(sfs->sfs_freemap, goal, diskblock);
+	}
 	if (result) {
 		return result;
 	}
@@ -74,6 +109,9 @@ sfs_balloc(struct sfs_fs *sfs, u_int32_t *diskblock)
 	}
 
 	/* Clear block before returning it */
+	if (!doclear) {
+		return 0;
+	}
 	return sfs_clearblock(sfs, *diskblock);
 }
 
@@ -106,33 +144,61 @@ sfs_bused(struct sfs_fs *sfs, u_int32_t diskblock)
 //
 // Block mapping/inode maintenance
 
+/* Values for sfs_bmap's DOALLOC */
+#define SFS_BMAP_ALLOC  1	/* allocate the block if there isn't one */
+#define SFS_BMAP_FILL   2	/* same, but the caller overwrites it all */
+
+/* Where to put a new block that follows block PREV of a file */
+#define SFS_GOAL(prev)  ((prev) == 0 ? 0 : (prev) + 1)
+
+/*
+ * Where the inode keeps the top block of the indirect tree with
+ * LEVELS levels; for 0, the last direct block, which comes before the
+ * single indirect tree.
+ */
+static
+u_int32_t *
+sfs_idroot(struct sfs_vnode *sv, int levels)
+{
+	switch (levels) {
+	    case 0:
+		return &sv->sv_i.sfi_direct[SFS_NDIRECT-1];
+	    case 1:
+		return &sv->sv_i.sfi_indirect;
+	    case 2:
+		return &sv->sv_i.sfi_dindirect;
+	    case 3:
+		return &sv->sv_i.sfi_tindirect;
+	}
+	panic("sfs: no indirect tree with %d levels\n", levels);
+	return NULL;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * allocated, right after the file's previous block if that's free.
+ * A new block is zeroed first unless DOALLOC is SFS_BMAP_FILL. If
+ * ISNEW isn't NULL, it's set to whether the block was just allocated.
  */
 static
 int
 sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
-	    u_int32_t *diskblock)
+	    u_int32_t *diskblock, int *isnew)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static u_int32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *idbuf;
+	u_int32_t *idptrs, *idroot;
 	u_int32_t block;
 	u_int32_t idblock;
-	u_int32_t idnum, idoff;
-	int result;
+	u_int32_t idoff, span, dbperidb = SFS_FS_DBPERIDB(sfs);
+	u_int32_t origblock = fileblock;
+	int levels, result;
 
-	assert(sizeof(idbuf)==SFS_BLOCKSIZE);
+	if (isnew != NULL) {
+		*isnew = 0;
+	}
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -147,10 +213,17 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			u_int32_t prev = fileblock > 0 ?
+				sv->sv_i.sfi_direct[fileblock-1] : 0;
+
+			result = sfs_balloc(sfs, SFS_GOAL(prev),
+					    doalloc != SFS_BMAP_FILL, &block);
 			if (result) {
 				return result;
 			}
+			if (isnew != NULL) {
+				*isnew = 1;
+			}
 
 			/* Remember what we allocated; mark inode dirty */
 			sv->sv_i.sfi_direct[fileblock] = block;
@@ -169,27 +242,27 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * It's not a direct block. Subtract off the number of direct
+	 * blocks, then those covered by each indirect tree until we find
+	 * the one it's in. SPAN is the number of file blocks that tree
+	 * covers.
 	 */
-
 	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
-
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum > 0) {
-		return EINVAL;
+	levels = 1;
+	span = dbperidb;
+	while (fileblock >= span) {
+		fileblock -= span;
+		levels++;
+		if (levels > SFS_NINDIRECT) {
+			/* Past the triple indirect block; too large */
+			return EINVAL;
+		}
+		span *= dbperidb;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the disk block number of the top indirect block. */
+	idroot = sfs_idroot(sv, levels);
+	idblock = *idroot;
 
 	if (idblock==0 && !doalloc) {
 		/*
@@ -204,57 +277,75 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 		/*
 		 * There's no indirect block allocated, but we need to
 		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
+		 * it. Thus, we need to allocate an indirect block. Put
+		 * it after the previous tree's top block.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		result = sfs_balloc(sfs, SFS_GOAL(*sfs_idroot(sv, levels-1)),
+				    1, &idblock);
 		if (result) {
 			return result;
 		}
 
 		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+		*idroot = idblock;
 
 		/* Mark the inode dirty */
 		sv->sv_dirty = 1;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
-	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_rblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
-		}
+		/* sfs_balloc left it cleared in the cache */
 	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	/*
+	 * Walk down the tree, one indirect block per level, allocating
+	 * blocks that are missing on the way if asked to.
+	 */
+	do {
+		span /= dbperidb;
+		idoff = fileblock / span;
+		fileblock %= span;
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+		/* Load the indirect block */
+		result = sfs_bread(sfs, idblock, &idbuf);
 		if (result) {
 			return result;
 		}
+		idptrs = idbuf->sb_data;
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+		/* Get the next block out of the indirect block buffer */
+		block = idptrs[idoff];
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
+		/* If there's no block there, allocate one */
+		if (block==0 && doalloc) {
+			/* the first one goes right after the indirect block */
+			u_int32_t prev = idoff > 0 ? idptrs[idoff-1] : idblock;
+
+			/* Indirect blocks must start out cleared */
+			result = sfs_balloc(sfs, SFS_GOAL(prev),
+					    span > 1 || doalloc != SFS_BMAP_FILL,
+					    &block);
+			if (result) {
+				sfs_brelse(sfs, idbuf);
+				return result;
+			}
+			if (isnew != NULL && span == 1) {
+				*isnew = 1;
+			}
+
+			/* Remember the block we allocated */
+			idptrs[idoff] = block;
+
+			/* The indirect block is now dirty */
+			sfs_bdirty(idbuf);
 		}
-	}
+		sfs_brelse(sfs, idbuf);
+
+		idblock = block;
+	} while (span > 1 && block != 0);
 
-	/* Hand back the result and return. */
+	/* Hand back the result (0 if it's in a hole) and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
 		panic("sfs: Data block %u (block %u of file %u) marked free\n",
-		      block, fileblock, sv->sv_ino);
+		      block, origblock, sv->sv_ino);
 	}
 	*diskblock = block;
 	return 0;
@@ -279,16 +370,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      u_int32_t skipstart, u_int32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *iobuf;
 	u_int32_t diskblock;
 	u_int32_t fileblock;
 	int result;
@@ -296,13 +379,13 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	/* Allocate missing blocks if and only if we're writing */
 	int doalloc = (uio->uio_rw==UIO_WRITE);
 
-	assert(skipstart + len <= SFS_BLOCKSIZE);
+	assert(skipstart + len <= sfs->sfs_blocksize);
 
 	/* Compute the block offset of this block in the file */
-	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+	fileblock = uio->uio_offset / sfs->sfs_blocksize;
 
 	/* Get the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, fileblock, doalloc, &diskblock, NULL);
 	if (result) {
 		return result;
 	}
@@ -310,40 +393,34 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		assert(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_rblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block from the buffer cache.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = sfs_bread(sfs, diskblock, &iobuf);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
 	 */
-	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_wblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+	result = uiomove((char *)iobuf->sb_data+skipstart, len, uio);
+
+	/*
+	 * If it was a write, the buffer is now dirty.
+	 */
+	if (result == 0 && uio->uio_rw == UIO_WRITE) {
+		sfs_bdirty(iobuf);
 	}
 
-	return 0;
+	sfs_brelse(sfs, iobuf);
+	return result;
 }
 
 /*
@@ -354,20 +431,25 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *buf;
 	u_int32_t diskblock;
 	u_int32_t fileblock;
-	int result;
-	int doalloc = (uio->uio_rw==UIO_WRITE);
+	int result, isnew;
 	off_t saveoff;
 	off_t diskoff;
 	off_t saveres;
 	off_t diskres;
 
 	/* Get the block number within the file */
-	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+	fileblock = uio->uio_offset / sfs->sfs_blocksize;
 
-	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	/*
+	 * Look up the disk block number. If we're writing, we're about
+	 * to overwrite all of it, so a new block needn't be zeroed.
+	 */
+	result = sfs_bmap(sv, fileblock,
+			  uio->uio_rw==UIO_WRITE ? SFS_BMAP_FILL : 0,
+			  &diskblock, &isnew);
 	if (result) {
 		return result;
 	}
@@ -380,7 +462,29 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		 * allocated a block for us.
 		 */
 		assert(uio->uio_rw == UIO_READ);
-		return uiomovezeros(SFS_BLOCKSIZE, uio);
+		return uiomovezeros(sfs->sfs_blocksize, uio);
+	}
+
+	/*
+	 * If the block is in the buffer cache, use that copy; the
+	 * disk's may be out of date, or would be left so.
+	 */
+	buf = sfs_bpeek(sfs, diskblock);
+	if (buf == NULL && uio->uio_rw == UIO_READ &&
+	    sfs_bprefetch_pending(sfs, diskblock)) {
+		/* Read-ahead wants it too; read it just once */
+		result = sfs_bread(sfs, diskblock, &buf);
+		if (result) {
+			goto done;
+		}
+	}
+	if (buf != NULL) {
+		result = uiomove(buf->sb_data, sfs->sfs_blocksize, uio);
+		if (result == 0 && uio->uio_rw == UIO_WRITE) {
+			sfs_bdirty(buf);
+		}
+		sfs_brelse(sfs, buf);
+		goto done;
 	}
 
 	/*
@@ -388,19 +492,24 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	 * and substitute one that makes sense to the device.
 	 */
 	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
+	diskoff = diskblock * sfs->sfs_blocksize;
 	uio->uio_offset = diskoff;
 
 	/*
 	 * Temporarily set the residue to be one block size.
 	 */
-	assert(uio->uio_resid >= SFS_BLOCKSIZE);
+	assert(uio->uio_resid >= sfs->sfs_blocksize);
 	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
+	diskres = sfs->sfs_blocksize;
 	uio->uio_resid = diskres;
 	
 	result = sfs_rwblock(sfs, uio);
 
+	/* Read-ahead may have cached the old contents meanwhile */
+	if (result == 0 && uio->uio_rw == UIO_WRITE) {
+		sfs_bforget(sfs, diskblock);
+	}
+
 	/*
 	 * Now, restore the original uio_offset and uio_resid and update 
 	 * them by the amount of I/O done.
@@ -408,6 +517,14 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
 	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
 
+ done:
+	/*
+	 * A new block we didn't manage to fill holds whatever was on
+	 * the disk before. Don't let that show up in the file later.
+	 */
+	if (result && isnew) {
+		sfs_clearblock(sfs, diskblock);
+	}
 	return result;
 }
 
@@ -418,6 +535,7 @@ static
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	u_int32_t blkoff;
 	u_int32_t nblocks, i;
 	int result = 0;
@@ -447,13 +565,13 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	/*
 	 * First, do any leading partial block.
 	 */
-	blkoff = uio->uio_offset % SFS_BLOCKSIZE;
+	blkoff = uio->uio_offset % sfs->sfs_blocksize;
 	if (blkoff != 0) {
 		/* Number of bytes at beginning of block to skip */
 		u_int32_t skip = blkoff;
 
 		/* Number of bytes to read/write after that point */
-		u_int32_t len = SFS_BLOCKSIZE - blkoff;
+		u_int32_t len = sfs->sfs_blocksize - blkoff;
 
 		/* ...which might be less than the rest of the block */
 		if (len > uio->uio_resid) {
@@ -475,8 +593,8 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	/*
 	 * Now we should be block-aligned. Do the remaining whole blocks.
 	 */
-	assert(uio->uio_offset % SFS_BLOCKSIZE == 0);
-	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
+	assert(uio->uio_offset % sfs->sfs_blocksize == 0);
+	nblocks = uio->uio_resid / sfs->sfs_blocksize;
 	for (i=0; i<nblocks; i++) {
 		result = sfs_blockio(sv, uio);
 		if (result) {
@@ -487,7 +605,7 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	/*
 	 * Now do any remaining partial block at the end.
 	 */
-	assert(uio->uio_resid < SFS_BLOCKSIZE);
+	assert(uio->uio_resid < sfs->sfs_blocksize);
 
 	if (uio->uio_resid > 0) {
 		result = sfs_partialio(sv, uio, 0, uio->uio_resid);
@@ -512,6 +630,62 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	return result;
 }
 
+/*
+ * Called after reading a file from block STARTBLOCK up to byte ENDPOS.
+ * If the read carried on from the last one, widen the read-ahead
+ * window and queue whatever blocks in it haven't been asked for yet;
+ * if not, turn read-ahead off until reads are sequential again.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, u_int32_t startblock, off_t endpos)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t fileblock, diskblock, first, last, nblocks, ramax;
+
+	if (startblock != sv->sv_ranext) {
+		/* Not sequential */
+		sv->sv_ranext = endpos / sfs->sfs_blocksize;
+		sv->sv_rawin = 0;
+		sv->sv_raend = 0;
+		return;
+	}
+	sv->sv_ranext = endpos / sfs->sfs_blocksize;
+
+	/* Don't read ahead so far that the cache can't hold it */
+	ramax = sfs->sfs_bufcache.bc_nbufs / 4;
+	if (ramax > SFS_RAMAX) {
+		ramax = SFS_RAMAX;
+	}
+	sv->sv_rawin = sv->sv_rawin == 0 ? 1 : sv->sv_rawin * 2;
+	if (sv->sv_rawin > ramax) {
+		sv->sv_rawin = ramax;
+	}
+
+	/* The window starts at the first block not read yet */
+	first = DIVROUNDUP(endpos, sfs->sfs_blocksize);
+	last = first + sv->sv_rawin;
+	nblocks = DIVROUNDUP(sv->sv_i.sfi_size, sfs->sfs_blocksize);
+	if (last > nblocks) {
+		last = nblocks;
+	}
+	if (first < sv->sv_raend) {
+		first = sv->sv_raend;
+	}
+
+	for (fileblock = first; fileblock < last; fileblock++) {
+		if (sfs_bmap(sv, fileblock, 0, &diskblock, NULL)) {
+			break;
+		}
+		if (diskblock != 0) {
+			sfs_bprefetch(sfs, diskblock);
+		}
+	}
+	if (fileblock > sv->sv_raend) {
+		sv->sv_raend = fileblock;
+	}
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Directory I/O
@@ -605,6 +779,447 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_dir);
 }
 
+////////////////////////////////////////////////////////////
+//
+// Hashed directories (see kern/sfs.h for the layout)
+//
+// Lookups go straight to the one leaf a name can be in. Slot numbers
+// are the same as for a plain directory (the leaf's block times
+// SFS_DIRPERBLOCK plus the entry's place in it), so sfs_readdir,
+// sfs_writedir and sfs_dir_unlink work on either kind. But a split
+// moves entries to another leaf, so a slot is only good until the
+// next link into the directory. Leaves and index blocks are never
+// merged or freed; directories don't shrink.
+
+/* Hash a name (32-bit FNV-1a). */
+static
+u_int32_t
+sfs_dirhash(const char *name)
+{
+	u_int32_t hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/* Read block FILEBLOCK of a hashed directory into the buffer cache. */
+static
+int
+sfs_dirhash_bread(struct sfs_vnode *sv, u_int32_t fileblock,
+		  struct sfs_buf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t diskblock;
+	int result;
+
+	if (fileblock >= sv->sv_i.sfi_size / sfs->sfs_blocksize) {
+		panic("sfs: directory %u: index points past the end "
+		      "(block %u)\n", sv->sv_ino, fileblock);
+	}
+
+	result = sfs_bmap(sv, fileblock, 0, &diskblock, NULL);
+	if (result) {
+		return result;
+	}
+	if (diskblock == 0) {
+		panic("sfs: directory %u: hole at block %u\n",
+		      sv->sv_ino, fileblock);
+	}
+	return sfs_bread(sfs, diskblock, ret);
+}
+
+/*
+ * Read index block FILEBLOCK of a hashed directory, checking it. Only
+ * the root (block 0) may have depth 1.
+ */
+static
+int
+sfs_dirhash_getindex(struct sfs_vnode *sv, u_int32_t fileblock,
+		     struct sfs_buf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_dirindex *di;
+	int result;
+
+	result = sfs_dirhash_bread(sv, fileblock, ret);
+	if (result) {
+		return result;
+	}
+	di = (*ret)->sb_data;
+	if (di->sdi_magic != SFS_DIRINDEX_MAGIC ||
+	    di->sdi_count == 0 || di->sdi_count > SFS_FS_DIRINDEX_MAX(sfs) ||
+	    di->sdi_depth > (fileblock == 0 ? 1 : 0) ||
+	    (fileblock == 0 && SFS_DIRIDX(di)[0].sdx_hash != 0)) {
+		panic("sfs: directory %u: bad index block %u\n",
+		      sv->sv_ino, fileblock);
+	}
+	return 0;
+}
+
+/* Find the last entry of an index block whose hash is <= HASH. */
+static
+int
+sfs_dirhash_search(const struct sfs_dirindex *di, u_int32_t hash)
+{
+	int lo = 0, hi = di->sdi_count - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (SFS_DIRIDX(di)[mid].sdx_hash <= hash) {
+			lo = mid;
+		}
+		else {
+			hi = mid - 1;
+		}
+	}
+	return lo;
+}
+
+/* Insert an entry into an index block, which must have room, at POS. */
+static
+void
+sfs_dirhash_insert(struct sfs_dirindex *di, int pos,
+		   u_int32_t hash, u_int32_t block)
+{
+	assert(pos > 0 && pos <= di->sdi_count);
+
+	memmove(&SFS_DIRIDX(di)[pos+1], &SFS_DIRIDX(di)[pos],
+		(di->sdi_count - pos) * sizeof(struct sfs_diridx));
+	SFS_DIRIDX(di)[pos].sdx_hash = hash;
+	SFS_DIRIDX(di)[pos].sdx_block = block;
+	di->sdi_count++;
+}
+
+/*
+ * Find the leaf that holds, or would hold, names with hash HASH.
+ */
+static
+int
+sfs_dirhash_walk(struct sfs_vnode *sv, u_int32_t hash, u_int32_t *leaf)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	struct sfs_dirindex *di;
+	u_int32_t block = 0;
+	int depth, result;
+
+	do {
+		result = sfs_dirhash_getindex(sv, block, &buf);
+		if (result) {
+			return result;
+		}
+		di = buf->sb_data;
+		depth = di->sdi_depth;
+		block = SFS_DIRIDX(di)[sfs_dirhash_search(di, hash)].sdx_block;
+		sfs_brelse(sfs, buf);
+
+		if (block == 0) {
+			panic("sfs: directory %u: index points at the root\n",
+			      sv->sv_ino);
+		}
+	} while (depth > 0);
+
+	*leaf = block;
+	return 0;
+}
+
+/*
+ * Add a new, zeroed block to the end of a hashed directory, handing
+ * back its number in the directory and its buffer.
+ */
+static
+int
+sfs_dirhash_grow(struct sfs_vnode *sv, u_int32_t *fileblock,
+		 struct sfs_buf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t block, diskblock;
+	int result;
+
+	block = sv->sv_i.sfi_size / sfs->sfs_blocksize;
+
+	/* It's zeroed here, in the cache, so don't have bmap do it */
+	result = sfs_bmap(sv, block, SFS_BMAP_FILL, &diskblock, NULL);
+	if (result == EINVAL) {
+		/* past the largest file we can have */
+		return ENOSPC;
+	}
+	if (result) {
+		return result;
+	}
+	result = sfs_bget(sfs, diskblock, ret);
+	if (result) {
+		return result;
+	}
+	bzero((*ret)->sb_data, sfs->sfs_blocksize);
+	sfs_bdirty(*ret);
+
+	sv->sv_i.sfi_size += sfs->sfs_blocksize;
+	sv->sv_dirty = 1;
+
+	*fileblock = block;
+	return 0;
+}
+
+/*
+ * Make a new, empty leaf for the names with hashes from HASH up to
+ * those of the leaf after it, and enter it in the index. If its index
+ * block is full, that's split first; if that's the root, at depth 0,
+ * its entries are moved down a level.
+ */
+static
+int
+sfs_dirhash_addleaf(struct sfs_vnode *sv, u_int32_t hash,
+		    u_int32_t *newleaf, struct sfs_buf **newbuf)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *rootbuf, *nodebuf = NULL, *sibbuf = NULL, *tmp;
+	struct sfs_dirindex *root, *node, *sib;
+	u_int32_t nodeblock, sibblock;
+	int idxmax = SFS_FS_DIRINDEX_MAX(sfs);
+	int pos, half, result;
+
+	result = sfs_dirhash_getindex(sv, 0, &rootbuf);
+	if (result) {
+		return result;
+	}
+	root = rootbuf->sb_data;
+
+	if (root->sdi_depth == 0 && root->sdi_count == idxmax) {
+		/* Move the root's entries down a level */
+		result = sfs_dirhash_grow(sv, &nodeblock, &nodebuf);
+		if (result) {
+			goto out;
+		}
+		memcpy(nodebuf->sb_data, root, sfs->sfs_blocksize);
+		root->sdi_depth = 1;
+		root->sdi_count = 1;
+		SFS_DIRIDX(root)[0].sdx_hash = 0;
+		SFS_DIRIDX(root)[0].sdx_block = nodeblock;
+		sfs_bdirty(rootbuf);
+	}
+
+	if (root->sdi_depth == 0) {
+		node = root;
+		pos = 0;
+	}
+	else {
+		pos = sfs_dirhash_search(root, hash);
+		if (nodebuf == NULL) {
+			nodeblock = SFS_DIRIDX(root)[pos].sdx_block;
+			result = sfs_dirhash_getindex(sv, nodeblock, &nodebuf);
+			if (result) {
+				goto out;
+			}
+		}
+		node = nodebuf->sb_data;
+	}
+
+	if (node->sdi_count == idxmax) {
+		/* Split it; the root has depth 1 by now */
+		if (root->sdi_count == idxmax) {
+			result = ENOSPC;
+			goto out;
+		}
+		result = sfs_dirhash_grow(sv, &sibblock, &sibbuf);
+		if (result) {
+			goto out;
+		}
+		half = idxmax / 2;
+		sib = sibbuf->sb_data;
+		sib->sdi_magic = SFS_DIRINDEX_MAGIC;
+		sib->sdi_depth = 0;
+		sib->sdi_count = idxmax - half;
+		memcpy(SFS_DIRIDX(sib), &SFS_DIRIDX(node)[half],
+		       sib->sdi_count * sizeof(struct sfs_diridx));
+		node->sdi_count = half;
+		sfs_bdirty(nodebuf);
+
+		sfs_dirhash_insert(root, pos+1, SFS_DIRIDX(sib)[0].sdx_hash,
+				   sibblock);
+		sfs_bdirty(rootbuf);
+
+		if (hash >= SFS_DIRIDX(sib)[0].sdx_hash) {
+			tmp = nodebuf;
+			nodebuf = sibbuf;
+			sibbuf = tmp;
+			node = sib;
+		}
+	}
+
+	result = sfs_dirhash_grow(sv, newleaf, newbuf);
+	if (result) {
+		goto out;
+	}
+	sfs_dirhash_insert(node, sfs_dirhash_search(node, hash) + 1,
+			   hash, *newleaf);
+	sfs_bdirty(nodebuf != NULL ? nodebuf : rootbuf);
+
+ out:
+	if (sibbuf != NULL) {
+		sfs_brelse(sfs, sibbuf);
+	}
+	if (nodebuf != NULL) {
+		sfs_brelse(sfs, nodebuf);
+	}
+	sfs_brelse(sfs, rootbuf);
+	return result;
+}
+
+/*
+ * sfs_dir_findname for hashed directories. Only the name's leaf is
+ * searched, so any empty slot handed back is in that leaf.
+ */
+static
+int
+sfs_dirhash_findname(struct sfs_vnode *sv, const char *name,
+		     u_int32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	struct sfs_dir *sds;
+	u_int32_t leaf;
+	int dirperblock = SFS_FS_DIRPERBLOCK(sfs);
+	int found = 0;
+	int i, result;
+
+	result = sfs_dirhash_walk(sv, sfs_dirhash(name), &leaf);
+	if (result) {
+		return result;
+	}
+	result = sfs_dirhash_bread(sv, leaf, &buf);
+	if (result) {
+		return result;
+	}
+	sds = buf->sb_data;
+
+	for (i=0; i<dirperblock; i++) {
+		if (sds[i].sfd_ino == SFS_NOINO) {
+			if (emptyslot != NULL) {
+				*emptyslot = leaf*dirperblock + i;
+			}
+		}
+		else {
+			/* Ensure null termination, just in case */
+			sds[i].sfd_name[sizeof(sds[i].sfd_name)-1] = 0;
+			if (strcmp(sds[i].sfd_name, name)) {
+				continue;
+			}
+			assert(found==0);
+
+			found = 1;
+			if (slot != NULL) {
+				*slot = leaf*dirperblock + i;
+			}
+			if (ino != NULL) {
+				*ino = sds[i].sfd_ino;
+			}
+		}
+	}
+
+	sfs_brelse(sfs, buf);
+	return found ? 0 : ENOENT;
+}
+
+/*
+ * Make room for NAME in a hashed directory whose leaf for it is full,
+ * by moving the upper half of the leaf, by hash, to a new one. Hands
+ * back a free slot that NAME now belongs in.
+ */
+static
+int
+sfs_dirhash_split(struct sfs_vnode *sv, const char *name, int *emptyslot)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *buf, *newbuf;
+	struct sfs_dir *sds, *newsds;
+	u_int32_t hashes[SFS_DIRPERBLOCK(SFS_MAXBLOCKSIZE)+1];
+	u_int32_t hash, split, tmp, leaf, newleaf;
+	int dirperblock = SFS_FS_DIRPERBLOCK(sfs);
+	int i, j, n, result;
+
+	hash = sfs_dirhash(name);
+	result = sfs_dirhash_walk(sv, hash, &leaf);
+	if (result) {
+		return result;
+	}
+	result = sfs_dirhash_bread(sv, leaf, &buf);
+	if (result) {
+		return result;
+	}
+	sds = buf->sb_data;
+
+	/* Sort the hashes in the leaf, and the new one */
+	hashes[0] = hash;
+	n = 1;
+	for (i=0; i<dirperblock; i++) {
+		if (sds[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		sds[i].sfd_name[sizeof(sds[i].sfd_name)-1] = 0;
+		tmp = sfs_dirhash(sds[i].sfd_name);
+		for (j=n; j>0 && hashes[j-1] > tmp; j--) {
+			hashes[j] = hashes[j-1];
+		}
+		hashes[j] = tmp;
+		n++;
+	}
+
+	/*
+	 * Split at the median, but so that something stays behind: the
+	 * new leaf's hash has to be above the old one's. Both halves
+	 * then have at most a block's worth of names, counting NAME.
+	 */
+	for (i=n/2; i<n && hashes[i] == hashes[0]; i++);
+	if (i == n) {
+		/* a block's worth of names, and NAME, with the same hash */
+		sfs_brelse(sfs, buf);
+		return ENOSPC;
+	}
+	split = hashes[i];
+
+	result = sfs_dirhash_addleaf(sv, split, &newleaf, &newbuf);
+	if (result) {
+		sfs_brelse(sfs, buf);
+		return result;
+	}
+	newsds = newbuf->sb_data;
+
+	for (i=j=0; i<dirperblock; i++) {
+		if (sds[i].sfd_ino != SFS_NOINO &&
+		    sfs_dirhash(sds[i].sfd_name) >= split) {
+			newsds[j++] = sds[i];
+			bzero(&sds[i], sizeof(sds[i]));
+			sds[i].sfd_ino = SFS_NOINO;
+		}
+	}
+	sfs_bdirty(buf);
+	sfs_bdirty(newbuf);
+
+	/* Find NAME a slot on its side */
+	if (hash >= split) {
+		assert(j < dirperblock);
+		*emptyslot = newleaf*dirperblock + j;
+	}
+	else {
+		for (i=0; sds[i].sfd_ino != SFS_NOINO; i++) {
+			assert(i < dirperblock-1);
+		}
+		*emptyslot = leaf*dirperblock + i;
+	}
+
+	sfs_brelse(sfs, newbuf);
+	sfs_brelse(sfs, buf);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Directory operations
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
@@ -618,8 +1233,13 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 {
 	struct sfs_dir tsd;
 	int found = 0;
-	int nentries = sfs_dir_nentries(sv);
-	int i, result;
+	int nentries, i, result;
+
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_DIRHASH) {
+		return sfs_dirhash_findname(sv, name, ino, slot, emptyslot);
+	}
+
+	nentries = sfs_dir_nentries(sv);
 
 	/* For each slot... */
 	for (i=0; i<nentries; i++) {
@@ -682,8 +1302,17 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, u_int32_t ino, int *slot)
 		return ENAMETOOLONG;
 	}
 
-	/* If we didn't get an empty slot, add the entry at the end. */
-	if (emptyslot < 0) {
+	/*
+	 * If we didn't get an empty slot, add the entry at the end, or
+	 * for a hashed directory, split the leaf the name goes in.
+	 */
+	if (emptyslot < 0 && (sv->sv_i.sfi_flags & SFS_IFLAG_DIRHASH)) {
+		result = sfs_dirhash_split(sv, name, &emptyslot);
+		if (result) {
+			return result;
+		}
+	}
+	else if (emptyslot < 0) {
 		emptyslot = sfs_dir_nentries(sv);
 	}
 
@@ -770,7 +1399,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, 0, 1, &ino);
 	if (result) {
 		return result;
 	}
@@ -859,7 +1488,7 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	int ix, i, num, result;
+	int result;
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
@@ -899,25 +1528,23 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	ix = -1;
-	num = array_getnum(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct sfs_vnode *sv2 = array_getguy(sfs->sfs_vnodes, i);
-		if (sv2==sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix<0) {
+	if (sv->sv_hashprevp == NULL) {
 		panic("sfs: reclaim vnode %u not in vnode pool\n",
 		      sv->sv_ino);
 	}
-	array_remove(sfs->sfs_vnodes, ix);
+	*sv->sv_hashprevp = sv->sv_hashnext;
+	if (sv->sv_hashnext != NULL) {
+		sv->sv_hashnext->sv_hashprevp = sv->sv_hashprevp;
+	}
+	sv->sv_hashnext = NULL;
+	sv->sv_hashprevp = NULL;
+	assert(sfs->sfs_nvnodes > 0);
+	sfs->sfs_nvnodes--;
 
 	VOP_KILL(&sv->sv_v);
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	objcache_free(sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
@@ -931,8 +1558,20 @@ int
 sfs_read(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t startblock;
+	int result;
+
 	assert(uio->uio_rw==UIO_READ);
-	return sfs_io(sv, uio);
+
+	startblock = uio->uio_offset / sfs->sfs_blocksize;
+	result = sfs_io(sv, uio);
+	if (result) {
+		return result;
+	}
+
+	sfs_readahead(sv, startblock, uio->uio_offset);
+	return 0;
 }
 
 /*
@@ -1043,7 +1682,16 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
-	return sfs_sync_inode(sv);
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	int result;
+
+	result = sfs_sync_inode(sv);
+	if (result) {
+		return result;
+	}
+
+	/* The file's blocks are in the buffer cache; write them out */
+	return sfs_bsync(sfs);
 }
 
 /*
@@ -1057,6 +1705,90 @@ sfs_mmap(struct vnode *v   /* add stuff as needed */)
 	return EUNIMP;
 }
 
+/*
+ * Free the blocks past BLOCKLEN in the indirect tree with LEVELS
+ * levels whose top block is *IDBLOCK and whose first file block is
+ * BASEBLOCK. If that leaves the top block empty, it's freed too, and
+ * *IDBLOCK cleared and *CHANGED set.
+ */
+static
+int
+sfs_itruncate(struct sfs_fs *sfs, u_int32_t *idblock, int levels,
+	      u_int32_t baseblock, u_int32_t blocklen, int *changed)
+{
+	struct sfs_buf *idbuf;
+	u_int32_t *idptrs;
+	u_int32_t j, span, dbperidb = SFS_FS_DBPERIDB(sfs);
+	int i, result;
+	int hasnonzero, iddirty;
+
+	if (*idblock == 0) {
+		return 0;
+	}
+
+	/* File blocks under each pointer in the top block */
+	span = 1;
+	for (i=1; i<levels; i++) {
+		span *= dbperidb;
+	}
+
+	if (blocklen >= baseblock + span*dbperidb) {
+		/* All before the proposed EOF */
+		return 0;
+	}
+
+	/* Read the indirect block */
+	result = sfs_bread(sfs, *idblock, &idbuf);
+	if (result) {
+		return result;
+	}
+	idptrs = idbuf->sb_data;
+
+	hasnonzero = 0;
+	iddirty = 0;
+	for (j=0; j<dbperidb; j++) {
+		if (idptrs[j] == 0) {
+			continue;
+		}
+		if (levels > 1) {
+			/* Trim the tree below */
+			result = sfs_itruncate(sfs, &idptrs[j], levels-1,
+					       baseblock + j*span, blocklen,
+					       &iddirty);
+			if (result) {
+				if (iddirty) {
+					sfs_bdirty(idbuf);
+				}
+				sfs_brelse(sfs, idbuf);
+				return result;
+			}
+		}
+		else if (blocklen <= baseblock+j) {
+			/* Discard any blocks that are past the new EOF */
+			sfs_bfree(sfs, idptrs[j]);
+			idptrs[j] = 0;
+			iddirty = 1;
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idptrs[j] != 0) {
+			hasnonzero = 1;
+		}
+	}
+
+	if (!hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		sfs_bfree(sfs, *idblock);
+		*idblock = 0;
+		*changed = 1;
+	}
+	else if (iddirty) {
+		/* The indirect block is dirty */
+		sfs_bdirty(idbuf);
+	}
+	sfs_brelse(sfs, idbuf);
+	return 0;
+}
+
 /*
  * Called for ftruncate() and from sfs_reclaim.
  */
@@ -1064,27 +1796,15 @@ static
 int
 sfs_truncate(struct vnode *v, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static u_int32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
-	u_int32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
+	u_int32_t blocklen = DIVROUNDUP(len, sfs->sfs_blocksize);
 
-	u_int32_t i, j, block;
-	u_int32_t idblock, baseblock, highblock;
-	int result;
-	int hasnonzero, iddirty;
-
-	assert(sizeof(idbuf)==SFS_BLOCKSIZE);
+	u_int32_t i, block;
+	u_int32_t baseblock, span;
+	int levels, result;
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -1099,52 +1819,17 @@ sfs_truncate(struct vnode *v, off_t len)
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
+	/* Then each indirect tree, starting with the single one */
 	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
+	span = SFS_FS_DBPERIDB(sfs);
+	for (levels=1; levels<=SFS_NINDIRECT; levels++) {
+		result = sfs_itruncate(sfs, sfs_idroot(sv, levels), levels,
+				       baseblock, blocklen, &sv->sv_dirty);
 		if (result) {
 			return result;
 		}
-		
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = 1;
-		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				return result;
-			}
-		}
+		baseblock += span;
+		span *= SFS_FS_DBPERIDB(sfs);
 	}
 
 	/* Set the file size */
@@ -1341,6 +2026,17 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = 1;
 
+	/*
+	 * In a hashed directory the link may have split the old name's
+	 * leaf and moved it, so find it again.
+	 */
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_DIRHASH) {
+		result = sfs_dir_findname(sv, n1, NULL, &slot1, NULL);
+		if (result) {
+			goto puke_harder;
+		}
+	}
+
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
 	if (result) {
@@ -1547,23 +2243,23 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct sfs_vnode *sv;
+	struct sfs_vnode *sv, **bucket;
+	struct sfs_buf *buf;
 	const struct vnode_ops *ops = NULL;
-	int i, num;
 	int result;
 
 	/* Look in the vnodes table */
-	num = array_getnum(sfs->sfs_vnodes);
+	bucket = &sfs->sfs_vnhash[SFS_VNHASHFN(ino)];
 
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		sv = array_getguy(sfs->sfs_vnodes, i);
+	for (sv = *bucket; sv != NULL; sv = sv->sv_hashnext) {
 
+#if OPT_SFSDEBUG
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: Found inode %u in unallocated block\n",
 			      sv->sv_ino);
 		}
+#endif
 
 		if (sv->sv_ino==ino) {
 			/* Found */
@@ -1579,7 +2275,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = objcache_alloc(sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -1591,11 +2287,13 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	}
 
 	/* Read the block the inode is in */
-	result = sfs_rblock(sfs, &sv->sv_i, ino);
+	result = sfs_bread(sfs, ino, &buf);
 	if (result) {
-		kfree(sv);
+		objcache_free(sfs_vnode_cache, sv);
 		return result;
 	}
+	memcpy(&sv->sv_i, buf->sb_data, sizeof(sv->sv_i));
+	sfs_brelse(sfs, buf);
 
 	/* Not dirty yet */
 	sv->sv_dirty = 0;
@@ -1630,26 +2328,48 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		objcache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	sv->sv_ranext = 0;
+	sv->sv_rawin = 0;
+	sv->sv_raend = 0;
 
 	/* Add it to our table */
-	result = array_add(sfs->sfs_vnodes, sv);
-	if (result) {
-		VOP_KILL(&sv->sv_v);
-		kfree(sv);
-		return result;
+	sv->sv_hashnext = *bucket;
+	if (sv->sv_hashnext != NULL) {
+		sv->sv_hashnext->sv_hashprevp = &sv->sv_hashnext;
 	}
+	sv->sv_hashprevp = bucket;
+	*bucket = sv;
+	sfs->sfs_nvnodes++;
 
 	/* Hand it back */
 	*ret = sv;
 	return 0;
 }
 
+/*
+ * Set up the vnode cache. Called on every mount; only the first one
+ * does anything.
+ */
+int
+sfs_vnodecache_init(void)
+{
+	if (sfs_vnode_cache != NULL) {
+		return 0;
+	}
+	sfs_vnode_cache = objcache_create("sfs_vnode", sizeof(struct sfs_vnode),
+					  SFS_VNODE_CACHE_LIMIT, NULL, NULL);
+	if (sfs_vnode_cache == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
 /*
  * Get vnode for the root of the filesystem.
  * The root vnode is always found in block 1 (SFS_ROOT_LOCATION).
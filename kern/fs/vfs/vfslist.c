@@ -70,6 +70,7 @@ vfs_bootstrap(void)
 	}
 
 	vfs_initbootfs();
+	vfs_nc_bootstrap();
 	devnull_create();
 }
 
@@ -510,6 +511,9 @@ vfs_unmount(const char *devname)
 		goto puke;
 	}
 
+	/* Cached names hold vnodes, which would keep it busy */
+	vfs_nc_purge(kd->kd_fs, 0);
+
 	result = FSOP_UNMOUNT(kd->kd_fs);
 	if (result) {
 		goto puke;
@@ -566,6 +570,8 @@ vfs_unmountall(void)
 			}
 		}
 
+		vfs_nc_purge(dev->kd_fs, 0);
+
 		result = FSOP_UNMOUNT(dev->kd_fs);
 		if (result==EBUSY) {
 			kprintf("vfs: Cannot unmount %s: (busy)\n", 
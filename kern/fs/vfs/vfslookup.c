@@ -233,10 +233,16 @@ vfs_lookparent(char *path, struct vnode **retval,
 	return result;
 }
 
+/*
+ * vfs_lookup goes through the name cache (vfsnamecache.c); results
+ * that come from the filesystem, found or ENOENT, are entered in it.
+ */
 int
 vfs_lookup(char *path, struct vnode **retval)
 {
 	struct vnode *startvn;
+	char name[VFS_NC_NAMELEN+1];
+	unsigned gen;
 	int result;
 
 	result = getdevice(path, &path, &startvn);
@@ -249,7 +255,26 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
+	if (vfs_nc_lookup(startvn, path, retval, &gen)) {
+		VOP_DECREF(startvn);
+		return *retval != NULL ? 0 : ENOENT;
+	}
+
+	/* The filesystem may scribble on PATH */
+	if (strlen(path) > VFS_NC_NAMELEN) {
+		result = VOP_LOOKUP(startvn, path, retval);
+		VOP_DECREF(startvn);
+		return result;
+	}
+	strcpy(name, path);
+
 	result = VOP_LOOKUP(startvn, path, retval);
+	if (result == 0) {
+		vfs_nc_enter(startvn, name, *retval, gen);
+	}
+	else if (result == ENOENT) {
+		vfs_nc_enter(startvn, name, NULL, gen);
+	}
 
 	VOP_DECREF(startvn);
 	return result;
@@ -0,0 +1,371 @@
+/*
+ * VFS name cache.
+ *
+ * Remembers what vfs_lookup found for a (starting directory, path)
+ * pair, so looking up the same path again doesn't go down to the
+ * filesystem at all. Paths that didn't exist are remembered too, as
+ * negative entries. The path is whatever the filesystem's VOP_LOOKUP
+ * was handed, which for emufs can be several components long; paths
+ * longer than VFS_NC_NAMELEN aren't cached.
+ *
+ * Entries hold references to both vnodes, so neither can go away (and
+ * be replaced by another at the same address) while cached. Keeping
+ * the cache right is up to the callers in vfspath.c: anything that
+ * creates a name drops the negative entries for that filesystem, and
+ * anything that removes or renames one drops all of its entries. That
+ * is heavy-handed, but those are rare next to lookups. A lookup that
+ * went to the filesystem while a purge happened isn't entered, since
+ * what it found may be out of date already.
+ *
+ * There are NC_SIZE entries, found through a hash table and recycled
+ * least recently used first, all protected by nc_lock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#define NC_SIZE      128	/* entries */
+#define NC_HASH      64		/* hash buckets; power of 2 */
+
+struct ncentry {
+	struct vnode *nc_dir;		/* where the lookup started; */
+					/*   NULL if the entry is free */
+	char nc_name[VFS_NC_NAMELEN+1];	/* path looked up from there */
+	struct vnode *nc_vn;		/* what it found; NULL if nothing */
+	unsigned nc_hashval;
+	struct ncentry *nc_hashnext;
+	struct ncentry *nc_lrunext;	/* most recent first */
+	struct ncentry *nc_lruprev;
+};
+
+static struct lock *nc_lock;
+static struct ncentry nc_entries[NC_SIZE];
+static struct ncentry *nc_hash[NC_HASH];
+static struct ncentry *nc_lruhead, *nc_lrutail;
+static unsigned nc_gen;			/* bumped by every purge */
+
+/* statistics */
+static unsigned nc_hits, nc_neghits, nc_misses, nc_purges;
+
+static
+unsigned
+nc_hashfn(struct vnode *dir, const char *name)
+{
+	unsigned h = (unsigned)(vaddr_t)dir >> 4;
+
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+////////////////////////////////////////////////////////////
+//
+// List maintenance. nc_lock must be held.
+
+static
+void
+nc_lruremove(struct ncentry *nc)
+{
+	if (nc->nc_lruprev != NULL) {
+		nc->nc_lruprev->nc_lrunext = nc->nc_lrunext;
+	}
+	else {
+		nc_lruhead = nc->nc_lrunext;
+	}
+	if (nc->nc_lrunext != NULL) {
+		nc->nc_lrunext->nc_lruprev = nc->nc_lruprev;
+	}
+	else {
+		nc_lrutail = nc->nc_lruprev;
+	}
+}
+
+/* Make NC the most recently used. */
+static
+void
+nc_lrutouch(struct ncentry *nc)
+{
+	nc_lruremove(nc);
+	nc->nc_lruprev = NULL;
+	nc->nc_lrunext = nc_lruhead;
+	if (nc_lruhead != NULL) {
+		nc_lruhead->nc_lruprev = nc;
+	}
+	nc_lruhead = nc;
+	if (nc_lrutail == NULL) {
+		nc_lrutail = nc;
+	}
+}
+
+/* Make NC the next to be reused. */
+static
+void
+nc_lrulast(struct ncentry *nc)
+{
+	nc_lruremove(nc);
+	nc->nc_lrunext = NULL;
+	nc->nc_lruprev = nc_lrutail;
+	if (nc_lrutail != NULL) {
+		nc_lrutail->nc_lrunext = nc;
+	}
+	nc_lrutail = nc;
+	if (nc_lruhead == NULL) {
+		nc_lruhead = nc;
+	}
+}
+
+static
+struct ncentry *
+nc_find(struct vnode *dir, const char *name, unsigned hashval)
+{
+	struct ncentry *nc;
+
+	for (nc = nc_hash[hashval % NC_HASH]; nc != NULL;
+	     nc = nc->nc_hashnext) {
+		if (nc->nc_hashval == hashval && nc->nc_dir == dir &&
+		    !strcmp(nc->nc_name, name)) {
+			return nc;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+nc_unhash(struct ncentry *nc)
+{
+	struct ncentry **ncp;
+
+	for (ncp = &nc_hash[nc->nc_hashval % NC_HASH]; *ncp != nc;
+	     ncp = &(*ncp)->nc_hashnext) {
+		assert(*ncp != NULL);
+	}
+	*ncp = nc->nc_hashnext;
+	nc->nc_hashnext = NULL;
+}
+
+/*
+ * Take NC out of use, handing back the references it held through
+ * DIR and VN for the caller to drop once nc_lock is released.
+ */
+static
+void
+nc_clear(struct ncentry *nc, struct vnode **dir, struct vnode **vn)
+{
+	*dir = nc->nc_dir;
+	*vn = nc->nc_vn;
+	nc_unhash(nc);
+	nc->nc_dir = NULL;
+	nc->nc_vn = NULL;
+	nc_lrulast(nc);
+}
+
+static
+void
+nc_release(struct vnode *dir, struct vnode *vn)
+{
+	if (dir != NULL) {
+		VOP_DECREF(dir);
+	}
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+/*
+ * Look up PATH from DIR. Returns 1 if the cache knows the answer, with
+ * the vnode (referenced) in *RET, or NULL if there's no such file; 0
+ * if the filesystem has to be asked, with a value for vfs_nc_enter in
+ * *GEN.
+ */
+int
+vfs_nc_lookup(struct vnode *dir, const char *path, struct vnode **ret,
+	      unsigned *gen)
+{
+	struct ncentry *nc;
+	unsigned hashval;
+
+	if (strlen(path) > VFS_NC_NAMELEN) {
+		return 0;
+	}
+	hashval = nc_hashfn(dir, path);
+
+	lock_acquire(nc_lock);
+	nc = nc_find(dir, path, hashval);
+	if (nc == NULL) {
+		nc_misses++;
+		*gen = nc_gen;
+		lock_release(nc_lock);
+		return 0;
+	}
+
+	if (nc->nc_vn != NULL) {
+		VOP_INCREF(nc->nc_vn);
+		nc_hits++;
+	}
+	else {
+		nc_neghits++;
+	}
+	*ret = nc->nc_vn;
+	nc_lrutouch(nc);
+	lock_release(nc_lock);
+
+	return 1;
+}
+
+/*
+ * Remember that looking up PATH from DIR found VN, or nothing if VN
+ * is NULL. GEN is what vfs_nc_lookup gave back before the filesystem
+ * was asked.
+ */
+void
+vfs_nc_enter(struct vnode *dir, const char *path, struct vnode *vn,
+	     unsigned gen)
+{
+	struct ncentry *nc;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+	unsigned hashval;
+
+	if (strlen(path) > VFS_NC_NAMELEN) {
+		return;
+	}
+	hashval = nc_hashfn(dir, path);
+
+	lock_acquire(nc_lock);
+
+	if (gen != nc_gen) {
+		lock_release(nc_lock);
+		return;
+	}
+
+	nc = nc_find(dir, path, hashval);
+	if (nc == NULL) {
+		/* Reuse the least recently used entry */
+		nc = nc_lrutail;
+		if (nc->nc_dir != NULL) {
+			nc_clear(nc, &olddir, &oldvn);
+		}
+		nc->nc_dir = dir;
+		strcpy(nc->nc_name, path);
+		nc->nc_hashval = hashval;
+		nc->nc_hashnext = nc_hash[hashval % NC_HASH];
+		nc_hash[hashval % NC_HASH] = nc;
+		VOP_INCREF(dir);
+	}
+	else {
+		/* Someone else got here first; update it */
+		oldvn = nc->nc_vn;
+	}
+
+	nc->nc_vn = vn;
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	nc_lrutouch(nc);
+
+	lock_release(nc_lock);
+
+	nc_release(olddir, oldvn);
+}
+
+/*
+ * Drop the entries for lookups on filesystem FS: only the negative
+ * ones if NEGONLY is set, otherwise all of them.
+ */
+void
+vfs_nc_purge(struct fs *fs, int negonly)
+{
+	struct ncentry *nc;
+	struct vnode *dir, *vn;
+	int i;
+
+	lock_acquire(nc_lock);
+	nc_purges++;
+	nc_gen++;
+	for (i=0; i<NC_SIZE; i++) {
+		nc = &nc_entries[i];
+		if (nc->nc_dir == NULL || nc->nc_dir->vn_fs != fs ||
+		    (negonly && nc->nc_vn != NULL)) {
+			continue;
+		}
+		nc_clear(nc, &dir, &vn);
+
+		/*
+		 * Dropping the last reference can mean I/O; don't do
+		 * that with the cache locked. Entries may be reused
+		 * meanwhile, but each is checked as we come to it.
+		 */
+		lock_release(nc_lock);
+		nc_release(dir, vn);
+		lock_acquire(nc_lock);
+	}
+	lock_release(nc_lock);
+}
+
+void
+vfs_nc_printstats(void)
+{
+	unsigned hits, neghits, misses, purges, used = 0;
+	int i;
+
+	lock_acquire(nc_lock);
+	hits = nc_hits;
+	neghits = nc_neghits;
+	misses = nc_misses;
+	purges = nc_purges;
+	for (i=0; i<NC_SIZE; i++) {
+		if (nc_entries[i].nc_dir != NULL) {
+			used++;
+		}
+	}
+	lock_release(nc_lock);
+
+	kprintf("vfs name cache: %u/%u entries in use\n", used, NC_SIZE);
+	kprintf("    %u hits, %u negative hits, %u misses, %u purges\n",
+		hits, neghits, misses, purges);
+}
+
+void
+vfs_nc_bootstrap(void)
+{
+	struct ncentry *nc;
+	int i;
+
+	nc_lock = lock_create("vfs namecache");
+	if (nc_lock == NULL) {
+		panic("vfs: Could not create name cache lock\n");
+	}
+
+	for (i=0; i<NC_HASH; i++) {
+		nc_hash[i] = NULL;
+	}
+	nc_gen = 0;
+
+	nc_lruhead = nc_lrutail = NULL;
+	for (i=0; i<NC_SIZE; i++) {
+		nc = &nc_entries[i];
+		nc->nc_dir = NULL;
+		nc->nc_vn = NULL;
+		nc->nc_hashnext = NULL;
+
+		/* all free, so order doesn't matter */
+		nc->nc_lrunext = NULL;
+		nc->nc_lruprev = nc_lrutail;
+		if (nc_lrutail != NULL) {
+			nc_lrutail->nc_lrunext = nc;
+		}
+		else {
+			nc_lruhead = nc;
+		}
+		nc_lrutail = nc;
+	}
+}
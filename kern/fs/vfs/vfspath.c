@@ -45,6 +45,10 @@ vfs_open(char *path, int openflags, struct vnode **ret)
 		}
 
 		result = VOP_CREAT(dir, name, excl, &vn);
+		if (result == 0) {
+			/* it may be new */
+			vfs_nc_purge(dir->vn_fs, 1);
+		}
 
 		VOP_DECREF(dir);
 	}
@@ -121,6 +125,9 @@ vfs_remove(char *path)
 	}
 
 	result = VOP_REMOVE(dir, name);
+	if (result == 0) {
+		vfs_nc_purge(dir->vn_fs, 0);
+	}
 	VOP_DECREF(dir);
 
 	return result;
@@ -154,6 +161,9 @@ vfs_rename(char *oldpath, char *newpath)
 	}
 
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	if (result == 0) {
+		vfs_nc_purge(olddir->vn_fs, 0);
+	}
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -188,6 +198,9 @@ vfs_link(char *oldpath, char *newpath)
 	}
 
 	result = VOP_LINK(newdir, newname, oldfile);
+	if (result == 0) {
+		vfs_nc_purge(newdir->vn_fs, 1);
+	}
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -215,6 +228,9 @@ vfs_symlink(const char *contents, char *path)
 	}
 
 	result = VOP_SYMLINK(newdir, newname, contents);
+	if (result == 0) {
+		vfs_nc_purge(newdir->vn_fs, 1);
+	}
 	VOP_DECREF(newdir);
 
 	return result;
@@ -261,6 +277,9 @@ vfs_mkdir(char *path)
 	}
 
 	result = VOP_MKDIR(parent, name);
+	if (result == 0) {
+		vfs_nc_purge(parent->vn_fs, 1);
+	}
 
 	VOP_DECREF(parent);
 
@@ -283,6 +302,9 @@ vfs_rmdir(char *path)
 	}
 
 	result = VOP_RMDIR(parent, name);
+	if (result == 0) {
+		vfs_nc_purge(parent->vn_fs, 0);
+	}
 
 	VOP_DECREF(parent);
 
@@ -0,0 +1,40 @@
+#ifndef _ARGBUF_H_
+#define _ARGBUF_H_
+
+/*
+ * Argument buffers: the argv of a program being started, held in the
+ * kernel while the old address space goes away and the new one is
+ * loaded.
+ *
+ * The strings are packed back to back in a single ARG_MAX-byte
+ * buffer, so copying in an argv costs one allocation however many
+ * arguments there are, and the total (strings plus the argv array)
+ * is bounded by ARG_MAX. argbuf_copyout builds the whole user stack
+ * image - argv array, NULL, strings - in that same buffer and copies
+ * it out in one go.
+ *
+ * Functions:
+ *       argbuf_init       - set up an empty buffer. Returns 0 or ENOMEM.
+ *       argbuf_copyin     - copy in the NULL-terminated user argv
+ *                           ARGV. Returns E2BIG if it doesn't fit.
+ *       argbuf_fromkernel - same, from NARGS kernel strings.
+ *       argbuf_copyout    - put the arguments on the user stack below
+ *                           *STACKPTR, update *STACKPTR, and return the
+ *                           user address of argv in *ARGV. Can only be
+ *                           done once.
+ *       argbuf_cleanup    - free the buffer.
+ */
+
+struct argbuf {
+	char *ab_buf;		/* ARG_MAX bytes */
+	size_t ab_len;		/* bytes of strings in ab_buf */
+	int ab_nargs;
+};
+
+int  argbuf_init(struct argbuf *ab);
+int  argbuf_copyin(struct argbuf *ab, const_userptr_t argv);
+int  argbuf_fromkernel(struct argbuf *ab, int nargs, char **args);
+int  argbuf_copyout(struct argbuf *ab, vaddr_t *stackptr, userptr_t *argv);
+void argbuf_cleanup(struct argbuf *ab);
+
+#endif /* _ARGBUF_H_ */
@@ -9,6 +9,10 @@
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *                      Searches onward from the last bit allocated.
+ *     bitmap_alloc_near - likewise, but starting from bit GOAL.
+ *     bitmap_alloc_range - set a run of up to WANT cleared bits, starting
+ *                      at or after GOAL; returns the first and how many.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
@@ -20,6 +24,11 @@ struct bitmap;  /* Opaque. */
 struct bitmap *bitmap_create(u_int32_t nbits);
 void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, u_int32_t *index);
+int            bitmap_alloc_near(struct bitmap *, u_int32_t goal,
+				 u_int32_t *index);
+int            bitmap_alloc_range(struct bitmap *, u_int32_t goal,
+				  u_int32_t want, u_int32_t *index,
+				  u_int32_t *count);
 void           bitmap_mark(struct bitmap *, u_int32_t index);
 void           bitmap_unmark(struct bitmap *, u_int32_t index);
 int	       bitmap_isset(struct bitmap *, u_int32_t index);
@@ -0,0 +1,46 @@
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: run a function a given number of clock ticks (1/HZ
+ * seconds) from now.
+ *
+ * Pending callouts are kept in a hashed timer wheel that hardclock()
+ * advances once per tick, so scheduling a callout, and checking each
+ * tick for ones that are due, cost the same however many are pending.
+ * Callout records for callout_schedule come from a fixed pool set up
+ * at boot, so it never calls kmalloc and may be used from an
+ * interrupt handler. callout_sleep keeps its record on the sleeping
+ * thread's stack instead, so any number of threads can sleep at once.
+ *
+ * The function runs from the timer interrupt with interrupts off. It
+ * must not sleep; typically it just calls thread_wakeup, or schedules
+ * itself again.
+ *
+ * Functions:
+ *       callout_bootstrap - set up the wheel and the callout pool.
+ *       callout_schedule  - call FN(ARG) after TICKS ticks (at least
+ *                           one). Returns 0, or EAGAIN if the pool is
+ *                           used up.
+ *       callout_cancel    - remove every pending callout_schedule
+ *                           callout for FN(ARG). Returns how many
+ *                           were removed.
+ *       callout_tick      - advance the wheel by TICKS ticks and run
+ *                           any callouts that are due. Called by
+ *                           hardclock.
+ *       callout_nextevent - ticks until the next callout is due, or -1
+ *                           if none are pending.
+ *       callout_sleep     - put the current thread to sleep for TICKS
+ *                           ticks. Always returns 0.
+ *       callout_printstats - print wheel usage statistics.
+ */
+
+void callout_bootstrap(void);
+int  callout_schedule(int ticks, void (*fn)(void *), void *arg);
+int  callout_cancel(void (*fn)(void *), void *arg);
+void callout_tick(int ticks);
+int  callout_nextevent(void);
+int  callout_sleep(int ticks);
+void callout_printstats(void);
+
+#endif /* _CALLOUT_H_ */
@@ -6,7 +6,16 @@
 /*
  * Time-related definitions.
  *
- * hardclock() is called from the timer interrupt HZ times a second.
+ * hardclock() is called from the timer interrupt. There are HZ ticks a
+ * second, but the timer is only set to go off on the next tick that
+ * something needs doing on (see hardclock.c).
+ * hardclock_attach() is called by the timer device driving hardclock
+ * with functions to set its countdown and to read the time.
+ * hardclock_kick() is called when something may need the clock sooner
+ * than it is set for; interrupts must be off.
+ * hardclock_printstats() prints timer statistics.
+ * clock_getusecs() returns a microsecond count for timing intervals;
+ * it wraps around, so only differences are meaningful.
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
  */
@@ -27,7 +36,15 @@
 #define HZ  100
 #endif
 
+struct thread;
+
 void hardclock(void);
+void hardclock_attach(void *dev, void (*arm)(void *dev, u_int32_t usecs),
+		      void (*gettime)(void *dev, time_t *secs,
+				      u_int32_t *nsecs));
+void hardclock_kick(struct thread *running);
+void hardclock_printstats(void);
+u_int32_t clock_getusecs(void);
 
 void gettime(time_t *seconds, u_int32_t *nanoseconds);
 
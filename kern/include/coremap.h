@@ -4,6 +4,7 @@
 struct coremap_entry {
 	int in_use;
 	int is_kernel;
+	int is_zeroed;	/* free and known to be all zeros */
 	time_t secs;
 	u_int32_t nsecs;
 };
@@ -12,6 +13,8 @@ void coremap_bootstrap();
 vaddr_t is_coremap_initialized(int n);
 int get_free_kpages(int n);
 int get_free_page();
+int get_zeroed_page();
+int coremap_zero_idle();
 int coremap_entry_count();
 void free_page(int page);
 int coremap_is_kernel(int index);
@@ -30,6 +30,7 @@ struct fd{
 	struct vnode * vnode;	// See kern/include/vnode.h for more info
 	off_t offset;			// File pointer offset
 	size_t flags;			// read, write or append permissions
+	int refcount;			// table slots sharing this fd (dup2)
 };
 
 // Initialize fdt 
@@ -44,12 +45,24 @@ struct fd{
 // Returns -1 on error
 // int fdt_add (struct fdt * fdt, const char * filename, struct vnode * vnode, int flags);
 
+// Set up the cache fd structures come from. Call once during startup.
+void fd_bootstrap(void);
+
 int fd_init(char *name, int flag, struct fd **retval);
 
 int fd_init_initial(struct thread * t);
 
 int fd_copy(struct fd *master, struct fd **copy);
 
+// Copy a whole table for a new thread, keeping slots that share an fd
+// shared in the copy. On error nothing is left in TO.
+int fd_copytable(struct fd **from, struct fd **to);
+
+// Share an fd in another slot of the same table (dup2). Refcounts are
+// only touched by the thread that owns the table, so need no lock.
+void fd_incref(struct fd *des);
+
+// Drop one slot's reference; the file is closed with the last one.
 void fd_destroy(struct fd *des);
 
 #endif /* _FILE_CALLS_H_ */
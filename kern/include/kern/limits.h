@@ -7,6 +7,9 @@
 /* Longest full path name */
 #define PATH_MAX   1024
 
+/* Most bytes of arguments (strings plus argv pointers) for execv */
+#define ARG_MAX   16384
+
 /* Largest amount of Process ID's that can be used at a time */
 #define PID_MAX 128
 
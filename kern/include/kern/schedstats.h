@@ -0,0 +1,21 @@
+#ifndef _KERN_SCHEDSTATS_H_
+#define _KERN_SCHEDSTATS_H_
+
+/*
+ * Per-thread scheduler accounting, as returned by the schedstats
+ * system call. Times are in microseconds and wrap around after a
+ * little over an hour.
+ */
+
+struct schedstats {
+	u_int32_t ss_cpuusecs;		/* time spent running */
+	u_int32_t ss_waitusecs;		/* time spent runnable, waiting to run */
+	u_int32_t ss_maxwaitusecs;	/* longest single wait to run */
+	u_int32_t ss_sleepusecs;	/* time spent asleep or blocked */
+	u_int32_t ss_dispatches;	/* times picked to run */
+	u_int32_t ss_nvoluntary;	/* switches away by sleeping or yielding */
+	u_int32_t ss_ninvoluntary;	/* switches away by being preempted */
+	int32_t ss_priority;		/* current run queue level */
+};
+
+#endif /* _KERN_SCHEDSTATS_H_ */
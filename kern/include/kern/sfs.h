@@ -2,27 +2,50 @@
 #define _KERN_SFS_H_
 
 #define SFS_MAGIC         0xabadf001    /* magic number identifying us */
-#define SFS_BLOCKSIZE     512           /* size of our blocks */
+#define SFS_MINBLOCKSIZE  512           /* smallest (and default) block */
+#define SFS_MAXBLOCKSIZE  4096          /* largest block */
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
-#define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
+#define SFS_NINDIRECT      3            /* levels of indirect blocks */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SB_LOCATION    0            /* block the superblock lives in */
 #define SFS_ROOT_LOCATION  1            /* loc'n of the root dir inode */
 #define SFS_MAP_LOCATION   2            /* 1st block of the freemap */
 #define SFS_NOINO          0            /* inode # for free dir entry */
 
+/*
+ * The block size is chosen by mksfs, as a power of 2 from
+ * SFS_MINBLOCKSIZE to SFS_MAXBLOCKSIZE, and kept in the superblock.
+ * Block numbers everywhere are in units of it. The superblock and
+ * inodes are SFS_MINBLOCKSIZE bytes at the start of their blocks; the
+ * rest of those blocks is unused.
+ */
+
+/* # direct blks per indirect blk */
+#define SFS_DBPERIDB(bsize)     ((bsize) / sizeof(u_int32_t))
+
+/* # dir entries per block */
+#define SFS_DIRPERBLOCK(bsize)  ((bsize) / sizeof(struct sfs_dir))
+
 /* Number of bits in a block */
-#define SFS_BLOCKBITS (SFS_BLOCKSIZE * CHAR_BIT)
+#define SFS_BLOCKBITS(bsize)    ((bsize) * CHAR_BIT)
 
 /* Utility macro */
-#define SFS_ROUNDUP(a,b)       ((((a)+(b)-1)/(b))*b)
+#define SFS_ROUNDUP(a,b)       ((((a)+(b)-1)/(b))*(b))
 
 /* Size of bitmap (in bits) */
-#define SFS_BITMAPSIZE(nblocks) SFS_ROUNDUP(nblocks, SFS_BLOCKBITS)
+#define SFS_BITMAPSIZE(nblocks, bsize) \
+	SFS_ROUNDUP(nblocks, SFS_BLOCKBITS(bsize))
 
 /* Size of bitmap (in blocks) */
-#define SFS_BITBLOCKS(nblocks)  (SFS_BITMAPSIZE(nblocks)/SFS_BLOCKBITS)
+#define SFS_BITBLOCKS(nblocks, bsize) \
+	(SFS_BITMAPSIZE(nblocks, bsize)/SFS_BLOCKBITS(bsize))
+
+/* Features for sp_features */
+#define SFS_FEATURE_DIRHASH  0x00000001  /* may have hashed directories */
+
+/* Flags for sfi_flags */
+#define SFS_IFLAG_DIRHASH    0x00000001  /* directory has a hash index */
 
 /* File types for dfi_type */
 #define SFS_TYPE_INVAL    0       /* Should not appear on disk */
@@ -36,11 +59,18 @@ struct sfs_super {
 	u_int32_t sp_magic;       /* Magic number, should be SFS_MAGIC */
 	u_int32_t sp_nblocks;     /* Number of blocks in fs */
 	char sp_volname[SFS_VOLNAME_SIZE];  /* Name of this volume */
-	u_int32_t reserved[118];
+	u_int32_t sp_features;    /* SFS_FEATURE_* flags */
+	u_int32_t sp_blocksize;   /* Block size; 0 for SFS_MINBLOCKSIZE */
+	u_int32_t reserved[116];
 };
 
 /*
  * On-disk inode
+ *
+ * The first SFS_NDIRECT blocks of a file are listed in the inode. The
+ * next SFS_DBPERIDB are listed in the indirect block; the next
+ * SFS_DBPERIDB^2 in the blocks listed in the double indirect block;
+ * and so on for the triple indirect block, which is as far as it goes.
  */
 struct sfs_inode {
 	u_int32_t sfi_size;        /* Size of this file (bytes) */
@@ -48,7 +78,10 @@ struct sfs_inode {
 	u_int16_t sfi_linkcount;   /* Number of hard links to this file */
 	u_int32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	u_int32_t sfi_indirect;			/* Indirect block */
-	u_int32_t sfi_waste[128-3-SFS_NDIRECT]; /* unused space */
+	u_int32_t sfi_flags;			/* SFS_IFLAG_* flags */
+	u_int32_t sfi_dindirect;		/* Double indirect block */
+	u_int32_t sfi_tindirect;		/* Triple indirect block */
+	u_int32_t sfi_waste[128-6-SFS_NDIRECT]; /* unused space */
 };
 
 /*
@@ -59,4 +92,42 @@ struct sfs_dir {
 	char sfd_name[SFS_NAMELEN];  /* Filename */
 };
 
+/*
+ * Hashed directories.
+ *
+ * A directory with SFS_IFLAG_DIRHASH set is made of whole blocks.
+ * Block 0 of it is the root of an index from name hash (see
+ * sfs_dirhash() in the kernel) to blocks of directory entries
+ * ("leaves"). The index is sorted by hash, and each leaf holds the
+ * names with hashes from that of its index entry up to the next one.
+ * The root's first entry always has hash 0.
+ *
+ * If sdi_depth in the root is 0 its entries point at leaves; if it's
+ * 1 they point at further index blocks, with depth 0, which point at
+ * leaves. Block numbers are within the directory. The slots taken up
+ * by index blocks look like free entries to code that doesn't know
+ * about the index, except that the first has SFS_DIRINDEX_MAGIC where
+ * the inode number would be.
+ */
+#define SFS_DIRINDEX_MAGIC  0xabad1dea
+
+/* Entries in an index block (63 for 512-byte blocks) */
+#define SFS_DIRINDEX_MAX(bsize) \
+	(((bsize) - sizeof(struct sfs_dirindex)) / sizeof(struct sfs_diridx))
+
+/* The entries, which fill the rest of the block after the header */
+#define SFS_DIRIDX(di)      ((struct sfs_diridx *)((di) + 1))
+
+struct sfs_diridx {
+	u_int32_t sdx_hash;             /* lowest hash in the block */
+	u_int32_t sdx_block;            /* block within the directory */
+};
+
+struct sfs_dirindex {
+	u_int32_t sdi_magic;            /* SFS_DIRINDEX_MAGIC */
+	u_int16_t sdi_depth;            /* levels of index below this */
+	u_int16_t sdi_count;            /* entries in use */
+	/* followed by SFS_DIRINDEX_MAX(blocksize) struct sfs_diridx */
+};
+
 #endif /* _KERN_SFS_H_ */
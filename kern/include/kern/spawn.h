@@ -0,0 +1,35 @@
+#ifndef _KERN_SPAWN_H_
+#define _KERN_SPAWN_H_
+
+/*
+ * File actions for spawn().
+ *
+ * The child starts with a copy of the parent's file table. The
+ * actions are then carried out in order in the child, before the
+ * program is loaded:
+ *
+ *     SPAWN_FD_CLOSE - close sfa_fd.
+ *     SPAWN_FD_OPEN  - open sfa_path with open() flags sfa_flags as
+ *                      sfa_fd, closing whatever was there.
+ *     SPAWN_FD_DUP2  - make sfa_fd refer to the same open file as
+ *                      sfa_srcfd, sharing its offset.
+ *
+ * Fields an action doesn't use are ignored.
+ */
+
+#define SPAWN_FD_CLOSE   0
+#define SPAWN_FD_OPEN    1
+#define SPAWN_FD_DUP2    2
+
+/* Most file actions one spawn() can take */
+#define SPAWN_MAX_FDACTIONS  16
+
+struct spawn_fdaction {
+	int sfa_op;		/* SPAWN_FD_* */
+	int sfa_fd;		/* file handle in the child */
+	int sfa_srcfd;		/* DUP2: handle to copy */
+	int sfa_flags;		/* OPEN: O_* flags */
+	const char *sfa_path;	/* OPEN: file to open */
+};
+
+#endif /* _KERN_SPAWN_H_ */
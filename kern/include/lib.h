@@ -91,6 +91,16 @@ void *kmalloc(size_t sz);
 void kfree(void *ptr);
 void kheap_printstats(void);
 
+/*
+ * Optional kmalloc profiling. While enabled, live allocations are
+ * charged to kmalloc's caller and to their size class. Turning it on
+ * discards any previous profile. kheap_printprofile prints the N
+ * call sites holding the most memory.
+ */
+void kheap_setprofiling(int on);
+int kheap_getprofiling(void);
+void kheap_printprofile(int n);
+
 /*
  * C string functions. 
  *
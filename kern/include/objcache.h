@@ -0,0 +1,46 @@
+#ifndef _OBJCACHE_H_
+#define _OBJCACHE_H_
+
+/*
+ * Object cache: a front end to kmalloc for kernel objects of one type
+ * that are created and destroyed often (threads, locks, file handles,
+ * vnodes...).
+ *
+ * Freed objects are kept, up to a limit, and handed out again by the
+ * next allocation without going to kmalloc. An object is constructed
+ * by CTOR when it is first taken from kmalloc and destructed by DTOR
+ * only when it is finally given back to kmalloc. Objects must be in
+ * their constructed state when passed to objcache_free, so a reuse
+ * pays for neither. CTOR and DTOR may be NULL.
+ *
+ * Functions:
+ *       objcache_create  - create a cache called NAME for objects of
+ *                          SIZE bytes, keeping at most LIMIT free
+ *                          objects around. CTOR returns 0 or an error
+ *                          code. Returns NULL on error.
+ *       objcache_alloc   - get a constructed object. Returns NULL if
+ *                          out of memory or the constructor fails.
+ *       objcache_free    - give an object back to its cache.
+ *       objcache_prealloc - construct objects until at least N are
+ *                          free in the cache, raising its limit to N
+ *                          if need be. Returns 0 or an error code.
+ *       objcache_destroy - dispose of the cache and any free objects
+ *                          in it. All objects must have been freed.
+ *       objcache_printstats - print usage statistics for every cache.
+ *
+ * These may be called from any thread context; the cache itself is
+ * protected by turning interrupts off.
+ */
+
+struct objcache; /* Opaque. */
+
+struct objcache *objcache_create(const char *name, size_t size, int limit,
+				 int (*ctor)(void *obj),
+				 void (*dtor)(void *obj));
+void            *objcache_alloc(struct objcache *oc);
+void             objcache_free(struct objcache *oc, void *obj);
+int              objcache_prealloc(struct objcache *oc, int n);
+void             objcache_destroy(struct objcache *oc);
+void             objcache_printstats(void);
+
+#endif /* _OBJCACHE_H_ */
@@ -1,19 +1,33 @@
 /*
 	pid.h
 
+	Process IDs and per-process records; see pid.c.
+
+	pid_alloc      - give a thread a pid, as a child of process PARENT
+	                 or detached if PARENT is 0. Returns 0 on failure.
+	pid_unalloc    - take back a pid whose thread never ran.
+	pid_getthread  - the running thread with a pid, or NULL.
+	pid_getstats   - scheduler accounting for a running process.
+	pid_setexitcode - set the code reported when a process exits.
+	pid_exit       - a process has exited; called from thread_exit.
+	pid_wait       - wait for a child (or any child, pid -1) to exit.
 */
 #ifndef _PID_H_
 #define _PID_H_
 
+struct thread;
+struct schedstats;
+
 void pid_setuptable(void);
 void pid_destroy(void);
 
-pid_t pid_getnext(struct thread *master);
+pid_t pid_alloc(struct thread *master, pid_t parent);
+void pid_unalloc(pid_t pid);
 struct thread * pid_getthread(pid_t pid);
-int pid_getexitcode(pid_t pid);
+int pid_getstats(pid_t pid, struct schedstats *stats);
 void pid_setexitcode(pid_t pid, int exitcode);
-void pid_clear(pid_t pid);
-int pid_is_child(struct thread *thread, pid_t pid2);
+void pid_exit(pid_t pid);
+int pid_wait(pid_t pid, int options, int *exitcode, pid_t *retpid);
 
 
 #endif /* _PID_H_ */
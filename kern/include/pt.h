@@ -16,6 +16,7 @@ struct page_table_entry {
 int pt_init(int pages, int coremap_size, paddr_t starting_paddr, vaddr_t coremap_vaddr, struct lock *mutex);
 paddr_t pt_get_paddr(pid_t pid, vaddr_t vaddr);
 paddr_t pt_alloc_page(pid_t pid, vaddr_t vaddr, int writeable, int dirty);
+paddr_t pt_alloc_zeroed_page(pid_t pid, vaddr_t vaddr, int writeable, int dirty, int *zeroed);
 vaddr_t pt_alloc_kpages(pid_t pid, int npages);
 int pt_copymem(pid_t curpid, pid_t pid);
 int pt_search_swap (pid_t pid, vaddr_t va);
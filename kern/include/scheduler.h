@@ -8,8 +8,20 @@
  *     make_runnable - add the specified thread to the run queue. If it's
  *                     already on the run queue or sleeping, weird things
  *                     may happen. Returns an error code.
+ *     scheduler_wakeup - like make_runnable, for a thread that was
+ *                     waiting for a device (thread_sleep_io); raises
+ *                     its priority.
+ *     scheduler_tick - called from hardclock with the ticks gone by since
+ *                     the last call. Returns nonzero if the current
+ *                     thread should be preempted.
+ *     scheduler_nextevent - ticks until the given running thread may
+ *                     need preempting, or -1 if never.
+ *     scheduler_setquantum - set the quantum of the top level, in ticks.
+ *                     Returns an error code.
+ *     scheduler_getquantum - return the quantum of the top level.
  *
  *     print_run_queue - dump the run queue to the console for debugging.
+ *     scheduler_printstats - print per-level run queue statistics.
  *
  *     scheduler_bootstrap - initialize scheduler data 
  *                           (must happen early in boot)
@@ -22,8 +34,14 @@ struct thread;
 
 struct thread *scheduler(void);
 int make_runnable(struct thread *t);
+int scheduler_wakeup(struct thread *t);
+int scheduler_tick(int ticks);
+int scheduler_nextevent(struct thread *running);
+int scheduler_setquantum(int ticks);
+int scheduler_getquantum(void);
 
 void print_run_queue(void);
+void scheduler_printstats(void);
 
 void scheduler_bootstrap(void);
 int scheduler_preallocate(int numthreads);
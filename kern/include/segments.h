@@ -14,6 +14,7 @@ struct segdef {
 	off_t sd_offset;
 };
 
+void sd_bootstrap(void);
 struct segdef *sd_create(void);
 struct segdef *sd_copy(struct segdef *old);
 void sd_destroy(struct segdef *segdef);
@@ -28,5 +29,13 @@ struct segdef *sd_get_by_addr(struct addrspace *as, vaddr_t vbase);
 
 int load_segment(struct vnode *v, off_t offset, vaddr_t vaddr, 
 	     size_t memsize, size_t filesize, int is_executable);
+
+/*part of /userprog/loadelf
+ * loads one page of an elf segment into physical frame PADDR through
+ * its kernel address, zero-filling past FILESIZE. Unlike load_segment
+ * the page needn't be mapped in the TLB while this runs.
+ */
+int load_page(struct vnode *v, off_t offset, paddr_t paddr,
+	     size_t filesize);
 #endif
 
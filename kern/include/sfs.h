@@ -18,6 +18,85 @@ struct sfs_vnode {
 	struct sfs_inode sv_i;		/* on-disk inode */
 	u_int32_t sv_ino;               /* inode number */
 	int sv_dirty;                   /* true if sv_i modified */
+	struct sfs_vnode *sv_hashnext;  /* resident vnode hash chain */
+	struct sfs_vnode **sv_hashprevp;
+	u_int32_t sv_ranext;            /* block a sequential read wants */
+	u_int32_t sv_rawin;             /* read-ahead window (blocks) */
+	u_int32_t sv_raend;             /* read ahead up to here already */
+};
+
+/*
+ * Resident vnodes are hashed by inode number so sfs_loadvnode can
+ * tell quickly whether one is already in memory.
+ */
+#define SFS_VNHASH     128	/* hash buckets; power of 2 */
+#define SFS_VNHASHFN(ino)  ((ino) & (SFS_VNHASH-1))
+
+/*
+ * Buffer cache (sfs_cache.c).
+ *
+ * Each mounted volume keeps SFS_CACHESIZE bytes' worth of block
+ * buffers, but at least SFS_MINBUFS of them, found by block
+ * number through a hash table and recycled least recently used first.
+ * Inodes, indirect blocks and partial-block file I/O go through it;
+ * whole-block file I/O goes straight to the device unless the block
+ * is already cached. Modified buffers are only marked dirty, and are
+ * written back when recycled, or by sfs_bsync (called from sync and
+ * fsync). The superblock and free map don't go through the cache.
+ *
+ * A buffer handed out by sfs_bread/sfs_bget is pinned and can't be
+ * recycled until sfs_brelse. Nothing is locked while it's pinned, so
+ * it may be held across a uiomove that faults.
+ * If every buffer is pinned, a thread that needs one waits for an
+ * sfs_brelse; a single thread may never pin the whole cache.
+ *
+ * Device I/O for the cache is done with the cache unlocked. The
+ * buffer is marked busy meanwhile, and anyone else who wants that
+ * block waits for it; lookups of other blocks go ahead.
+ */
+#define SFS_CACHESIZE  32768	/* bytes cached per mounted volume */
+#define SFS_MINBUFS    16	/* fewest buffers per mounted volume */
+#define SFS_BUFHASH    32	/* hash buckets; power of 2 */
+
+/*
+ * Read-ahead. A read that starts where the last read of the same
+ * file left off is taken as sequential, and the blocks after it are
+ * queued with sfs_bprefetch, to be read into the cache by
+ * SFS_RATHREADS kernel threads, so several can be waiting at the disk
+ * at once. The window starts at one block and doubles with each
+ * sequential read up to SFS_RAMAX, or a quarter of the buffers if
+ * that's less; any other read shuts it off.
+ */
+#define SFS_RAMAX      16	/* most blocks to read ahead */
+#define SFS_RAQUEUE    32	/* prefetches waiting, all volumes */
+#define SFS_RATHREADS  4	/* read-ahead threads, all volumes */
+
+struct sfs_buf {
+	u_int32_t sb_block;		/* disk block held */
+	int sb_inuse;			/* sb_block (and data) mean anything */
+	int sb_dirty;			/* needs writing back */
+	int sb_refcount;		/* pins */
+	int sb_busy;			/* being read or written back */
+	int sb_stale;			/* forgotten while pinned; unhashed */
+	struct sfs_buf *sb_hashnext;	/* hash chain */
+	struct sfs_buf *sb_lrunext;	/* LRU list, most recent first */
+	struct sfs_buf *sb_lruprev;
+	void *sb_data;			/* sfs_blocksize bytes */
+};
+
+struct sfs_bufcache {
+	struct lock *bc_lock;
+	struct cv *bc_iodone;		/* some buffer stopped being busy */
+	struct cv *bc_unpinned;		/* some buffer's last pin went */
+	struct sfs_buf *bc_bufs;	/* bc_nbufs of them */
+	int bc_nbufs;
+	struct sfs_buf *bc_hash[SFS_BUFHASH];
+	struct sfs_buf *bc_lruhead;
+	struct sfs_buf *bc_lrutail;
+
+	/* statistics */
+	unsigned bc_hits, bc_misses, bc_writebacks, bc_prefetches;
+	unsigned bc_pinwaits;
 };
 
 struct sfs_fs {
@@ -25,9 +104,12 @@ struct sfs_fs {
 	struct sfs_super sfs_super;	/* on-disk superblock */
 	int sfs_superdirty;             /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct array *sfs_vnodes;       /* vnodes loaded into memory */
+	u_int32_t sfs_blocksize;        /* from sp_blocksize */
+	struct sfs_vnode *sfs_vnhash[SFS_VNHASH]; /* vnodes in memory */
+	unsigned sfs_nvnodes;           /* how many */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	int sfs_freemapdirty;           /* true if freemap modified */
+	struct sfs_bufcache sfs_bufcache; /* cached blocks */
 };
 
 /*
@@ -40,14 +122,47 @@ int sfs_mount(const char *device);
  * Internal functions
  */
 
+/* Shortcuts for the block size macros in kern/sfs.h */
+#define SFS_FS_DBPERIDB(sfs)      SFS_DBPERIDB((sfs)->sfs_blocksize)
+#define SFS_FS_DIRPERBLOCK(sfs)   SFS_DIRPERBLOCK((sfs)->sfs_blocksize)
+#define SFS_FS_DIRINDEX_MAX(sfs)  SFS_DIRINDEX_MAX((sfs)->sfs_blocksize)
+
 /* Initialize uio structure */
-#define SFSUIO(uio, ptr, block, rw) \
-    mk_kuio(uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
+#define SFSUIO(sfs, uio, ptr, block, rw) \
+    mk_kuio(uio, ptr, (sfs)->sfs_blocksize, \
+	    ((off_t)(block))*(sfs)->sfs_blocksize, rw)
 
 /* Convenience functions for block I/O */
 int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, u_int32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, u_int32_t block);
+int sfs_rwsuper(struct sfs_fs *sfs, enum uio_rw rw);
+
+/* Buffer cache; see above. sfs_bread reads the block in, sfs_bget
+ * leaves its contents undefined for the caller to fill. sfs_bpeek
+ * returns the block pinned if it's cached, else NULL. sfs_bforget
+ * drops a stale copy of a block written without the cache. */
+int sfs_bcache_init(struct sfs_fs *sfs);
+void sfs_bcache_destroy(struct sfs_fs *sfs);
+int sfs_bread(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret);
+int sfs_bget(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret);
+struct sfs_buf *sfs_bpeek(struct sfs_fs *sfs, u_int32_t block);
+void sfs_bforget(struct sfs_fs *sfs, u_int32_t block);
+void sfs_bdirty(struct sfs_buf *buf);
+void sfs_brelse(struct sfs_fs *sfs, struct sfs_buf *buf);
+int sfs_bsync(struct sfs_fs *sfs);
+
+/* Read-ahead; see above. sfs_bprefetch drops the request if the
+ * queue is full. sfs_bprefetch_pending tells a read that bypasses the
+ * cache to go through it after all, since read-ahead wants the block
+ * too. sfs_bprefetch_cancel is for unmount. */
+int sfs_readahead_init(void);
+void sfs_bprefetch(struct sfs_fs *sfs, u_int32_t block);
+int sfs_bprefetch_pending(struct sfs_fs *sfs, u_int32_t block);
+void sfs_bprefetch_cancel(struct sfs_fs *sfs);
+
+/* Create the cache sfs_vnodes are allocated from */
+int sfs_vnodecache_init(void);
 
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
@@ -5,19 +5,33 @@
 #ifndef _SYNCH_H_
 #define _SYNCH_H_
 
+#include <threadlist.h>
 #include "opt-A1.h"
 
+/*
+ * Semaphores, locks, and CVs are allocated from object caches; call
+ * synch_bootstrap once during startup, before creating any of them.
+ *
+ * Each object keeps a copy of its name for easier debugging. Names
+ * longer than SYNCH_NAMELEN-1 characters are truncated.
+ */
+#define SYNCH_NAMELEN 32
+
+void synch_bootstrap(void);
+
 /*
  * Dijkstra-style semaphore.
  * Operations:
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *     P_io:         like P, for waiting on a device. The scheduler
+ *                   boosts a thread woken from it.
  * 
  * Both operations are atomic.
  *
  * The name field is for easier debugging. A copy of the name is made
- * internally.
+ * internally (see SYNCH_NAMELEN above).
  */
 
 struct semaphore {
@@ -27,6 +41,7 @@ struct semaphore {
 
 struct semaphore *sem_create(const char *name, int initial_count);
 void              P(struct semaphore *);
+void              P_io(struct semaphore *);
 void              V(struct semaphore *);
 void              sem_destroy(struct semaphore *);
 
@@ -46,8 +61,11 @@ void              sem_destroy(struct semaphore *);
  * When the lock is created, no thread should be holding it. Likewise,
  * when the lock is destroyed, no thread should be holding it.
  *
+ * Waiters queue up in FIFO order. lock_release hands the lock directly
+ * to the first waiter, which wakes up already holding it.
+ *
  * The name field is for easier debugging. A copy of the name is made
- * internally.
+ * internally (see SYNCH_NAMELEN above).
  */
 
 struct lock {
@@ -55,6 +73,7 @@ struct lock {
 
     #if OPT_A1
         volatile struct thread *holder;
+        struct threadlist waiters;
     #endif /* OPT_A1 */
 };
 
@@ -85,17 +104,18 @@ void         lock_destroy(struct lock *);
  * These operations must be atomic. You get to write them.
  *
  * These CVs are expected to support Mesa semantics, that is, no
- * guarantees are made about scheduling.
+ * guarantees are made about scheduling. Waiters are woken in the order
+ * they started waiting.
  *
  * The name field is for easier debugging. A copy of the name is made
- * internally.
+ * internally (see SYNCH_NAMELEN above).
  */
 
 struct cv {
 	char *name;
 
     #if OPT_A1
-
+        struct threadlist waiters;
     #endif /* OPT_A1 */
 };
 
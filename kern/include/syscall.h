@@ -53,5 +53,21 @@ int sys_write(int fd, const_userptr_t data, size_t len, int *retval);
  * code resides in /kern/userprog/progcalls.c
  */
 int sys_getpid(int *retval);
+
+/* SYS_nanosleep system call
+ * code resides in /kern/userprog/progcalls.c
+ */
+int sys_nanosleep(time_t seconds, unsigned long nanoseconds);
+
+/* SYS_schedstats system call
+ * code resides in /kern/userprog/progcalls.c
+ */
+int sys_schedstats(pid_t pid, userptr_t buf);
+
+/* SYS_spawn system call
+ * code resides in /kern/userprog/spawn.c
+ */
+int sys_spawn(const_userptr_t path, userptr_t argv, const_userptr_t actions,
+	      int nactions, int *retval);
 #endif /* OPT_A2 */
 #endif /* _SYSCALL_H_ */
@@ -33,6 +33,7 @@ int readstress(int, char **);
 int writestress(int, char **);
 int writestress2(int, char **);
 int createstress(int, char **);
+int renametest(int, char **);
 int printfile(int, char **);
 
 /* other tests */
@@ -46,4 +47,12 @@ void menu(char *argstr);
 /* Routine for running userlevel test code. */
 int runprogram(char *progname, int nargs, char **args);
 
+/* Load a program for the current thread without starting it. */
+struct argbuf;
+struct vnode;
+int progload(char *progname, struct argbuf *args,
+	     vaddr_t *entrypoint, vaddr_t *stackptr, userptr_t *argv);
+int progload_vnode(struct vnode *v, struct argbuf *args,
+		   vaddr_t *entrypoint, vaddr_t *stackptr, userptr_t *argv);
+
 #endif /* _TEST_H_ */
@@ -7,12 +7,15 @@
 
 /* Get machine-dependent stuff */
 #include <machine/pcb.h>
+#include <kern/schedstats.h>
 #include <filecalls.h>
 #include <synch.h>
+#include <threadlist.h>
 #include "opt-A1.h"
 #include "opt-A2.h"
 
 struct addrspace;
+struct sleepq;
 
 struct thread {
 	/**********************************************************/
@@ -22,7 +25,20 @@ struct thread {
 	struct pcb t_pcb;
 	char *t_name;
 	const void *t_sleepaddr;
+	struct sleepq *t_sleepq;	/* lent out while asleep */
+	struct thread *t_sleepnext;	/* next on the same wait queue */
+	int t_iowait;			/* sleeping in thread_sleep_io */
 	char *t_stack;
+
+	/* Scheduler state; see scheduler.c */
+	int t_priority;		/* run queue level, 0 is highest */
+	int t_ticksleft;	/* ticks left in current quantum */
+
+	/* Scheduler accounting; see thread.c */
+	struct schedstats t_stats;
+	u_int32_t t_stamp;		/* clock_getusecs() at last switch */
+	struct thread *t_allnext;	/* list of all threads */
+	struct thread **t_allprevp;
 	
 	/**********************************************************/
 	/* Public thread members - can be used by other code      */
@@ -41,16 +57,18 @@ struct thread {
 	 */
 	struct vnode *t_cwd;
 
+	/*
+	 * Buffer cache pins held (see sfs_cache.c), so the cache can
+	 * tell waiting for a buffer from waiting on ourselves.
+	 */
+	int t_bufpins;
+
 	#if OPT_A2
 	/* Process ID
 	 * Since OS161 is 1 thread per process, no need to create an extra object
 	 * the thread can hold the process info aswell */
 	pid_t t_pid;
-	pid_t t_ppid;
 
-	/* condition variable used as a signal for waitpid */
-	struct cv *t_cvwaitpid;
-	
 	/* File descriptors
 	 * each thread has unique file table */
 	struct fd *t_filetable[MAX_FD];
@@ -58,8 +76,6 @@ struct thread {
 	#endif 
 };
 
-void sys_init();
-
 /* Call once during startup to allocate data structures. */
 struct thread *thread_bootstrap(void);
 
@@ -84,6 +100,17 @@ int thread_fork(const char *name,
 		void (*func)(void *, unsigned long),
 		struct thread **ret);
 
+#if OPT_A2
+/*
+ * Like thread_fork, but the new thread gets a pid that is a child of
+ * the current process, so it can be waited for with waitpid.
+ */
+int thread_fork_child(const char *name, 
+		      void *data1, unsigned long data2, 
+		      void (*func)(void *, unsigned long),
+		      struct thread **ret);
+#endif
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -105,6 +132,13 @@ void thread_yield(void);
  */
 void thread_sleep(const void *addr);
 
+/*
+ * Like thread_sleep, for a thread waiting for a device (disk,
+ * console). The scheduler boosts it a level when it wakes; other
+ * sleeps and blocks wake it at the level it had.
+ */
+void thread_sleep_io(const void *addr);
+
 /*
  * Cause all threads sleeping on the specified address to wake up.
  * Interrupts must be disabled.
@@ -150,6 +184,26 @@ int thread_hassleepers(const void *addr);
  */
 int one_thread_only(void);
 
+/*
+ * Make sure at least N thread structures and kernel stacks are cached,
+ * so that forking that many threads needs no kmalloc. Returns 0 or
+ * ENOMEM.
+ */
+int thread_prealloc(int n);
+
+/*
+ * Scheduler accounting.
+ *
+ * thread_getstats copies the accounting for thread T into STATS.
+ * Interrupts need not be disabled.
+ *
+ * thread_printstats prints the accounting for every thread and the
+ * system-wide histograms of run queue waits and of how long threads
+ * run once picked.
+ */
+void thread_getstats(struct thread *t, struct schedstats *stats);
+void thread_printstats(void);
+
 /*
  * Private thread functions.
  */
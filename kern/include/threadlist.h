@@ -0,0 +1,33 @@
+#ifndef _THREADLIST_H_
+#define _THREADLIST_H_
+
+struct thread;
+
+/*
+ * FIFO list of blocked threads, for synchronization primitives that
+ * keep their own wait queues instead of sleeping on an address.
+ *
+ *    threadlist_init    - initialize an empty list.
+ *    threadlist_isempty - return true if no thread is on the list.
+ *    thread_block       - put the current thread at the end of the list
+ *                         and switch away until it is unblocked.
+ *    thread_unblock_one - make the first thread on the list runnable
+ *                         and return it; returns NULL if the list is
+ *                         empty.
+ *    thread_unblock_all - make every thread on the list runnable.
+ *
+ * Interrupts must be disabled for all but threadlist_init.
+ */
+struct threadlist {
+	struct thread *tl_head;
+	struct thread *tl_tail;
+	int tl_count;
+};
+
+void threadlist_init(struct threadlist *tl);
+int threadlist_isempty(struct threadlist *tl);
+void thread_block(struct threadlist *tl);
+struct thread *thread_unblock_one(struct threadlist *tl);
+void thread_unblock_all(struct threadlist *tl);
+
+#endif /* _THREADLIST_H_ */
@@ -132,6 +132,30 @@ int vfs_getcwd(struct uio *buf);
 
 void vfs_bootstrap(void);
 
+/*
+ * Name cache (vfsnamecache.c), used by vfs_lookup.
+ *
+ *    vfs_nc_bootstrap  - Set up; called from vfs_bootstrap.
+ *    vfs_nc_lookup     - Look up a path from a directory in the cache.
+ *    vfs_nc_enter      - Add what the filesystem found for a path.
+ *    vfs_nc_purge      - Forget lookups on a filesystem, or just the
+ *                        ones that found nothing. Anything that changes
+ *                        a directory must call this.
+ *    vfs_nc_printstats - Print hit rates.
+ *
+ * Paths longer than VFS_NC_NAMELEN aren't cached.
+ */
+
+#define VFS_NC_NAMELEN  47
+
+void vfs_nc_bootstrap(void);
+int vfs_nc_lookup(struct vnode *dir, const char *path, struct vnode **ret,
+		  unsigned *gen);
+void vfs_nc_enter(struct vnode *dir, const char *path, struct vnode *vn,
+		  unsigned gen);
+void vfs_nc_purge(struct fs *fs, int negonly);
+void vfs_nc_printstats(void);
+
 void vfs_initbootfs(void);
 int vfs_setbootfs(const char *fsname);
 void vfs_clearbootfs(void);
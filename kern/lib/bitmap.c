@@ -24,6 +24,7 @@
 struct bitmap {
 	u_int32_t nbits;
 	WORD_TYPE *v;
+	u_int32_t hint;		/* where the next search starts */
 };
 
 
@@ -46,6 +47,7 @@ bitmap_create(u_int32_t nbits)
 
 	bzero(b->v, words*sizeof(WORD_TYPE));
 	b->nbits = nbits;
+	b->hint = 0;
 
 	/* Mark any leftover bits at the end in use */
 	if (nbits / BITS_PER_WORD < words) {
@@ -69,39 +71,122 @@ bitmap_getdata(struct bitmap *b)
 	return b->v;
 }
 
+static
+inline
+void
+bitmap_translate(u_int32_t bitno, u_int32_t *ix, WORD_TYPE *mask)
+{
+	u_int32_t offset;
+	*ix = bitno / BITS_PER_WORD;
+	offset = bitno % BITS_PER_WORD;
+	*mask = ((WORD_TYPE)1) << offset;
+}
+
+/*
+ * Index of the lowest clear bit in W, which must not be all ones.
+ */
+static
+inline
+u_int32_t
+bitmap_ffz(WORD_TYPE w)
+{
+	u_int32_t offset = 0;
+
+	assert(w != WORD_ALLBITS);
+	if ((w & 0x0f) == 0x0f) {
+		w >>= 4;
+		offset += 4;
+	}
+	if ((w & 0x03) == 0x03) {
+		w >>= 2;
+		offset += 2;
+	}
+	if (w & 0x01) {
+		offset++;
+	}
+	return offset;
+}
+
+/*
+ * Find the first clear bit at or after START, wrapping around to the
+ * beginning if need be. Full words are skipped whole. The spare bits
+ * at the end of the last word are always set, so they never turn up.
+ */
+static
 int
-bitmap_alloc(struct bitmap *b, u_int32_t *index)
+bitmap_findfree(struct bitmap *b, u_int32_t start, u_int32_t *index)
 {
-	u_int32_t ix;
 	u_int32_t maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-	u_int32_t offset;
+	u_int32_t startix, ix, n;
+	WORD_TYPE w;
+
+	if (start >= b->nbits) {
+		start = 0;
+	}
+	startix = start / BITS_PER_WORD;
 
-	for (ix=0; ix<maxix; ix++) {
-		if (b->v[ix]!=WORD_ALLBITS) {
-			for (offset = 0; offset < BITS_PER_WORD; offset++) {
-				WORD_TYPE mask = ((WORD_TYPE)1)<<offset;
-				if ((b->v[ix] & mask)==0) {
-					b->v[ix] |= mask;
-					*index = (ix*BITS_PER_WORD)+offset;
-					assert(*index < b->nbits);
-					return 0;
-				}
-			}
-			assert(0);
+	/* Ignore the bits below START in the first word */
+	w = b->v[startix] | (WORD_TYPE)((1 << (start % BITS_PER_WORD)) - 1);
+	if (w != WORD_ALLBITS) {
+		*index = startix*BITS_PER_WORD + bitmap_ffz(w);
+		return 0;
+	}
+
+	/* Then the rest, coming back around to the first word whole */
+	for (n=1; n<=maxix; n++) {
+		ix = (startix + n) % maxix;
+		if (b->v[ix] != WORD_ALLBITS) {
+			*index = ix*BITS_PER_WORD + bitmap_ffz(b->v[ix]);
+			assert(*index < b->nbits);
+			return 0;
 		}
 	}
 	return ENOSPC;
 }
 
-static
-inline
-void
-bitmap_translate(u_int32_t bitno, u_int32_t *ix, WORD_TYPE *mask)
+int
+bitmap_alloc_range(struct bitmap *b, u_int32_t goal, u_int32_t want,
+		   u_int32_t *index, u_int32_t *count)
 {
-	u_int32_t offset;
-	*ix = bitno / BITS_PER_WORD;
-	offset = bitno % BITS_PER_WORD;
-	*mask = ((WORD_TYPE)1) << offset;
+	u_int32_t first, n, ix;
+	WORD_TYPE mask;
+	int result;
+
+	assert(want > 0);
+
+	result = bitmap_findfree(b, goal, &first);
+	if (result) {
+		return result;
+	}
+
+	/* Take clear bits from there until we have enough or hit a set one */
+	for (n=0; n<want && first+n < b->nbits; n++) {
+		bitmap_translate(first+n, &ix, &mask);
+		if (b->v[ix] & mask) {
+			break;
+		}
+		b->v[ix] |= mask;
+	}
+	assert(n > 0);
+
+	b->hint = first + n;
+	*index = first;
+	if (count != NULL) {
+		*count = n;
+	}
+	return 0;
+}
+
+int
+bitmap_alloc_near(struct bitmap *b, u_int32_t goal, u_int32_t *index)
+{
+	return bitmap_alloc_range(b, goal, 1, index, NULL);
+}
+
+int
+bitmap_alloc(struct bitmap *b, u_int32_t *index)
+{
+	return bitmap_alloc_range(b, b->hint, 1, index, NULL);
 }
 
 void
@@ -84,71 +84,67 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
- *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
- *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
- *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * Pagerefs are carved out of whole pages obtained from alloc_kpages,
+ * one page at a time as they are needed. Unused pagerefs are kept on
+ * a free list threaded through next_all, so allocating one is O(1).
+ * The pages holding pagerefs are never given back; they are small
+ * compared to the heap they describe (one page of pagerefs manages
+ * 1M of subpage blocks).
  */
 
-#define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
-static struct pageref pagerefs[NPAGEREFS];
+#define PAGEREFS_PER_PAGE (PAGE_SIZE / sizeof(struct pageref))
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static u_int32_t pagerefs_inuse[INUSE_WORDS];
+static struct pageref *freepagerefs;
+static unsigned npagerefpages;
 
 static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	u_int32_t k;
+	struct pageref *pr;
+	vaddr_t page;
+	unsigned i;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
-			continue;
+	assert(curspl>0);
+
+	if (freepagerefs == NULL) {
+		page = alloc_kpages(1);
+		if (page == 0) {
+			/* ran out */
+			return NULL;
 		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
+		npagerefpages++;
+
+		pr = (struct pageref *)page;
+		for (i=0; i<PAGEREFS_PER_PAGE; i++) {
+			pr[i].next_all = freepagerefs;
+			freepagerefs = &pr[i];
 		}
-		assert(0);
 	}
 
-	/* ran out */
-	return NULL;
+	pr = freepagerefs;
+	freepagerefs = pr->next_all;
+	return pr;
 }
 
 static
 void
 freepageref(struct pageref *p)
 {
-	size_t i, j;
-	u_int32_t k;
-
-	j = p-pagerefs;
-	assert(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
-	i = j/32;
-	k = ((u_int32_t)1) << (j%32);
-	assert((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	assert(curspl>0);
+	p->next_samesize = NULL;
+	p->next_all = freepagerefs;
+	freepagerefs = p;
 }
 
 ////////////////////////////////////////
 
+/*
+ * sizebases[] holds, for each block size, only the pages that have at
+ * least one free block, so allocation can always take the first one.
+ * A page drops off its list when it fills up and goes back on when a
+ * block on it is freed. allbase holds every page.
+ */
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
 
@@ -215,18 +211,23 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			assert(sc < NPAGEREFS);
+			assert(PR_BLOCKTYPE(pr) == i);
+			assert(pr->nfree > 0);
+			assert(sc < npagerefpages * PAGEREFS_PER_PAGE);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		assert(ac < NPAGEREFS);
+		assert(ac < npagerefpages * PAGEREFS_PER_PAGE);
+		if (pr->nfree > 0) {
+			sc--;
+		}
 		ac++;
 	}
 
-	assert(sc==ac);
+	assert(sc==0);
 }
 #else
 #define checksubpages() 
@@ -294,6 +295,7 @@ kheap_printstats(void)
 	int spl = splhigh();
 
 	kprintf("Subpage allocator status:\n");
+	kprintf("%u page(s) of pagerefs\n", npagerefpages);
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		dumpsubpage(pr);
@@ -304,6 +306,10 @@ kheap_printstats(void)
 
 ////////////////////////////////////////
 
+/*
+ * Take a page off both lists. Only pages that have free blocks are on
+ * sizebases[], which is always the case for a page being released.
+ */
 static
 void
 remove_lists(struct pageref *pr, int blktype)
@@ -311,6 +317,7 @@ remove_lists(struct pageref *pr, int blktype)
 	struct pageref **guy;
 
 	assert(blktype>=0 && blktype<NSIZES);
+	assert(pr->nfree > 0);
 
 	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
 		checksubpage(*guy);
@@ -369,41 +376,44 @@ subpage_kmalloc(size_t sz)
 
 	checksubpages();
 
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+	pr = sizebases[blktype];
+	if (pr != NULL) {
 
 		/* check for corruption */
 		assert(PR_BLOCKTYPE(pr) == blktype);
+		assert(pr->nfree > 0);
 		checksubpage(pr);
 
-		if (pr->nfree > 0) {
-
-		doalloc: /* comes here after getting a whole fresh page */
+	doalloc: /* comes here after getting a whole fresh page */
 
-			assert(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+		assert(pr->freelist_offset < PAGE_SIZE);
+		prpage = PR_PAGEADDR(pr);
+		fla = prpage + pr->freelist_offset;
+		fl = (struct freelist *)fla;
 
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
+		retptr = fl;
+		fl = fl->next;
+		pr->nfree--;
 
-			if (fl != NULL) {
-				assert(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				assert(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				assert(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+		if (fl != NULL) {
+			assert(pr->nfree > 0);
+			fla = (vaddr_t)fl;
+			assert(fla - prpage < PAGE_SIZE);
+			pr->freelist_offset = fla - prpage;
+		}
+		else {
+			/* Page is full; take it off the list for its size. */
+			assert(pr->nfree == 0);
+			assert(sizebases[blktype] == pr);
+			pr->freelist_offset = INVALID_OFFSET;
+			sizebases[blktype] = pr->next_samesize;
+			pr->next_samesize = NULL;
+		}
 
-			checksubpages();
+		checksubpages();
 
-			splx(spl);
-			return retptr;
-		}
+		splx(spl);
+		return retptr;
 	}
 
 	/*
@@ -518,7 +528,11 @@ subpage_kfree(void *ptr)
 	fla = prpage + offset;
 	fl = (struct freelist *)fla;
 	if (pr->freelist_offset == INVALID_OFFSET) {
+		/* Page was full; it has a free block again. */
+		assert(pr->nfree == 0);
 		fl->next = NULL;
+		pr->next_samesize = sizebases[blktype];
+		sizebases[blktype] = pr;
 	} else {
 		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
 	}
@@ -539,12 +553,290 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+//
+////////////////////////////////////////////////////////////
+//
+// Allocation profiling.
+//
+//    When turned on, every kmalloc is charged to its caller (the
+//    return address of kmalloc) and to its size class, and every
+//    kfree of a block allocated while profiling is credited back.
+//    Counts are in blocks and bytes actually consumed (i.e. rounded
+//    up to the block size or to whole pages).
+//
+//    To find the call site again on kfree, live blocks are kept in a
+//    fixed-size open-addressed hash table keyed by address. If that
+//    (or the call site table) fills up, further allocations are just
+//    counted as dropped.
+//
+//    When turned off the only cost is one test in kmalloc and kfree.
+//
+
+#define PROF_NSITES	128	/* call sites; power of 2 */
+#define PROF_NLIVE	1024	/* live blocks tracked; power of 2 */
+#define PROF_NCLASSES	(NSIZES+1)	/* last one is whole pages */
+#define PROF_NOSITE	0xffff
+
+struct profsite {
+	vaddr_t ps_caller;	/* 0 if slot unused */
+	unsigned ps_nallocs;	/* total allocations */
+	unsigned ps_count;	/* blocks currently allocated */
+	unsigned ps_bytes;	/* bytes currently allocated */
+	unsigned ps_maxbytes;	/* high-water mark of ps_bytes */
+};
+
+struct profclass {
+	unsigned pc_nallocs;
+	unsigned pc_count;
+	unsigned pc_bytes;
+	unsigned pc_maxbytes;
+};
+
+struct proflive {
+	vaddr_t pl_addr;	/* 0 if slot unused */
+	u_int32_t pl_bytes;
+	u_int16_t pl_site;
+	u_int16_t pl_class;
+};
+
+static int prof_enabled;
+static struct profsite prof_sites[PROF_NSITES];
+static struct profclass prof_classes[PROF_NCLASSES];
+static struct proflive prof_live[PROF_NLIVE];
+static unsigned prof_bytes, prof_maxbytes, prof_dropped;
+
+#define PROF_HASH(addr, n) ((((addr) >> 4) ^ ((addr) >> 12)) & ((n)-1))
+
+static
+void
+prof_reset(void)
+{
+	bzero(prof_sites, sizeof(prof_sites));
+	bzero(prof_classes, sizeof(prof_classes));
+	bzero(prof_live, sizeof(prof_live));
+	prof_bytes = prof_maxbytes = prof_dropped = 0;
+}
+
+static
+unsigned
+prof_findsite(vaddr_t caller)
+{
+	unsigned i, n;
+
+	i = PROF_HASH(caller, PROF_NSITES);
+	for (n=0; n<PROF_NSITES; n++) {
+		if (prof_sites[i].ps_caller == caller) {
+			return i;
+		}
+		if (prof_sites[i].ps_caller == 0) {
+			prof_sites[i].ps_caller = caller;
+			return i;
+		}
+		i = (i+1) & (PROF_NSITES-1);
+	}
+	return PROF_NOSITE;
+}
+
+static
+void
+prof_alloc(void *ptr, unsigned bytes, int class, vaddr_t caller)
+{
+	vaddr_t addr = (vaddr_t)ptr;
+	unsigned site, i, n;
+	int spl;
+
+	spl = splhigh();
+
+	site = prof_findsite(caller);
+	if (site == PROF_NOSITE) {
+		prof_dropped++;
+		splx(spl);
+		return;
+	}
+
+	i = PROF_HASH(addr, PROF_NLIVE);
+	for (n=0; n<PROF_NLIVE && prof_live[i].pl_addr != 0; n++) {
+		i = (i+1) & (PROF_NLIVE-1);
+	}
+	if (n == PROF_NLIVE) {
+		prof_dropped++;
+		splx(spl);
+		return;
+	}
+	prof_live[i].pl_addr = addr;
+	prof_live[i].pl_bytes = bytes;
+	prof_live[i].pl_site = site;
+	prof_live[i].pl_class = class;
+
+	prof_sites[site].ps_nallocs++;
+	prof_sites[site].ps_count++;
+	prof_sites[site].ps_bytes += bytes;
+	if (prof_sites[site].ps_bytes > prof_sites[site].ps_maxbytes) {
+		prof_sites[site].ps_maxbytes = prof_sites[site].ps_bytes;
+	}
+
+	prof_classes[class].pc_nallocs++;
+	prof_classes[class].pc_count++;
+	prof_classes[class].pc_bytes += bytes;
+	if (prof_classes[class].pc_bytes > prof_classes[class].pc_maxbytes) {
+		prof_classes[class].pc_maxbytes = prof_classes[class].pc_bytes;
+	}
+
+	prof_bytes += bytes;
+	if (prof_bytes > prof_maxbytes) {
+		prof_maxbytes = prof_bytes;
+	}
+
+	splx(spl);
+}
+
+static
+void
+prof_free(void *ptr)
+{
+	vaddr_t addr = (vaddr_t)ptr;
+	struct proflive *pl;
+	unsigned i, j, k, n;
+	int spl;
+
+	spl = splhigh();
+
+	i = PROF_HASH(addr, PROF_NLIVE);
+	for (n=0; n<PROF_NLIVE; n++) {
+		if (prof_live[i].pl_addr == addr || prof_live[i].pl_addr == 0) {
+			break;
+		}
+		i = (i+1) & (PROF_NLIVE-1);
+	}
+	if (n == PROF_NLIVE || prof_live[i].pl_addr == 0) {
+		/* allocated before profiling started, or dropped */
+		splx(spl);
+		return;
+	}
+
+	pl = &prof_live[i];
+	prof_sites[pl->pl_site].ps_count--;
+	prof_sites[pl->pl_site].ps_bytes -= pl->pl_bytes;
+	prof_classes[pl->pl_class].pc_count--;
+	prof_classes[pl->pl_class].pc_bytes -= pl->pl_bytes;
+	prof_bytes -= pl->pl_bytes;
+	pl->pl_addr = 0;
+
+	/*
+	 * Close the gap so later entries in the same probe sequence can
+	 * still be found: move back any entry whose home slot isn't
+	 * cyclically between the hole and its current position.
+	 */
+	j = i;
+	for (;;) {
+		j = (j+1) & (PROF_NLIVE-1);
+		if (prof_live[j].pl_addr == 0) {
+			break;
+		}
+		k = PROF_HASH(prof_live[j].pl_addr, PROF_NLIVE);
+		if ((j > i && (k <= i || k > j)) ||
+		    (j < i && (k <= i && k > j))) {
+			prof_live[i] = prof_live[j];
+			prof_live[j].pl_addr = 0;
+			i = j;
+		}
+	}
+
+	splx(spl);
+}
+
+void
+kheap_setprofiling(int on)
+{
+	int spl = splhigh();
+	if (on && !prof_enabled) {
+		prof_reset();
+	}
+	prof_enabled = on;
+	splx(spl);
+}
+
+int
+kheap_getprofiling(void)
+{
+	return prof_enabled;
+}
+
+void
+kheap_printprofile(int n)
+{
+	unsigned order[PROF_NSITES];
+	unsigned i, j, nsites, tmp;
+	struct profsite *ps;
+
+	/* print the whole thing with interrupts off */
+	int spl = splhigh();
+
+	kprintf("kmalloc profile (%s): %u bytes live, %u peak, %u dropped\n",
+		prof_enabled ? "on" : "off",
+		prof_bytes, prof_maxbytes, prof_dropped);
+
+	kprintf("  %-6s %8s %8s %10s %10s\n", "class", "allocs", "live",
+		"bytes", "peak");
+	for (i=0; i<PROF_NCLASSES; i++) {
+		struct profclass *pc = &prof_classes[i];
+		if (pc->pc_nallocs == 0) {
+			continue;
+		}
+		if (i < NSIZES) {
+			kprintf("  %-6lu", (unsigned long) sizes[i]);
+		}
+		else {
+			kprintf("  %-6s", "pages");
+		}
+		kprintf(" %8u %8u %10u %10u\n", pc->pc_nallocs,
+			pc->pc_count, pc->pc_bytes, pc->pc_maxbytes);
+	}
+
+	/* Sort the call sites by live bytes, then by peak. */
+	nsites = 0;
+	for (i=0; i<PROF_NSITES; i++) {
+		if (prof_sites[i].ps_caller != 0) {
+			order[nsites++] = i;
+		}
+	}
+	for (i=1; i<nsites; i++) {
+		for (j=i; j>0; j--) {
+			struct profsite *a = &prof_sites[order[j-1]];
+			struct profsite *b = &prof_sites[order[j]];
+			if (a->ps_bytes > b->ps_bytes ||
+			    (a->ps_bytes == b->ps_bytes &&
+			     a->ps_maxbytes >= b->ps_maxbytes)) {
+				break;
+			}
+			tmp = order[j];
+			order[j] = order[j-1];
+			order[j-1] = tmp;
+		}
+	}
+
+	kprintf("  %-10s %8s %8s %10s %10s\n", "caller", "allocs", "live",
+		"bytes", "peak");
+	for (i=0; i<nsites && (int)i<n; i++) {
+		ps = &prof_sites[order[i]];
+		kprintf("  0x%08lx %8u %8u %10u %10u\n",
+			(unsigned long) ps->ps_caller, ps->ps_nallocs,
+			ps->ps_count, ps->ps_bytes, ps->ps_maxbytes);
+	}
+
+	splx(spl);
+}
+
 //
 ////////////////////////////////////////////////////////////
 
 void *
 kmalloc(size_t sz)
 {
+	void *ptr;
+	unsigned bytes;
+	int class;
+
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
@@ -556,15 +848,39 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 
-		return (void *)address;
+		ptr = (void *)address;
+		bytes = npages * PAGE_SIZE;
+		class = NSIZES;
+	}
+	else {
+		ptr = subpage_kmalloc(sz);
+		if (ptr == NULL) {
+			return NULL;
+		}
+		bytes = 0;
+		class = -1;
 	}
 
-	return subpage_kmalloc(sz);
+	if (prof_enabled) {
+		/* Only worth looking up the size class when profiling */
+		if (class < 0) {
+			class = blocktype(sz);
+			bytes = sizes[class];
+		}
+		prof_alloc(ptr, bytes, class,
+			   (vaddr_t) __builtin_return_address(0));
+	}
+
+	return ptr;
 }
 
 void
 kfree(void *ptr)
 {
+	if (ptr != NULL && prof_enabled) {
+		prof_free(ptr);
+	}
+
 	/*
 	 * Try subpage first; if that fails, assume it's a big allocation.
 	 */
@@ -0,0 +1,267 @@
+/*
+ * Object cache. See objcache.h for details.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <objcache.h>
+#include <machine/spl.h>
+
+struct objcache {
+	char *oc_name;
+	size_t oc_size;
+	int (*oc_ctor)(void *);
+	void (*oc_dtor)(void *);
+
+	/* free, constructed objects; a stack of at most oc_limit */
+	void **oc_free;
+	int oc_nfree;
+	int oc_limit;
+
+	/* statistics */
+	unsigned oc_nallocs;	// objcache_alloc calls that succeeded
+	unsigned oc_nhits;	// ...of which were served from oc_free
+	unsigned oc_ninuse;	// objects currently handed out
+	unsigned oc_maxinuse;	// high-water mark of oc_ninuse
+
+	struct objcache *oc_next;	// list of all caches
+};
+
+/* All caches, for objcache_printstats. */
+static struct objcache *allcaches;
+
+struct objcache *
+objcache_create(const char *name, size_t size, int limit,
+		int (*ctor)(void *), void (*dtor)(void *))
+{
+	struct objcache *oc;
+	int spl;
+
+	assert(size > 0);
+	assert(limit >= 0);
+
+	oc = kmalloc(sizeof(struct objcache));
+	if (oc == NULL) {
+		return NULL;
+	}
+
+	oc->oc_name = kstrdup(name);
+	if (oc->oc_name == NULL) {
+		kfree(oc);
+		return NULL;
+	}
+
+	oc->oc_free = NULL;
+	if (limit > 0) {
+		oc->oc_free = kmalloc(limit * sizeof(void *));
+		if (oc->oc_free == NULL) {
+			kfree(oc->oc_name);
+			kfree(oc);
+			return NULL;
+		}
+	}
+
+	oc->oc_size = size;
+	oc->oc_ctor = ctor;
+	oc->oc_dtor = dtor;
+	oc->oc_nfree = 0;
+	oc->oc_limit = limit;
+	oc->oc_nallocs = 0;
+	oc->oc_nhits = 0;
+	oc->oc_ninuse = 0;
+	oc->oc_maxinuse = 0;
+
+	spl = splhigh();
+	oc->oc_next = allcaches;
+	allcaches = oc;
+	splx(spl);
+
+	return oc;
+}
+
+void *
+objcache_alloc(struct objcache *oc)
+{
+	void *obj = NULL;
+	int spl;
+
+	spl = splhigh();
+	if (oc->oc_nfree > 0) {
+		obj = oc->oc_free[--oc->oc_nfree];
+		oc->oc_nhits++;
+	}
+	splx(spl);
+
+	if (obj == NULL) {
+		/* Nothing cached; make a new one. */
+		obj = kmalloc(oc->oc_size);
+		if (obj == NULL) {
+			return NULL;
+		}
+		if (oc->oc_ctor != NULL && oc->oc_ctor(obj)) {
+			kfree(obj);
+			return NULL;
+		}
+	}
+
+	spl = splhigh();
+	oc->oc_nallocs++;
+	oc->oc_ninuse++;
+	if (oc->oc_ninuse > oc->oc_maxinuse) {
+		oc->oc_maxinuse = oc->oc_ninuse;
+	}
+	splx(spl);
+
+	return obj;
+}
+
+void
+objcache_free(struct objcache *oc, void *obj)
+{
+	int spl;
+
+	assert(obj != NULL);
+
+	spl = splhigh();
+	assert(oc->oc_ninuse > 0);
+	oc->oc_ninuse--;
+	if (oc->oc_nfree < oc->oc_limit) {
+		oc->oc_free[oc->oc_nfree++] = obj;
+		obj = NULL;
+	}
+	splx(spl);
+
+	if (obj != NULL) {
+		/* Cache is full; really free it. */
+		if (oc->oc_dtor != NULL) {
+			oc->oc_dtor(obj);
+		}
+		kfree(obj);
+	}
+}
+
+int
+objcache_prealloc(struct objcache *oc, int n)
+{
+	void **newfree, *obj;
+	int spl, full, result;
+
+	assert(n >= 0);
+
+	/* Make room to keep N free objects */
+	if (n > oc->oc_limit) {
+		newfree = kmalloc(n * sizeof(void *));
+		if (newfree == NULL) {
+			return ENOMEM;
+		}
+
+		spl = splhigh();
+		if (n > oc->oc_limit) {
+			void **oldfree = oc->oc_free;
+
+			if (oc->oc_nfree > 0) {
+				memcpy(newfree, oldfree,
+				       oc->oc_nfree * sizeof(void *));
+			}
+			oc->oc_free = newfree;
+			oc->oc_limit = n;
+			newfree = oldfree;
+		}
+		splx(spl);
+
+		if (newfree != NULL) {
+			kfree(newfree);
+		}
+	}
+
+	for (;;) {
+		spl = splhigh();
+		full = oc->oc_nfree >= n;
+		splx(spl);
+		if (full) {
+			break;
+		}
+
+		obj = kmalloc(oc->oc_size);
+		if (obj == NULL) {
+			return ENOMEM;
+		}
+		if (oc->oc_ctor != NULL) {
+			result = oc->oc_ctor(obj);
+			if (result) {
+				kfree(obj);
+				return result;
+			}
+		}
+
+		spl = splhigh();
+		if (oc->oc_nfree < oc->oc_limit) {
+			oc->oc_free[oc->oc_nfree++] = obj;
+			obj = NULL;
+		}
+		splx(spl);
+
+		if (obj != NULL) {
+			/* someone else filled it up meanwhile */
+			if (oc->oc_dtor != NULL) {
+				oc->oc_dtor(obj);
+			}
+			kfree(obj);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+void
+objcache_destroy(struct objcache *oc)
+{
+	struct objcache **guy;
+	int spl;
+
+	spl = splhigh();
+	assert(oc->oc_ninuse == 0);
+	for (guy = &allcaches; *guy != NULL; guy = &(*guy)->oc_next) {
+		if (*guy == oc) {
+			*guy = oc->oc_next;
+			break;
+		}
+	}
+	splx(spl);
+
+	while (oc->oc_nfree > 0) {
+		void *obj = oc->oc_free[--oc->oc_nfree];
+		if (oc->oc_dtor != NULL) {
+			oc->oc_dtor(obj);
+		}
+		kfree(obj);
+	}
+
+	kfree(oc->oc_free);
+	kfree(oc->oc_name);
+	kfree(oc);
+}
+
+void
+objcache_printstats(void)
+{
+	struct objcache *oc;
+
+	/* print the whole thing with interrupts off */
+	int spl = splhigh();
+
+	kprintf("Object caches:\n");
+	kprintf("  %-16s %5s %6s %6s %6s %9s %9s\n", "name", "size",
+		"inuse", "max", "free", "allocs", "hits");
+	for (oc = allcaches; oc != NULL; oc = oc->oc_next) {
+		kprintf("  %-16s %5lu %6u %6u %3d/%-2d %9u %9u\n",
+			oc->oc_name, (unsigned long)oc->oc_size,
+			oc->oc_ninuse, oc->oc_maxinuse,
+			oc->oc_nfree, oc->oc_limit,
+			oc->oc_nallocs, oc->oc_nhits);
+	}
+
+	splx(spl);
+}
@@ -11,6 +11,7 @@
 #include <synch.h>
 #include <thread.h>
 #include <scheduler.h>
+#include <callout.h>
 #include <dev.h>
 #include <vfs.h>
 #include <vm.h>
@@ -83,7 +84,9 @@ boot(void)
 		hello();
 	#endif /* OPT_A0 */
 	ram_bootstrap();
+	synch_bootstrap();
 	scheduler_bootstrap();
+	callout_bootstrap();
 	#if OPT_A2
 	struct thread *menu = thread_bootstrap();
 	#else
@@ -104,7 +107,7 @@ boot(void)
 	assert(sizeof(*(userptr_t)0)==sizeof(char));
 	
 	#if OPT_A2
-	menu->t_pid = pid_getnext(menu);
+	menu->t_pid = pid_alloc(menu, 0);
 	fd_init_initial(menu);
 	#endif
 
@@ -14,6 +14,11 @@
 #include <vfs.h>
 #include <sfs.h>
 #include <test.h>
+#include <objcache.h>
+#include <scheduler.h>
+#include <callout.h>
+#include <machine/spl.h>
+#include <lamebus/lhd.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
@@ -346,15 +351,150 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+/*
+ * kh               - subpage allocator status
+ * kh prof on|off   - turn kmalloc profiling on (resetting it) or off
+ * kh top [N]       - N biggest kmalloc call sites (default 10)
+ */
 static
 int
 cmd_kheapstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kheap_printstats();
+		return 0;
+	}
+
+	if (nargs == 3 && !strcmp(args[1], "prof")) {
+		if (!strcmp(args[2], "on")) {
+			kheap_setprofiling(1);
+			return 0;
+		}
+		if (!strcmp(args[2], "off")) {
+			kheap_setprofiling(0);
+			return 0;
+		}
+	}
+	else if ((nargs == 2 || nargs == 3) && !strcmp(args[1], "top")) {
+		kheap_printprofile(nargs == 3 ? atoi(args[2]) : 10);
+		return 0;
+	}
+
+	kprintf("Usage: kh [prof on|off | top [N]]\n");
+	return EINVAL;
+}
+
+/*
+ * sp               - longest interrupts-off stretches by call site
+ * sp on|off        - turn interrupts-off profiling on (resetting it)
+ *                    or off
+ */
+static
+int
+cmd_splprofile(int nargs, char **args)
+{
+	if (nargs == 1) {
+		spl_printprofile();
+		return 0;
+	}
+
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		spl_setprofiling(1);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		spl_setprofiling(0);
+		return 0;
+	}
+
+	kprintf("Usage: sp [on|off]\n");
+	return EINVAL;
+}
+
+static
+int
+cmd_namecachestats(int nargs, char **args)
 {
 	(void)nargs;
 	(void)args;
 
-	kheap_printstats();
-	
+	vfs_nc_printstats();
+	return 0;
+}
+
+static
+int
+cmd_diskstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lhd_printstats();
+	return 0;
+}
+
+static
+int
+cmd_runqueuestats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		scheduler_printstats();
+		return 0;
+	}
+
+	if (nargs == 3 && !strcmp(args[1], "quantum")) {
+		if (scheduler_setquantum(atoi(args[2])) == 0) {
+			return 0;
+		}
+	}
+
+	kprintf("Usage: rq [quantum TICKS]\n");
+	return EINVAL;
+}
+
+static
+int
+cmd_threadstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		thread_printstats();
+		return 0;
+	}
+
+	if (nargs == 3 && !strcmp(args[1], "prealloc") && atoi(args[2]) >= 0) {
+		int result = thread_prealloc(atoi(args[2]));
+		if (result) {
+			kprintf("ts prealloc: %s\n", strerror(result));
+		}
+		return result;
+	}
+
+	kprintf("Usage: ts [prealloc N]\n");
+	return EINVAL;
+}
+
+static
+int
+cmd_calloutstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	hardclock_printstats();
+	callout_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_objcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	objcache_printstats();
+
 	return 0;
 }
 
@@ -433,6 +573,7 @@ static const char *testmenu[] = {
 	"[fs3] FS write stress       (4)     ",
 	"[fs4] FS write stress 2     (4)     ",
 	"[fs5] FS create stress      (4)     ",
+	"[fs6] FS rename test        (4)     ",
 	NULL
 };
 
@@ -463,6 +604,13 @@ static const char *mainmenu[] = {
 	"[1b] Stoplight                      ",
 #endif
 	"[kh] Kernel heap stats              ",
+	"[oc] Object cache stats             ",
+	"[rq] Run queue stats                ",
+	"[co] Clock and callout stats        ",
+	"[ts] Thread scheduling stats        ",
+	"[sp] Interrupts-off profile         ",
+	"[ds] Disk queue stats               ",
+	"[nc] VFS name cache stats           ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -518,6 +666,13 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "oc",         cmd_objcachestats },
+	{ "rq",         cmd_runqueuestats },
+	{ "co",         cmd_calloutstats },
+	{ "ts",         cmd_threadstats },
+	{ "sp",         cmd_splprofile },
+	{ "ds",         cmd_diskstats },
+	{ "nc",         cmd_namecachestats },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -543,6 +698,7 @@ static struct {
 	{ "fs3",	writestress },
 	{ "fs4",	writestress2 },
 	{ "fs5",	createstress },
+	{ "fs6",	renametest },
 
 	{ NULL, NULL }
 };
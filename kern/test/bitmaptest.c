@@ -1,5 +1,6 @@
 #include <types.h>
 #include <lib.h>
+#include <kern/errno.h>
 #include <bitmap.h>
 #include <test.h>
 
@@ -10,7 +11,7 @@ bitmaptest(int nargs, char **args)
 {
 	struct bitmap *b;
 	char data[TESTSIZE];
-	u_int32_t x;
+	u_int32_t x, y, n;
 	int i;
 
 	(void)nargs;
@@ -72,6 +73,44 @@ bitmaptest(int nargs, char **args)
 		assert(data[i]==0);
 	}
 
+	/* Next-fit: allocation carries on past the last bit handed out */
+	bitmap_unmark(b, 10);
+	bitmap_unmark(b, 100);
+	bitmap_unmark(b, 200);
+	assert(bitmap_alloc_near(b, 50, &x)==0 && x==100);
+	assert(bitmap_alloc(b, &x)==0 && x==200);
+	assert(bitmap_alloc(b, &x)==0 && x==10);
+	assert(bitmap_alloc(b, &x)==ENOSPC);
+
+	/* Runs, cut short by a set bit or the end of the map */
+	for (i=300; i<340; i++) {
+		bitmap_unmark(b, i);
+	}
+	bitmap_mark(b, 320);
+	assert(bitmap_alloc_range(b, 305, 100, &x, &n)==0);
+	assert(x==305 && n==15);
+	assert(bitmap_alloc_range(b, 0, 4, &x, &n)==0);
+	assert(x==300 && n==4);
+	assert(bitmap_alloc_range(b, 0, 100, &x, &n)==0);
+	assert(x==304 && n==1);
+	assert(bitmap_alloc_range(b, 330, 5, &x, &n)==0);
+	assert(x==330 && n==5);
+	assert(bitmap_alloc_range(b, 0, 100, &x, &n)==0);
+	assert(x==321 && n==9);
+	assert(bitmap_alloc_range(b, 0, 100, &x, &n)==0);
+	assert(x==335 && n==5);
+	for (i=TESTSIZE-3; i<TESTSIZE; i++) {
+		bitmap_unmark(b, i);
+	}
+	assert(bitmap_alloc_range(b, TESTSIZE-3, 8, &x, &n)==0);
+	assert(x==TESTSIZE-3 && n==3);
+	assert(bitmap_alloc_range(b, 0, 1, &y, &n)==ENOSPC);
+
+	for (i=0; i<TESTSIZE; i++) {
+		assert(bitmap_isset(b, i));
+	}
+	bitmap_destroy(b);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
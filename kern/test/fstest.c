@@ -26,6 +26,7 @@
 #define NCHUNKS  720
 #define NTHREADS 12
 #define NCREATES 32
+#define NRENAMES 96
 
 static struct semaphore *threadsem = NULL;
 
@@ -500,6 +501,119 @@ docreatestress(const char *filesys)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Create an empty file, or check that it exists (or doesn't).
+ */
+static
+int
+fstest_touch(const char *fs, const char *namesuffix, int flags)
+{
+	struct vnode *vn;
+	char name[32];
+	char buf[32];
+	int err;
+
+	MAKENAME();
+
+	/* vfs_open destroys the string it's passed */
+	strcpy(buf, name);
+	err = vfs_open(buf, flags, &vn);
+	if (err) {
+		return err;
+	}
+	vfs_close(vn);
+	return 0;
+}
+
+static
+int
+fstest_rename(const char *fs, const char *oldsuffix, const char *newsuffix)
+{
+	char oldname[32], newname[32];
+	int err;
+
+	fstest_makename(oldname, sizeof(oldname), fs, oldsuffix);
+	fstest_makename(newname, sizeof(newname), fs, newsuffix);
+
+	err = vfs_rename(oldname, newname);
+	if (err) {
+		kprintf("Could not rename %s%s to %s%s: %s\n", FILENAME,
+			oldsuffix, FILENAME, newsuffix, strerror(err));
+		return -1;
+	}
+
+	/* the old name must be gone and the new one there */
+	err = fstest_touch(fs, oldsuffix, O_RDONLY);
+	if (err != ENOENT) {
+		kprintf("%s%s still there after rename\n", FILENAME,
+			oldsuffix);
+		return -1;
+	}
+	err = fstest_touch(fs, newsuffix, O_RDONLY);
+	if (err) {
+		kprintf("%s%s missing after rename: %s\n", FILENAME,
+			newsuffix, strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Grow the directory a file at a time, renaming every file in it to a
+ * new name after each one. In a hashed directory, renames into a full
+ * leaf split it, which can move the old name to another slot.
+ */
+static
+void
+dorenametest(const char *filesys)
+{
+	static int gen[NRENAMES];
+	char oldsuffix[16], newsuffix[16];
+	int i, j, err, failed = 0;
+
+	kprintf("*** Starting fs rename test on %s:\n", filesys);
+
+	for (i=0; i<NRENAMES && !failed; i++) {
+		gen[i] = 0;
+		snprintf(oldsuffix, sizeof(oldsuffix), "%d-0", i);
+		err = fstest_touch(filesys, oldsuffix, O_WRONLY|O_CREAT);
+		if (err) {
+			kprintf("Could not create %s%s: %s\n", FILENAME,
+				oldsuffix, strerror(err));
+			failed = 1;
+			break;
+		}
+
+		for (j=0; j<=i && !failed; j++) {
+			snprintf(oldsuffix, sizeof(oldsuffix), "%d-%d",
+				 j, gen[j]);
+			snprintf(newsuffix, sizeof(newsuffix), "%d-%d",
+				 j, gen[j]+1);
+			if (fstest_rename(filesys, oldsuffix, newsuffix)) {
+				failed = 1;
+			}
+			else {
+				gen[j]++;
+			}
+		}
+	}
+
+	/* Clean up as many as were made */
+	for (i--; i>=0; i--) {
+		snprintf(oldsuffix, sizeof(oldsuffix), "%d-%d", i, gen[i]);
+		if (fstest_remove(filesys, oldsuffix)) {
+			failed = 1;
+		}
+	}
+
+	if (failed) {
+		kprintf("*** Test failed\n");
+	}
+	kprintf("*** fs rename test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
 static
 int
 checkfilesystem(int nargs, char **args)
@@ -507,7 +621,7 @@ checkfilesystem(int nargs, char **args)
 	char *device;
 
 	if (nargs != 2) {
-		kprintf("Usage: fs[12345] filesystem:\n");
+		kprintf("Usage: fs[123456] filesystem:\n");
 		return EINVAL;
 	}
 
@@ -539,6 +653,7 @@ DEFTEST(readstress);
 DEFTEST(writestress);
 DEFTEST(writestress2);
 DEFTEST(createstress);
+DEFTEST(renametest);
 
 ////////////////////////////////////////////////////////////
 
@@ -0,0 +1,323 @@
+/*
+ * Callout wheel. See callout.h for details.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <curthread.h>
+#include <clock.h>
+#include <callout.h>
+
+/*
+ * The wheel has CALLOUT_WHEELSIZE buckets; a callout due at tick T
+ * goes in bucket T % CALLOUT_WHEELSIZE. Each tick looks at exactly one
+ * bucket and runs whatever in it is due. Callouts more than a full
+ * turn of the wheel away just sit in their bucket until their turn
+ * comes around.
+ */
+#define CALLOUT_WHEELSIZE  64	/* must be a power of 2 */
+#define CALLOUT_WHEELMASK  (CALLOUT_WHEELSIZE-1)
+
+/* Maximum number of pending callout_schedule callouts. */
+#define CALLOUT_POOLSIZE   128
+
+struct callout {
+	u_int32_t c_expire;		// tick this is due at
+	void (*c_fn)(void *);		// NULL if not pending
+	void *c_arg;
+	struct callout *c_next;		// bucket or free list
+	struct callout **c_prevp;	// whatever points at us in the bucket
+	int c_pooled;			// from callout_pool, not the caller
+};
+
+static struct callout callout_pool[CALLOUT_POOLSIZE];
+static struct callout *callout_freelist;
+static struct callout *wheel[CALLOUT_WHEELSIZE];
+
+/* Ticks since boot, as far as the wheel is concerned. */
+static u_int32_t callout_now;
+
+/* statistics */
+static unsigned callout_nscheduled;	// successful callout_schedule calls
+static unsigned callout_nfired;		// callouts that ran
+static unsigned callout_ncancelled;	// callouts removed by callout_cancel
+static unsigned callout_nfailed;	// callout_schedule with the pool empty
+static unsigned callout_npending;	// currently on the wheel
+static unsigned callout_maxpending;	// high-water mark of callout_npending
+static unsigned callout_npooled;	// pending ones from the pool
+static unsigned callout_maxpooled;	// high-water mark of callout_npooled
+
+void
+callout_bootstrap(void)
+{
+	int i;
+
+	callout_freelist = NULL;
+	for (i=CALLOUT_POOLSIZE-1; i>=0; i--) {
+		callout_pool[i].c_fn = NULL;
+		callout_pool[i].c_prevp = NULL;
+		callout_pool[i].c_pooled = 1;
+		callout_pool[i].c_next = callout_freelist;
+		callout_freelist = &callout_pool[i];
+	}
+	for (i=0; i<CALLOUT_WHEELSIZE; i++) {
+		wheel[i] = NULL;
+	}
+}
+
+/*
+ * Take C off the wheel, and put it back in the pool if it came from
+ * there. Interrupts must be off.
+ */
+static
+void
+callout_remove(struct callout *c)
+{
+	assert(c->c_fn != NULL);
+
+	*c->c_prevp = c->c_next;
+	if (c->c_next != NULL) {
+		c->c_next->c_prevp = c->c_prevp;
+	}
+	c->c_fn = NULL;
+	c->c_arg = NULL;
+	c->c_prevp = NULL;
+	c->c_next = NULL;
+
+	if (c->c_pooled) {
+		c->c_next = callout_freelist;
+		callout_freelist = c;
+		assert(callout_npooled > 0);
+		callout_npooled--;
+	}
+
+	assert(callout_npending > 0);
+	callout_npending--;
+}
+
+/*
+ * Put C on the wheel to call FN(ARG) after TICKS ticks.
+ * Interrupts must be off.
+ */
+static
+void
+callout_insert(struct callout *c, int ticks, void (*fn)(void *), void *arg)
+{
+	struct callout **bucket;
+
+	assert(curspl>0);
+	assert(fn != NULL);
+
+	if (ticks < 1) {
+		ticks = 1;
+	}
+
+	c->c_expire = callout_now + ticks;
+	c->c_fn = fn;
+	c->c_arg = arg;
+
+	bucket = &wheel[c->c_expire & CALLOUT_WHEELMASK];
+	c->c_next = *bucket;
+	if (c->c_next != NULL) {
+		c->c_next->c_prevp = &c->c_next;
+	}
+	c->c_prevp = bucket;
+	*bucket = c;
+
+	callout_nscheduled++;
+	callout_npending++;
+	if (callout_npending > callout_maxpending) {
+		callout_maxpending = callout_npending;
+	}
+
+	/* The clock may be set to go off later than this */
+	hardclock_kick(curthread);
+}
+
+int
+callout_schedule(int ticks, void (*fn)(void *), void *arg)
+{
+	struct callout *c;
+	int spl;
+
+	spl = splhigh();
+
+	c = callout_freelist;
+	if (c == NULL) {
+		callout_nfailed++;
+		splx(spl);
+		return EAGAIN;
+	}
+	callout_freelist = c->c_next;
+
+	callout_npooled++;
+	if (callout_npooled > callout_maxpooled) {
+		callout_maxpooled = callout_npooled;
+	}
+
+	callout_insert(c, ticks, fn, arg);
+
+	splx(spl);
+	return 0;
+}
+
+int
+callout_cancel(void (*fn)(void *), void *arg)
+{
+	int i, n = 0;
+	int spl;
+
+	spl = splhigh();
+	for (i=0; i<CALLOUT_POOLSIZE; i++) {
+		struct callout *c = &callout_pool[i];
+		if (c->c_fn == fn && c->c_arg == arg) {
+			callout_remove(c);
+			n++;
+		}
+	}
+	callout_ncancelled += n;
+	splx(spl);
+
+	return n;
+}
+
+/*
+ * Called from hardclock, with interrupts off, with the number of ticks
+ * since the last call. The wheel steps through each of them in turn.
+ */
+void
+callout_tick(int ticks)
+{
+	struct callout *c;
+	void (*fn)(void *);
+	void *arg;
+
+	assert(curspl>0);
+
+	for (; ticks > 0; ticks--) {
+		callout_now++;
+
+		/*
+		 * Take one due callout at a time and rescan the bucket
+		 * after each call: the function may schedule or cancel
+		 * callouts, which can change the bucket under us.
+		 */
+		while (callout_npending > 0) {
+			for (c = wheel[callout_now & CALLOUT_WHEELMASK];
+			     c != NULL; c = c->c_next) {
+				/* Due, not a full turn (or more) away? */
+				if ((int32_t)(c->c_expire - callout_now) <= 0) {
+					break;
+				}
+			}
+			if (c == NULL) {
+				break;
+			}
+
+			/*
+			 * Put the record back in the pool before calling
+			 * the function, so it can schedule itself again.
+			 */
+			fn = c->c_fn;
+			arg = c->c_arg;
+			callout_remove(c);
+			callout_nfired++;
+
+			fn(arg);
+		}
+	}
+}
+
+/*
+ * Ticks until the first pending callout is due, or -1 if there are
+ * none. Only looks one turn of the wheel ahead; anything further out
+ * gets looked at again once the wheel has turned.
+ */
+int
+callout_nextevent(void)
+{
+	struct callout *c;
+	int i;
+
+	assert(curspl>0);
+
+	if (callout_npending == 0) {
+		return -1;
+	}
+
+	for (i=1; i<=CALLOUT_WHEELSIZE; i++) {
+		u_int32_t when = callout_now + i;
+		for (c = wheel[when & CALLOUT_WHEELMASK]; c != NULL;
+		     c = c->c_next) {
+			if ((int32_t)(c->c_expire - when) <= 0) {
+				return i;
+			}
+		}
+	}
+	return CALLOUT_WHEELSIZE;
+}
+
+/*
+ * Sleeping for a number of ticks: the callout wakes up whoever is
+ * sleeping on a token that lives on the sleeper's stack. The callout
+ * record lives there too, so sleepers don't use up the pool and
+ * callout_sleep can't fail.
+ */
+struct callout_sleeper {
+	struct callout cs_callout;
+	volatile int cs_done;
+};
+
+static
+void
+callout_wakeup(void *p)
+{
+	struct callout_sleeper *cs = p;
+
+	cs->cs_done = 1;
+	thread_wakeup(cs);
+}
+
+int
+callout_sleep(int ticks)
+{
+	struct callout_sleeper cs;
+	int spl;
+
+	assert(in_interrupt==0);
+
+	if (ticks <= 0) {
+		return 0;
+	}
+
+	cs.cs_done = 0;
+	cs.cs_callout.c_pooled = 0;
+
+	spl = splhigh();
+	callout_insert(&cs.cs_callout, ticks, callout_wakeup, &cs);
+	while (!cs.cs_done) {
+		thread_sleep(&cs);
+	}
+	splx(spl);
+
+	return 0;
+}
+
+void
+callout_printstats(void)
+{
+	int spl;
+
+	spl = splhigh();
+	kprintf("callouts: %u ticks, %u pending (max %u), "
+		"%u from the pool (max %u of %u)\n",
+		callout_now, callout_npending, callout_maxpending,
+		callout_npooled, callout_maxpooled, CALLOUT_POOLSIZE);
+	kprintf("          %u scheduled, %u fired, %u cancelled, %u failed\n",
+		callout_nscheduled, callout_nfired, callout_ncancelled,
+		callout_nfailed);
+	splx(spl);
+}
@@ -2,9 +2,12 @@
 #include <lib.h>
 #include <machine/spl.h>
 #include <thread.h>
+#include <curthread.h>
+#include <scheduler.h>
 #include <clock.h>
+#include <callout.h>
 
-/* 
+/*
  * The address of lbolt has thread_wakeup called on it once a second.
  */
 int lbolt;
@@ -12,24 +15,206 @@ int lbolt;
 static int lbolt_counter;
 
 /*
- * This is called HZ times a second by the timer device setup.
+ * The hardclock timer is not programmed to go off every tick. Each
+ * time it goes off we work out how many ticks there are until
+ * something needs doing - a quantum running out, a callout, lbolt -
+ * and program it for that. When the run queue is empty and nobody is
+ * waiting on the clock, that can be a whole second.
+ *
+ * If something earlier comes up in the meantime (a thread becomes
+ * runnable, or a callout is scheduled), hardclock_kick reprograms the
+ * timer. Ticks that had already gone by are remembered in
+ * clock_carry and charged when the timer next goes off.
+ *
+ * Without a timer that can be reprogrammed the clock just ticks HZ
+ * times a second, as it always did.
+ */
+
+/* Longest the timer is ever programmed for, in ticks */
+#define CLOCK_MAXTICKS  HZ
+
+/* The hardclock timer device, set by hardclock_attach */
+static void *clock_dev;
+static void (*clock_arm)(void *dev, u_int32_t usecs);
+static void (*clock_gettime)(void *dev, time_t *secs, u_int32_t *nsecs);
+
+static int clock_armed = 1;		// ticks the timer is set for
+static time_t clock_armsecs;		// when it was set
+static u_int32_t clock_armnsecs;
+static int clock_carry;			// ticks gone by before that
+static int in_hardclock;
+
+/* statistics */
+static unsigned clock_nirqs;		// timer interrupts
+static unsigned clock_nticks;		// ticks they accounted for
+static unsigned clock_nkicks;		// times the timer was set early
+
+void
+hardclock_attach(void *dev, void (*arm)(void *dev, u_int32_t usecs),
+		 void (*gettime)(void *dev, time_t *secs, u_int32_t *nsecs))
+{
+	clock_dev = dev;
+	clock_arm = arm;
+	clock_gettime = gettime;
+	clock_armed = 1;
+	clock_carry = 0;
+	clock_gettime(clock_dev, &clock_armsecs, &clock_armnsecs);
+}
+
+/*
+ * Ticks from the last hardclock until the next thing that needs the
+ * clock, or CLOCK_MAXTICKS if nothing does. ELAPSED ticks of that have
+ * already gone by; RUNNING is the thread whose quantum to go by.
+ */
+static
+int
+clock_nextevent(int elapsed, struct thread *running)
+{
+	int next = CLOCK_MAXTICKS;
+	int t;
+
+	t = callout_nextevent();
+	if (t >= 0 && t < next) {
+		next = t;
+	}
+	if (thread_hassleepers(&lbolt) && HZ - lbolt_counter < next) {
+		next = HZ - lbolt_counter;
+	}
+
+	next -= elapsed;
+
+	/* the quantum counts from now, not from the last hardclock */
+	t = scheduler_nextevent(running);
+	if (t >= 0 && t < next) {
+		next = t;
+	}
+
+	return next < 1 ? 1 : next;
+}
+
+static
+void
+clock_setarm(int ticks)
+{
+	clock_armed = ticks;
+	clock_gettime(clock_dev, &clock_armsecs, &clock_armnsecs);
+	clock_arm(clock_dev, ticks * (1000000 / HZ));
+}
+
+/*
+ * Something may need the clock sooner than it is set for. RUNNING is
+ * the thread that is about to run (curthread is NULL inside the
+ * scheduler). Interrupts must be off.
+ */
+void
+hardclock_kick(struct thread *running)
+{
+	time_t secs;
+	u_int32_t nsecs;
+	int elapsed, next;
+
+	assert(curspl>0);
+
+	/* Not reprogrammable, or going off within a tick anyway */
+	if (clock_arm == NULL || in_hardclock || clock_armed <= 1) {
+		return;
+	}
+
+	clock_gettime(clock_dev, &secs, &nsecs);
+	getinterval(clock_armsecs, clock_armnsecs, secs, nsecs,
+		    &secs, &nsecs);
+	elapsed = secs * HZ + nsecs / (1000000000 / HZ);
+	if (elapsed >= clock_armed) {
+		/* it's about to go off */
+		return;
+	}
+
+	next = clock_nextevent(clock_carry + elapsed, running);
+	if (next < clock_armed - elapsed) {
+		clock_carry += elapsed;
+		clock_setarm(next);
+		clock_nkicks++;
+	}
+}
+
+/*
+ * Microseconds on the hardclock timer's clock, for timing things.
+ * Wraps around every 71 minutes or so; 0 before the timer attaches.
+ */
+u_int32_t
+clock_getusecs(void)
+{
+	time_t secs;
+	u_int32_t nsecs;
+
+	if (clock_gettime == NULL) {
+		return 0;
+	}
+	clock_gettime(clock_dev, &secs, &nsecs);
+	return (u_int32_t)secs * 1000000 + nsecs / 1000;
+}
+
+/*
+ * This is called by the timer device whenever the time it was set
+ * for runs out.
  */
 
 void
 hardclock(void)
 {
+	int ticks, preempt;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
+	ticks = clock_carry + clock_armed;
+	clock_carry = 0;
+	clock_nirqs++;
+	clock_nticks += ticks;
+
+	in_hardclock = 1;
 
-	lbolt_counter++;
+	lbolt_counter += ticks;
 	if (lbolt_counter >= HZ) {
-		lbolt_counter = 0;
+		lbolt_counter %= HZ;
 		thread_wakeup(&lbolt);
 	}
 
-	thread_yield();
+	callout_tick(ticks);
+
+	preempt = scheduler_tick(ticks);
+
+	in_hardclock = 0;
+
+	/*
+	 * If we're about to switch, the scheduler will set the timer
+	 * for whatever it switches to, so only callouts and lbolt
+	 * count here.
+	 */
+	if (clock_arm != NULL) {
+		clock_setarm(clock_nextevent(0, preempt ? NULL : curthread));
+	}
+
+	/* Preempt only when the scheduler says the quantum is up */
+	if (preempt) {
+		thread_yield();
+	}
+}
+
+/*
+ * Print timer statistics.
+ */
+void
+hardclock_printstats(void)
+{
+	int spl = splhigh();
+
+	kprintf("hardclock: %u interrupts for %u ticks (%u early)\n",
+		clock_nirqs, clock_nticks, clock_nkicks);
+	kprintf("           timer set for %d ticks\n", clock_armed);
+
+	splx(spl);
 }
 
 /*
@@ -1,23 +1,73 @@
 /*
  * Scheduler.
  *
- * The default scheduler is very simple, just a round-robin run queue.
- * You'll want to improve it.
+ * Multi-level feedback queue. There are SCHED_NLEVELS run queues;
+ * level 0 is the highest priority. A thread runs for the quantum of
+ * its level (in hardclock ticks). If it uses the whole quantum it is
+ * moved down a level; if it sleeps waiting for a device and is woken
+ * up it is moved up a level, so interactive and I/O-bound threads
+ * float to the top while CPU-bound ones sink. Waking from a lock or
+ * CV wait leaves the level alone. Every SCHED_AGING_TICKS all runnable threads
+ * are moved back to level 0 so nothing at the bottom starves.
+ *
+ * A thread is preempted when its quantum runs out or when a thread
+ * at a higher level becomes runnable, and never when there is nothing
+ * else to run. The quantum of level 0 can be changed at runtime (see
+ * scheduler_setquantum); each level below gets twice the one above.
+ *
+ * The clock is not interrupting every tick (see hardclock.c), so
+ * scheduler_nextevent tells it how long the current thread may run.
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <scheduler.h>
 #include <thread.h>
+#include <curthread.h>
+#include <clock.h>
 #include <machine/spl.h>
 #include <queue.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <coremap.h>
+#endif
 
 /*
  *  Scheduler data
  */
 
-// Queue of runnable threads
-static struct queue *runqueue;
+#define SCHED_NLEVELS		4
+#define SCHED_AGING_TICKS	HZ
+
+/* Longest level-0 quantum scheduler_setquantum allows, in ticks */
+#define SCHED_MAXQUANTUM	(HZ/4)
+
+/* Quantum of level 0, in ticks; level L gets this << L */
+static int sched_basequantum = 1;
+#define SCHED_QUANTUM(level)	(sched_basequantum << (level))
+
+// Queues of runnable threads, one per level
+static struct queue *runqueues[SCHED_NLEVELS];
+
+// Total number of threads in runqueues
+static int sched_nqueued;
+
+// Ticks until the next aging pass
+static int aging_countdown;
+
+/* Per-level statistics */
+struct levelstats {
+	int ls_len;		// threads currently queued
+	int ls_maxlen;		// high-water mark of ls_len
+	unsigned ls_enqueues;	// times a thread was queued here
+	unsigned ls_dispatches;	// times a thread was picked from here
+	unsigned ls_demotions;	// threads moved down from this level
+	unsigned ls_boosts;	// threads moved up to this level on wakeup
+};
+static struct levelstats levelstats[SCHED_NLEVELS];
+static unsigned agings;
 
 /*
  * Setup function
@@ -25,10 +75,15 @@ static struct queue *runqueue;
 void
 scheduler_bootstrap(void)
 {
-	runqueue = q_create(32);
-	if (runqueue == NULL) {
-		panic("scheduler: Could not create run queue\n");
+	int i;
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		runqueues[i] = q_create(32);
+		if (runqueues[i] == NULL) {
+			panic("scheduler: Could not create run queue\n");
+		}
 	}
+	aging_countdown = SCHED_AGING_TICKS;
 }
 
 /*
@@ -37,12 +92,23 @@ scheduler_bootstrap(void)
  * if you change the scheduler to not require space outside the 
  * thread structure, for instance, this function can reasonably
  * do nothing.
+ *
+ * Aging can put every thread on the same level, so each queue has to
+ * be able to hold all of them.
  */
 int
 scheduler_preallocate(int nthreads)
 {
+	int i, result;
+
 	assert(curspl>0);
-	return q_preallocate(runqueue, nthreads);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		result = q_preallocate(runqueues[i], nthreads);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
 }
 
 /*
@@ -54,11 +120,17 @@ scheduler_preallocate(int nthreads)
 void
 scheduler_killall(void)
 {
+	int i;
+
 	assert(curspl>0);
-	while (!q_empty(runqueue)) {
-		struct thread *t = q_remhead(runqueue);
-		kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		while (!q_empty(runqueues[i])) {
+			struct thread *t = q_remhead(runqueues[i]);
+			kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+		}
+		levelstats[i].ls_len = 0;
 	}
+	sched_nqueued = 0;
 }
 
 /*
@@ -71,11 +143,73 @@ scheduler_killall(void)
 void
 scheduler_shutdown(void)
 {
+	int i;
+
 	scheduler_killall();
 
 	assert(curspl>0);
-	q_destroy(runqueue);
-	runqueue = NULL;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		q_destroy(runqueues[i]);
+		runqueues[i] = NULL;
+	}
+}
+
+/*
+ * Add a thread to the queue for its level.
+ */
+static
+int
+enqueue(struct thread *t)
+{
+	int level = t->t_priority;
+	int result;
+
+	assert(level >= 0 && level < SCHED_NLEVELS);
+
+	result = q_addtail(runqueues[level], t);
+	if (result) {
+		return result;
+	}
+
+	levelstats[level].ls_enqueues++;
+	levelstats[level].ls_len++;
+	if (levelstats[level].ls_len > levelstats[level].ls_maxlen) {
+		levelstats[level].ls_maxlen = levelstats[level].ls_len;
+	}
+
+	/* The current thread can now be preempted; it may need a timer */
+	if (sched_nqueued++ == 0) {
+		hardclock_kick(curthread);
+	}
+	return 0;
+}
+
+/*
+ * Move every queued thread, and the current one, back to level 0.
+ * The queues were preallocated for all threads, so the additions to
+ * level 0 can't fail.
+ */
+static
+void
+age_all(void)
+{
+	int i, result;
+
+	for (i=1; i<SCHED_NLEVELS; i++) {
+		while (!q_empty(runqueues[i])) {
+			struct thread *t = q_remhead(runqueues[i]);
+			levelstats[i].ls_len--;
+			sched_nqueued--;
+			t->t_priority = 0;
+			t->t_ticksleft = 0;
+			result = enqueue(t);
+			assert(result==0);
+		}
+	}
+	if (curthread != NULL) {
+		curthread->t_priority = 0;
+	}
+	agings++;
 }
 
 /*
@@ -87,10 +221,27 @@ scheduler_shutdown(void)
 struct thread *
 scheduler(void)
 {
+	struct thread *t;
+	int i;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
 	
-	while (q_empty(runqueue)) {
+	for (;;) {
+		for (i=0; i<SCHED_NLEVELS; i++) {
+			if (!q_empty(runqueues[i])) {
+				break;
+			}
+		}
+		if (i < SCHED_NLEVELS) {
+			break;
+		}
+#if OPT_A3
+		/* Use idle time to pre-zero free frames for zero-fill faults */
+		if (coremap_zero_idle()) {
+			continue;
+		}
+#endif
 		cpu_idle();
 	}
 
@@ -101,12 +252,23 @@ scheduler(void)
 	// 
 	//print_run_queue();
 	
-	return q_remhead(runqueue);
+	t = q_remhead(runqueues[i]);
+	levelstats[i].ls_len--;
+	levelstats[i].ls_dispatches++;
+	sched_nqueued--;
+
+	/* Start a fresh quantum unless it was preempted partway through */
+	if (t->t_ticksleft <= 0) {
+		t->t_ticksleft = SCHED_QUANTUM(t->t_priority);
+	}
+
+	/* Make sure the clock goes off when its quantum is up */
+	hardclock_kick(t);
+	return t;
 }
 
 /* 
- * Make a thread runnable.
- * With the base scheduler, just add it to the end of the run queue.
+ * Make a thread runnable at its current level.
  */
 int
 make_runnable(struct thread *t)
@@ -114,7 +276,121 @@ make_runnable(struct thread *t)
 	// meant to be called with interrupts off
 	assert(curspl>0);
 
-	return q_addtail(runqueue, t);
+	return enqueue(t);
+}
+
+/*
+ * Make a thread that was waiting for a device runnable, moving it up
+ * a level and giving it a fresh quantum. Threads woken from anything
+ * else go through make_runnable.
+ */
+int
+scheduler_wakeup(struct thread *t)
+{
+	assert(curspl>0);
+
+	if (t->t_priority > 0) {
+		t->t_priority--;
+		levelstats[t->t_priority].ls_boosts++;
+	}
+	t->t_ticksleft = 0;
+
+	return enqueue(t);
+}
+
+/*
+ * Called from hardclock with the number of ticks since it was last
+ * called. Charges them to the current thread and does periodic aging.
+ * Returns nonzero if the current thread should be preempted: either
+ * its quantum is used up (in which case it is moved down a level) and
+ * something at its new level or above is waiting, or something at a
+ * higher level is waiting to run.
+ */
+int
+scheduler_tick(int ticks)
+{
+	struct thread *cur = curthread;
+	int i, preempt;
+
+	assert(curspl>0);
+
+	aging_countdown -= ticks;
+	if (aging_countdown <= 0) {
+		aging_countdown = SCHED_AGING_TICKS;
+		age_all();
+	}
+
+	/* Idle (we're inside scheduler()) */
+	if (cur == NULL) {
+		return 0;
+	}
+
+	preempt = cur->t_priority;
+	cur->t_ticksleft -= ticks;
+	if (cur->t_ticksleft <= 0) {
+		cur->t_ticksleft = 0;
+		if (cur->t_priority < SCHED_NLEVELS-1) {
+			levelstats[cur->t_priority].ls_demotions++;
+			cur->t_priority++;
+		}
+		/* Waiters at the new level get a turn too */
+		preempt = cur->t_priority + 1;
+	}
+
+	for (i=0; i<preempt; i++) {
+		if (!q_empty(runqueues[i])) {
+			return 1;
+		}
+	}
+
+	/* Nothing to switch to; carry on with a fresh quantum */
+	if (cur->t_ticksleft == 0) {
+		cur->t_ticksleft = SCHED_QUANTUM(cur->t_priority);
+	}
+	return 0;
+}
+
+/*
+ * Ticks until RUNNING (which may be NULL) should be checked for
+ * preemption, or -1 if nothing else is runnable and it can run for as
+ * long as it likes.
+ */
+int
+scheduler_nextevent(struct thread *running)
+{
+	int next;
+
+	assert(curspl>0);
+
+	if (sched_nqueued == 0) {
+		return -1;
+	}
+
+	next = aging_countdown;
+	if (running != NULL && running->t_ticksleft > 0 &&
+	    running->t_ticksleft < next) {
+		next = running->t_ticksleft;
+	}
+	return next;
+}
+
+/*
+ * Set the quantum of the top level, in ticks.
+ */
+int
+scheduler_setquantum(int ticks)
+{
+	if (ticks < 1 || ticks > SCHED_MAXQUANTUM) {
+		return EINVAL;
+	}
+	sched_basequantum = ticks;
+	return 0;
+}
+
+int
+scheduler_getquantum(void)
+{
+	return sched_basequantum;
 }
 
 /*
@@ -126,15 +402,44 @@ print_run_queue(void)
 	/* Turn interrupts off so the whole list prints atomically. */
 	int spl = splhigh();
 
-	int i,k=0;
-	i = q_getstart(runqueue);
-	
-	while (i!=q_getend(runqueue)) {
-		struct thread *t = q_getguy(runqueue, i);
-		kprintf("  %2d: %s %p\n", k, t->t_name, t->t_sleepaddr);
-		i=(i+1)%q_getsize(runqueue);
-		k++;
+	int i, l, k=0;
+	u_int32_t now = clock_getusecs();
+
+	for (l=0; l<SCHED_NLEVELS; l++) {
+		struct queue *q = runqueues[l];
+		i = q_getstart(q);
+		while (i!=q_getend(q)) {
+			struct thread *t = q_getguy(q, i);
+			kprintf("  %2d: [%d] %s %p waiting %u usecs\n", k, l,
+				t->t_name, t->t_sleepaddr, now - t->t_stamp);
+			i=(i+1)%q_getsize(q);
+			k++;
+		}
 	}
 	
 	splx(spl);
 }
+
+/*
+ * Print per-level queue statistics.
+ */
+void
+scheduler_printstats(void)
+{
+	int spl = splhigh();
+	int l;
+
+	kprintf("Run queues (%d aging passes):\n", agings);
+	kprintf("  %5s %7s %5s %6s %10s %10s %8s %8s\n", "level",
+		"quantum", "len", "maxlen", "enqueues", "dispatches",
+		"demoted", "boosted");
+	for (l=0; l<SCHED_NLEVELS; l++) {
+		struct levelstats *ls = &levelstats[l];
+		kprintf("  %5d %7d %5d %6d %10u %10u %8u %8u\n", l,
+			SCHED_QUANTUM(l), ls->ls_len, ls->ls_maxlen,
+			ls->ls_enqueues, ls->ls_dispatches,
+			ls->ls_demotions, ls->ls_boosts);
+	}
+
+	splx(spl);
+}
@@ -4,13 +4,72 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <synch.h>
 #include <thread.h>
 #include <curthread.h>
 #include <machine/spl.h>
+#include <objcache.h>
 
 #include "opt-A1.h"
+
+/*
+ * Synchronization objects come from object caches. The constructor
+ * gives each object a name buffer, which stays with the object while
+ * it sits in the cache, so creating one normally costs no kmalloc.
+ */
+#define SYNCH_CACHE_LIMIT 32
+
+static struct objcache *sem_cache;
+static struct objcache *lock_cache;
+static struct objcache *cv_cache;
+
+/*
+ * The name is the first member of all three structures, so one
+ * constructor and destructor do for all of them.
+ */
+static
+int
+synch_ctor(void *obj)
+{
+	char **namep = obj;
+
+	*namep = kmalloc(SYNCH_NAMELEN);
+	if (*namep == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+synch_dtor(void *obj)
+{
+	char **namep = obj;
+	kfree(*namep);
+}
+
+static
+void
+synch_setname(char *buf, const char *name)
+{
+	snprintf(buf, SYNCH_NAMELEN, "%s", name);
+}
+
+void
+synch_bootstrap(void)
+{
+	sem_cache = objcache_create("semaphore", sizeof(struct semaphore),
+				    SYNCH_CACHE_LIMIT, synch_ctor, synch_dtor);
+	lock_cache = objcache_create("lock", sizeof(struct lock),
+				     SYNCH_CACHE_LIMIT, synch_ctor, synch_dtor);
+	cv_cache = objcache_create("cv", sizeof(struct cv),
+				   SYNCH_CACHE_LIMIT, synch_ctor, synch_dtor);
+	if (sem_cache == NULL || lock_cache == NULL || cv_cache == NULL) {
+		panic("synch_bootstrap: Out of memory\n");
+	}
+}
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -22,16 +81,12 @@ sem_create(const char *namearg, int initial_count)
 
 	assert(initial_count >= 0);
 
-	sem = kmalloc(sizeof(struct semaphore));
+	sem = objcache_alloc(sem_cache);
 	if (sem == NULL) {
 		return NULL;
 	}
 
-	sem->name = kstrdup(namearg);
-	if (sem->name == NULL) {
-		kfree(sem);
-		return NULL;
-	}
+	synch_setname(sem->name, namearg);
 
 	sem->count = initial_count;
 	return sem;
@@ -53,15 +108,18 @@ sem_destroy(struct semaphore *sem)
 	 * if they're going to do that, they can just as easily wait
 	 * a bit and start sleeping on the semaphore after it's been
 	 * freed. Consequently, there's not a whole lot of point in 
-	 * including the kfrees in the splhigh block, so we don't.
+	 * including the free in the splhigh block, so we don't.
 	 */
 
-	kfree(sem->name);
-	kfree(sem);
+	objcache_free(sem_cache, sem);
 }
 
-void 
-P(struct semaphore *sem)
+/*
+ * Common code for P and P_io.
+ */
+static
+void
+sem_down(struct semaphore *sem, int io)
 {
 	int spl;
 	assert(sem != NULL);
@@ -76,13 +134,30 @@ P(struct semaphore *sem)
 
 	spl = splhigh();
 	while (sem->count==0) {
-		thread_sleep(sem);
+		if (io) {
+			thread_sleep_io(sem);
+		}
+		else {
+			thread_sleep(sem);
+		}
 	}
 	assert(sem->count>0);
 	sem->count--;
 	splx(spl);
 }
 
+void 
+P(struct semaphore *sem)
+{
+	sem_down(sem, 0);
+}
+
+void
+P_io(struct semaphore *sem)
+{
+	sem_down(sem, 1);
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -104,19 +179,16 @@ lock_create(const char *name)
 {
 	struct lock *lock;
 
-	lock = kmalloc(sizeof(struct lock));
+	lock = objcache_alloc(lock_cache);
 	if (lock == NULL) {
 		return NULL;
 	}
 
-	lock->name = kstrdup(name);
-	if (lock->name == NULL) {
-		kfree(lock);
-		return NULL;
-	}
+	synch_setname(lock->name, name);
 	
 	#if OPT_A1
 		lock->holder = NULL;
+		threadlist_init(&lock->waiters);
 	#endif
 	
 	return lock;
@@ -130,11 +202,11 @@ lock_destroy(struct lock *lock)
 	#if OPT_A1
 		int spl = splhigh();
 		assert(lock->holder == NULL);
+		assert(threadlist_isempty(&lock->waiters));
 		splx(spl);
 	#endif
 	
-	kfree(lock->name);
-	kfree(lock);
+	objcache_free(lock_cache, lock);
 }
 
 void
@@ -145,12 +217,14 @@ lock_acquire(struct lock *lock)
 		assert(in_interrupt == 0);
 
 		int spl = splhigh();
-		while (lock->holder != NULL) {
-			thread_sleep(lock);
+		if (lock->holder == NULL) {
+			lock->holder = curthread;
 		}
-		assert(lock->holder == NULL);
-
-		lock->holder = curthread;
+		else {
+			/* lock_release hands the lock straight to us */
+			thread_block(&lock->waiters);
+		}
+		assert(lock->holder == curthread);
 		splx(spl);
 	#else
 		(void)lock;
@@ -166,8 +240,8 @@ lock_release(struct lock *lock)
 		
 		int spl = splhigh();
 		assert(lock_do_i_hold(lock));
-		lock->holder = NULL;
-		thread_wakeup(lock);
+		/* Hand off to the first waiter, if any */
+		lock->holder = thread_unblock_one(&lock->waiters);
 		splx(spl);
 	#else
 		(void)lock;		
@@ -200,16 +274,16 @@ cv_create(const char *name)
 {
 	struct cv *cv;
 
-	cv = kmalloc(sizeof(struct cv));
+	cv = objcache_alloc(cv_cache);
 	if (cv == NULL) {
 		return NULL;
 	}
 
-	cv->name = kstrdup(name);
-	if (cv->name==NULL) {
-		kfree(cv);
-		return NULL;
-	}
+	synch_setname(cv->name, name);
+
+	#if OPT_A1
+		threadlist_init(&cv->waiters);
+	#endif
 	
 	return cv;
 }
@@ -218,9 +292,14 @@ void
 cv_destroy(struct cv *cv)
 {
 	assert(cv != NULL);
+
+	#if OPT_A1
+		int spl = splhigh();
+		assert(threadlist_isempty(&cv->waiters));
+		splx(spl);
+	#endif
 	
-	kfree(cv->name);
-	kfree(cv);
+	objcache_free(cv_cache, cv);
 }
 
 void
@@ -232,7 +311,7 @@ cv_wait(struct cv *cv, struct lock *lock)
 		
 		int spl = splhigh();
 		lock_release(lock);
-		thread_sleep(cv);
+		thread_block(&cv->waiters);
 		lock_acquire(lock);
 		splx(spl);
 	#else
@@ -250,7 +329,7 @@ cv_signal(struct cv *cv, struct lock *lock)
 		assert(lock_do_i_hold(lock));
 	
 		int spl = splhigh();
-		thread_wakeup_one(cv);
+		thread_unblock_one(&cv->waiters);
 		splx(spl);
 	#else
 		(void)cv;
@@ -267,7 +346,7 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 		assert(lock_do_i_hold(lock));
 		
 		int spl = splhigh();
-		thread_wakeup(cv);
+		thread_unblock_all(&cv->waiters);
 		splx(spl);
 	#else
 		(void)cv;
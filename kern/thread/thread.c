@@ -19,6 +19,8 @@
 #include <synch.h>
 #include <filecalls.h>
 #include <pt.h>
+#include <objcache.h>
+#include <clock.h>
 
 #include "opt-synchprobs.h"
 #include "opt-A1.h"
@@ -29,14 +31,45 @@ typedef enum {
 	S_RUN,
 	S_READY,
 	S_SLEEP,
+	S_BLOCK,
 	S_ZOMB,
 } threadstate_t;
 
 /* Global variable for the thread currently executing at any given time. */
 struct thread *curthread;
 
-/* Table of sleeping threads. */
-static struct array *sleepers;
+/*
+ * Sleeping threads.
+ *
+ * Threads sleeping on the same address are kept, in the order they
+ * went to sleep, on a wait queue (struct sleepq) for that address.
+ * The wait queues are found through a hash table keyed by address, so
+ * waking up costs time proportional to the number of threads woken
+ * rather than to the number of threads asleep.
+ *
+ * No memory is allocated when going to sleep. Every awake thread owns
+ * one struct sleepq (t_sleepq). When it goes to sleep it hands it over:
+ * if it is the first thread sleeping on its address its sleepq becomes
+ * the wait queue for that address, otherwise it goes on that queue's
+ * list of spares. Each thread woken up takes one back, the last one
+ * taking the wait queue itself. So a wait queue with N sleepers always
+ * has N-1 spares.
+ */
+struct sleepq {
+	const void *sq_addr;		/* sleep address */
+	struct thread *sq_head;		/* first sleeper (next to wake) */
+	struct thread *sq_tail;		/* last sleeper */
+	struct sleepq *sq_next;		/* hash chain */
+	struct sleepq *sq_spares;	/* donated by the other sleepers */
+};
+
+#define SLEEPQ_HASHSIZE 64	/* power of 2 */
+#define SLEEPQ_HASH(addr) \
+	((((vaddr_t)(addr)) >> 3 ^ ((vaddr_t)(addr)) >> 9) & (SLEEPQ_HASHSIZE-1))
+
+static struct sleepq *sleepq_table[SLEEPQ_HASHSIZE];
+
+static void sleepq_add(struct thread *t);
 
 /* List of dead threads to be disposed of. */
 static struct array *zombies;
@@ -44,6 +77,63 @@ static struct array *zombies;
 /* Total number of outstanding threads. Does not count zombies[]. */
 static int numthreads;
 
+/*
+ * Scheduler accounting.
+ *
+ * Every thread is stamped with the time of its last transition
+ * between running, waiting to run, and sleeping, and the time since
+ * then is added to the matching total in its t_stats when it makes
+ * the next one. Run queue waits and run times (from being picked to
+ * switching away) also go into system-wide histograms, with bucket N
+ * counting times from 2^N to 2^(N+1)-1 microseconds.
+ *
+ * allthreads lists every thread structure, zombies included, for
+ * thread_printstats.
+ */
+#define SCHEDHIST_NBUCKETS 20
+
+static u_int32_t hist_wait[SCHEDHIST_NBUCKETS];
+static u_int32_t hist_run[SCHEDHIST_NBUCKETS];
+
+static struct thread *allthreads;
+
+/*
+ * Thread structures come from an object cache. The constructor sets
+ * up the parts that can be reused as-is by the next thread to get the
+ * same structure (the sleep queue).
+ *
+ * Kernel stacks come from a cache of their own, so a fork right after
+ * an exit gets the dead thread's stack back instead of going to the
+ * page allocator. THREAD_PREALLOC structures and stacks are made at
+ * boot; thread_prealloc can ask for more later.
+ */
+#define THREAD_CACHE_LIMIT 16
+#define THREAD_PREALLOC    4
+static struct objcache *thread_cache;
+static struct objcache *stack_cache;
+
+static
+int
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	thread->t_sleepq = kmalloc(sizeof(struct sleepq));
+	if (thread->t_sleepq == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	kfree(thread->t_sleepq);
+}
+
 /*
  * Create a thread. This is used both to create the first thread's 
  * thread structure and to create subsequent threads.
@@ -53,24 +143,42 @@ static
 struct thread *
 thread_create(const char *name)
 {
-	struct thread *thread = kmalloc(sizeof(struct thread));
+	struct thread *thread = objcache_alloc(thread_cache);
 	if (thread==NULL) {
 		return NULL;
 	}
 	thread->t_name = kstrdup(name);
 	if (thread->t_name==NULL) {
-		kfree(thread);
+		objcache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_sleepaddr = NULL;
+	thread->t_sleepnext = NULL;
+	thread->t_iowait = 0;
 	thread->t_stack = NULL;
+
+	/* New threads start at the top level */
+	thread->t_priority = 0;
+	thread->t_ticksleft = 0;
+
+	bzero(&thread->t_stats, sizeof(thread->t_stats));
+	thread->t_stamp = clock_getusecs();
+
+	int spl = splhigh();
+	thread->t_allnext = allthreads;
+	if (allthreads != NULL) {
+		allthreads->t_allprevp = &thread->t_allnext;
+	}
+	thread->t_allprevp = &allthreads;
+	allthreads = thread;
+	splx(spl);
 	
 	thread->t_vmspace = NULL;
 	thread->t_cwd = NULL;
+	thread->t_bufpins = 0;
 	
 	#if OPT_A2
-	thread->t_ppid = 0;
-	thread->t_cvwaitpid = cv_create(thread->t_name);
+	thread->t_pid = 0;
 
 	int i;
 	for(i=0;i<MAX_FD;i++){
@@ -82,6 +190,65 @@ thread_create(const char *name)
 	return thread;
 }
 
+/*
+ * Free the storage for a thread that either never ran or has been
+ * cleaned up by thread_exit.
+ */
+static
+void
+thread_free(struct thread *thread)
+{
+	int spl = splhigh();
+	*thread->t_allprevp = thread->t_allnext;
+	if (thread->t_allnext != NULL) {
+		thread->t_allnext->t_allprevp = thread->t_allprevp;
+	}
+	splx(spl);
+
+	if (thread->t_stack) {
+		objcache_free(stack_cache, thread->t_stack);
+	}
+	kfree(thread->t_name);
+	objcache_free(thread_cache, thread);
+}
+
+/*
+ * Give THREAD a kernel stack.
+ */
+static
+int
+thread_allocstack(struct thread *thread)
+{
+	thread->t_stack = objcache_alloc(stack_cache);
+	if (thread->t_stack==NULL) {
+		return ENOMEM;
+	}
+
+	/* stick a magic number on the bottom end of the stack */
+	thread->t_stack[0] = 0xae;
+	thread->t_stack[1] = 0x11;
+	thread->t_stack[2] = 0xda;
+	thread->t_stack[3] = 0x33;
+
+	return 0;
+}
+
+/*
+ * Make sure at least N thread structures and stacks are cached and
+ * ready for thread_fork, so it need not go to kmalloc for them.
+ */
+int
+thread_prealloc(int n)
+{
+	int result;
+
+	result = objcache_prealloc(thread_cache, n);
+	if (result) {
+		return result;
+	}
+	return objcache_prealloc(stack_cache, n);
+}
+
 /*
  * Destroy a thread.
  *
@@ -95,22 +262,13 @@ thread_destroy(struct thread *thread)
 	assert(thread != curthread);
 
 	// If you add things to the thread structure, be sure to dispose of
-	// them here or in thread_exit.
+	// them here, in thread_dtor, or in thread_exit.
 
 	// These things are cleaned up in thread_exit.
 	assert(thread->t_vmspace==NULL);
 	assert(thread->t_cwd==NULL);
 	
-	if (thread->t_stack) {
-		kfree(thread->t_stack);
-	}
-
-	#if OPT_A2
-	cv_destroy(thread->t_cvwaitpid);
-	#endif /* OPT_A2 */
-
-	kfree(thread->t_name);
-	kfree(thread);
+	thread_free(thread);
 }
 
 
@@ -144,32 +302,29 @@ static
 void
 thread_killall(void)
 {
-	int i, result;
+	struct sleepq *sq;
+	struct thread *t;
+	int i;
 
 	assert(curspl>0);
 
-	/*
-	 * Move all sleepers to the zombie list, to be sure they don't
-	 * wake up while we're shutting down.
-	 */
-
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		kprintf("sleep: Dropping thread %s\n", t->t_name);
+	for (i=0; i<SLEEPQ_HASHSIZE; i++) {
+		for (sq = sleepq_table[i]; sq != NULL; sq = sq->sq_next) {
+			for (t = sq->sq_head; t != NULL; t = t->t_sleepnext) {
+				kprintf("sleep: Dropping thread %s\n",
+					t->t_name);
+			}
+		}
 
 		/*
-		 * Don't do this: because these threads haven't
-		 * been through thread_exit, thread_destroy will
-		 * get upset. Just drop the threads on the floor,
-		 * which is safer anyway during panic.
-		 *
-		 * array_add(zombies, t);
+		 * Don't put the threads on the zombie list: because
+		 * they haven't been through thread_exit, thread_destroy
+		 * will get upset. Just drop the threads (and their
+		 * wait queues) on the floor, which is safer anyway
+		 * during panic.
 		 */
+		sleepq_table[i] = NULL;
 	}
-
-	result = array_setsize(sleepers, 0);
-	/* shrinking array: not supposed to fail */
-	assert(result==0);
 }
 
 /*
@@ -219,6 +374,62 @@ one_thread_only() {
   return(n==1);
 }
 
+void
+thread_getstats(struct thread *t, struct schedstats *stats)
+{
+	int spl = splhigh();
+
+	*stats = t->t_stats;
+	stats->ss_priority = t->t_priority;
+
+	splx(spl);
+}
+
+static
+void
+print_schedhist(const char *what, u_int32_t *hist)
+{
+	int b;
+
+	kprintf("%s (usecs):\n", what);
+	for (b=0; b<SCHEDHIST_NBUCKETS; b++) {
+		if (hist[b] == 0) {
+			continue;
+		}
+		if (b == SCHEDHIST_NBUCKETS-1) {
+			kprintf("  %8u+        %10u\n", 1U << b, hist[b]);
+		}
+		else {
+			kprintf("  %8u-%-8u %10u\n", b ? 1U << b : 0,
+				(2U << b) - 1, hist[b]);
+		}
+	}
+}
+
+void
+thread_printstats(void)
+{
+	struct thread *t;
+	int spl = splhigh();
+
+	kprintf("%-16s %3s %10s %10s %9s %10s %7s %6s %6s\n",
+		"thread", "lvl", "cpu", "wait", "maxwait", "sleep",
+		"runs", "vol", "invol");
+	for (t = allthreads; t != NULL; t = t->t_allnext) {
+		struct schedstats *ss = &t->t_stats;
+		kprintf("%-16s %3d %10u %10u %9u %10u %7u %6u %6u\n",
+			t->t_name, t->t_priority, ss->ss_cpuusecs,
+			ss->ss_waitusecs, ss->ss_maxwaitusecs,
+			ss->ss_sleepusecs, ss->ss_dispatches,
+			ss->ss_nvoluntary, ss->ss_ninvoluntary);
+	}
+
+	print_schedhist("Run queue wait", hist_wait);
+	print_schedhist("Run time once picked", hist_run);
+
+	splx(spl);
+}
+
 
 /*
  * Thread initialization.
@@ -229,9 +440,19 @@ thread_bootstrap(void)
 	struct thread *me;
 
 	/* Create the data structures we need. */
-	sleepers = array_create();
-	if (sleepers==NULL) {
-		panic("Cannot create sleepers array\n");
+	thread_cache = objcache_create("thread", sizeof(struct thread),
+				       THREAD_CACHE_LIMIT,
+				       thread_ctor, thread_dtor);
+	if (thread_cache==NULL) {
+		panic("Cannot create thread cache\n");
+	}
+	stack_cache = objcache_create("thread stack", STACK_SIZE,
+				      THREAD_CACHE_LIMIT, NULL, NULL);
+	if (stack_cache==NULL) {
+		panic("Cannot create thread stack cache\n");
+	}
+	if (thread_prealloc(THREAD_PREALLOC)) {
+		panic("Cannot preallocate threads\n");
 	}
 
 	zombies = array_create();
@@ -242,7 +463,7 @@ thread_bootstrap(void)
 	#if OPT_A2
 	//setup the table for tracking process ID information
 	pid_setuptable();
-	sys_init();
+	fd_bootstrap();
 	#endif /* OPT_A2 */
 	
 	/*
@@ -287,8 +508,6 @@ thread_bootstrap(void)
 void
 thread_shutdown(void)
 {
-	array_destroy(sleepers);
-	sleepers = NULL;
 	array_destroy(zombies);
 	zombies = NULL;
 	
@@ -302,16 +521,21 @@ thread_shutdown(void)
 /*
  * Create a new thread based on an existing one.
  * The new thread has name NAME, and starts executing in function FUNC.
- * DATA1 and DATA2 are passed to FUNC.
+ * DATA1 and DATA2 are passed to FUNC. Its pid is a child of PARENT,
+ * or detached if PARENT is 0.
  */
+static
 int
-thread_fork(const char *name, 
-	    void *data1, unsigned long data2,
-	    void (*func)(void *, unsigned long),
-	    struct thread **ret)
+thread_fork_pid(const char *name, 
+		void *data1, unsigned long data2,
+		void (*func)(void *, unsigned long),
+		pid_t parent, struct thread **ret)
 {
 	struct thread *newguy;
 	int s, result;
+	#if OPT_A2
+	int i;
+	#endif
 
 
 	/* Allocate a thread */
@@ -321,30 +545,25 @@ thread_fork(const char *name,
 	}
 
 	#if OPT_A2
-	newguy->t_pid = pid_getnext(newguy);
+	newguy->t_pid = pid_alloc(newguy, parent);
 	if(newguy->t_pid == 0){
-		kfree(newguy->t_name);
-		kfree(newguy);
+		thread_free(newguy);
 		return EAGAIN;
 	}
-	
-	newguy->t_ppid = curthread->t_pid;
+	#else
+	(void)parent;
 	#endif /* OPT_A2 */
 
 	/* Allocate a stack */
-	newguy->t_stack = kmalloc(STACK_SIZE);
-	if (newguy->t_stack==NULL) {
-		kfree(newguy->t_name);
-		kfree(newguy);
-		return ENOMEM;
+	result = thread_allocstack(newguy);
+	if (result) {
+		#if OPT_A2
+		pid_unalloc(newguy->t_pid);
+		#endif
+		thread_free(newguy);
+		return result;
 	}
 
-	/* stick a magic number on the bottom end of the stack */
-	newguy->t_stack[0] = 0xae;
-	newguy->t_stack[1] = 0x11;
-	newguy->t_stack[2] = 0xda;
-	newguy->t_stack[3] = 0x33;
-
 	/* Inherit the current directory */
 	if (curthread->t_cwd != NULL) {
 		VOP_INCREF(curthread->t_cwd);
@@ -361,10 +580,6 @@ thread_fork(const char *name,
 	 * Make sure our data structures have enough space, so we won't
 	 * run out later at an inconvenient time.
 	 */
-	result = array_preallocate(sleepers, numthreads+1);
-	if (result) {
-		goto fail;
-	}
 	result = array_preallocate(zombies, numthreads+1);
 	if (result) {
 		goto fail;
@@ -378,15 +593,9 @@ thread_fork(const char *name,
 
 	#if OPT_A2
 	// copy rest of fd's
-	int i, j; //j only used in case of failiure
-	for (i = 0; i <= MAX_FD; i++)
-	{
-		if (curthread->t_filetable[i] != NULL) {
-			result = fd_copy(curthread->t_filetable[i], &(newguy->t_filetable[i]));
-			if (result) {
-				goto failfd;
-			}
-		}
+	result = fd_copytable(curthread->t_filetable, newguy->t_filetable);
+	if (result) {
+		goto fail;
 	}
 	#endif /* OPT_A2 */
 
@@ -421,8 +630,9 @@ thread_fork(const char *name,
 
  failfd:
 	#if OPT_A2
-	for(j=0; j < i; j++){
+	for(i=0; i < MAX_FD; i++){
 		fd_destroy(newguy->t_filetable[i]);
+		newguy->t_filetable[i] = NULL;
 	}
 	#endif /* OPT_A2 */
  fail:
@@ -430,69 +640,93 @@ thread_fork(const char *name,
 	if (newguy->t_cwd != NULL) {
 		VOP_DECREF(newguy->t_cwd);
 	}
-	kfree(newguy->t_stack);
-	kfree(newguy->t_name);
-	kfree(newguy);
+	#if OPT_A2
+	pid_unalloc(newguy->t_pid);
+	#endif
+	thread_free(newguy);
 
 	return result;
 }
 
+/*
+ * Kernel threads are detached; nobody waits for them.
+ */
+int
+thread_fork(const char *name, 
+	    void *data1, unsigned long data2,
+	    void (*func)(void *, unsigned long),
+	    struct thread **ret)
+{
+	return thread_fork_pid(name, data1, data2, func, 0, ret);
+}
+
+#if OPT_A2
+/*
+ * Like thread_fork, but the new thread is a child process of the
+ * current one, which can wait for it.
+ */
+int
+thread_fork_child(const char *name, 
+		  void *data1, unsigned long data2,
+		  void (*func)(void *, unsigned long),
+		  struct thread **ret)
+{
+	return thread_fork_pid(name, data1, data2, func, curthread->t_pid,
+			       ret);
+}
+#endif /* OPT_A2 */
+
 //easier to do all the work in thread.c
 #if OPT_A2
 int
 sys_fork(struct trapframe *tf, int *retval)
 {
 	struct thread *newguy;
-	int s, result;
+	int s, result, i;
 
 	newguy = thread_create(curthread->t_name);
 	if(newguy==NULL) {
 		return ENOMEM;
 	}
 	
-	newguy->t_ppid = curthread->t_pid;
-	newguy->t_pid = pid_getnext(newguy);
+	newguy->t_pid = pid_alloc(newguy, curthread->t_pid);
 	//kprintf("forking %d forked %d\n", curthread->t_pid, newguy->t_pid);
 	if(newguy->t_pid == 0){
-		kfree(newguy->t_name);
-		kfree(newguy);
+		thread_free(newguy);
 		return EAGAIN;
 	}
 
-	newguy->t_stack = kmalloc(STACK_SIZE);
-	if (newguy->t_stack==NULL) {
-		kfree(newguy->t_name);
-		kfree(newguy);
-		return ENOMEM;
+	result = thread_allocstack(newguy);
+	if (result) {
+		pid_unalloc(newguy->t_pid);
+		thread_free(newguy);
+		return result;
 	}
 
-	newguy->t_stack[0] = 0xae;
-	newguy->t_stack[1] = 0x11;
-	newguy->t_stack[2] = 0xda;
-	newguy->t_stack[3] = 0x33;
-
 	if (curthread->t_cwd != NULL) {
 		VOP_INCREF(curthread->t_cwd);
 		newguy->t_cwd = curthread->t_cwd;
 	}
 
-	s = splhigh();
-	
 	memcpy(&newguy->t_stack[16], tf, sizeof(struct trapframe));
 	md_initpcb(&newguy->t_pcb, newguy->t_stack, &newguy->t_stack[16], 0, (void*)md_forkentry);
 	
+	/*
+	 * Copying the address space can take a long time (and sleep on
+	 * the page table lock or the disk), so do it with interrupts on.
+	 * Nobody else can see newguy yet.
+	 */
 	#if OPT_A3
 	result = as_copy(curthread->t_vmspace, &newguy->t_vmspace, newguy->t_pid);
 	#else
 	result = as_copy(curthread->t_vmspace, &newguy->t_vmspace);
 	#endif
 	if(result) {
-		goto fail;
-	}
-	result = array_preallocate(sleepers, numthreads+1);
-	if (result) {
-		goto fail;
+		goto failas;
 	}
+
+	s = splhigh();
+
 	result = array_preallocate(zombies, numthreads+1);
 	if (result) {
 		goto fail;
@@ -504,16 +738,9 @@ sys_fork(struct trapframe *tf, int *retval)
 	}
 
 	// copy rest of fd's
-	int i, j; //j only used in case of failiure
-	for (i = 0; i < MAX_FD; i++)
-	{
-		if (curthread->t_filetable[i] != NULL) {
-			result = fd_copy(curthread->t_filetable[i], &(newguy->t_filetable[i]));
-			
-			if (result) {
-				goto failfd;
-			}
-		}
+	result = fd_copytable(curthread->t_filetable, newguy->t_filetable);
+	if (result) {
+		goto fail;
 	}
 
 	result = make_runnable(newguy);
@@ -527,22 +754,109 @@ sys_fork(struct trapframe *tf, int *retval)
 	return 0;
 	
  failfd:
-	for(j=0; j < i; j++){
+	for(i=0; i < MAX_FD; i++){
 		fd_destroy(newguy->t_filetable[i]);
+		newguy->t_filetable[i] = NULL;
 	}
  fail:
 	splx(s);
+	if (newguy->t_vmspace != NULL) {
+		as_destroy(newguy->t_vmspace);
+		newguy->t_vmspace = NULL;
+	}
+ failas:
+	#if OPT_A3
+	pt_free_pages(newguy->t_pid);
+	#endif
 	if (newguy->t_cwd != NULL) {
 		VOP_DECREF(newguy->t_cwd);
 	}
-	pid_clear(newguy->t_pid);
-	kfree(newguy->t_stack);
-	kfree(newguy->t_name);
-	kfree(newguy);
+	pid_unalloc(newguy->t_pid);
+	thread_free(newguy);
 	return result;
 }
 #endif /* OPT_A2 */
 
+/*
+ * Bucket for a time in a scheduler histogram.
+ */
+static
+int
+schedhist_bucket(u_int32_t usecs)
+{
+	int b = 0;
+
+	while (usecs > 1 && b < SCHEDHIST_NBUCKETS-1) {
+		usecs >>= 1;
+		b++;
+	}
+	return b;
+}
+
+/*
+ * Accounting for CUR switching away to go to NEXTSTATE. Being
+ * switched out from the timer interrupt is a preemption; anything
+ * else is the thread's own doing.
+ */
+static
+void
+acct_switchout(struct thread *cur, threadstate_t nextstate)
+{
+	u_int32_t now = clock_getusecs();
+	u_int32_t ran = now - cur->t_stamp;
+
+	cur->t_stats.ss_cpuusecs += ran;
+	hist_run[schedhist_bucket(ran)]++;
+	cur->t_stamp = now;
+
+	if (nextstate == S_READY && in_interrupt) {
+		cur->t_stats.ss_ninvoluntary++;
+	}
+	else if (nextstate != S_ZOMB) {
+		cur->t_stats.ss_nvoluntary++;
+	}
+}
+
+/*
+ * Accounting for NEXT being picked to run.
+ */
+static
+void
+acct_switchin(struct thread *next)
+{
+	u_int32_t now = clock_getusecs();
+	u_int32_t waited = now - next->t_stamp;
+
+	next->t_stats.ss_waitusecs += waited;
+	if (waited > next->t_stats.ss_maxwaitusecs) {
+		next->t_stats.ss_maxwaitusecs = waited;
+	}
+	next->t_stats.ss_dispatches++;
+	hist_wait[schedhist_bucket(waited)]++;
+	next->t_stamp = now;
+}
+
+/*
+ * Make a sleeping or blocked thread runnable again. Only a thread
+ * that was waiting for a device gets a boost; one handed a lock or
+ * signalled on a CV goes back where it was.
+ */
+static
+int
+wake_thread(struct thread *t)
+{
+	u_int32_t now = clock_getusecs();
+
+	t->t_stats.ss_sleepusecs += now - t->t_stamp;
+	t->t_stamp = now;
+
+	if (t->t_iowait) {
+		t->t_iowait = 0;
+		return scheduler_wakeup(t);
+	}
+	return make_runnable(t);
+}
+
 /*
  * High level, machine-independent context switch code.
  */
@@ -581,6 +895,8 @@ mi_switch(threadstate_t nextstate)
 	cur = curthread;
 	curthread = NULL;
 
+	acct_switchout(cur, nextstate);
+
 	/*
 	 * Stash the current thread on whatever list it's supposed to go on.
 	 * Because we preallocate during thread_fork, this should not fail.
@@ -590,11 +906,13 @@ mi_switch(threadstate_t nextstate)
 		result = make_runnable(cur);
 	}
 	else if (nextstate==S_SLEEP) {
-		/*
-		 * Because we preallocate sleepers[] during thread_fork,
-		 * this should never fail.
-		 */
-		result = array_add(sleepers, cur);
+		/* Sleeping never needs memory; see struct sleepq. */
+		sleepq_add(cur);
+		result = 0;
+	}
+	else if (nextstate==S_BLOCK) {
+		/* thread_block already put us on its threadlist */
+		result = 0;
 	}
 	else {
 		assert(nextstate==S_ZOMB);
@@ -608,6 +926,8 @@ mi_switch(threadstate_t nextstate)
 
 	next = scheduler();
 
+	acct_switchin(next);
+
 	/* update curthread */
 	curthread = next;
 	
@@ -657,7 +977,6 @@ thread_exit(void)
 	}
 
 	#if OPT_A2
-	pid_clear(curthread->t_pid);
 	// file descriptor free
     int i;
     for (i = 0; i < MAX_FD; i++){
@@ -687,6 +1006,14 @@ thread_exit(void)
 		curthread->t_cwd = NULL;
 	}
 
+	#if OPT_A2
+	/*
+	 * Last, since the parent may reap us and the pid be reused as
+	 * soon as this is done, and the page tables are keyed by pid.
+	 */
+	pid_exit(curthread->t_pid);
+	#endif /* OPT_A2 */
+
 	assert(numthreads>0);
 	numthreads--;
 	mi_switch(S_ZOMB);
@@ -702,8 +1029,8 @@ thread_yield(void)
 {
 	int spl = splhigh();
 
-	/* Check sleepers just in case we get here after shutdown */
-	assert(sleepers != NULL);
+	/* Check zombies just in case we get here after shutdown */
+	assert(zombies != NULL);
 
 	mi_switch(S_READY);
 	splx(spl);
@@ -731,6 +1058,106 @@ thread_sleep(const void *addr)
 	curthread->t_sleepaddr = NULL;
 }
 
+/*
+ * Sleep on ADDR waiting for a device. Same rules as thread_sleep.
+ */
+void
+thread_sleep_io(const void *addr)
+{
+	curthread->t_iowait = 1;
+	thread_sleep(addr);
+	assert(curthread->t_iowait == 0);
+}
+
+/*
+ * Find the wait queue for ADDR. If PREVP is not NULL, it's set to point
+ * at the link to the queue in its hash chain.
+ */
+static
+struct sleepq *
+sleepq_lookup(const void *addr, struct sleepq ***prevp)
+{
+	struct sleepq **sqp;
+
+	for (sqp = &sleepq_table[SLEEPQ_HASH(addr)]; *sqp != NULL;
+	     sqp = &(*sqp)->sq_next) {
+		if ((*sqp)->sq_addr == addr) {
+			break;
+		}
+	}
+	if (prevp != NULL) {
+		*prevp = sqp;
+	}
+	return *sqp;
+}
+
+/*
+ * Put thread T, which is going to sleep on T->t_sleepaddr, at the end
+ * of the wait queue for that address.
+ */
+static
+void
+sleepq_add(struct thread *t)
+{
+	struct sleepq *sq, *mine;
+	struct sleepq **link;
+
+	assert(curspl>0);
+	assert(t->t_sleepq != NULL);
+
+	mine = t->t_sleepq;
+	t->t_sleepq = NULL;
+	t->t_sleepnext = NULL;
+
+	sq = sleepq_lookup(t->t_sleepaddr, &link);
+	if (sq == NULL) {
+		/* First sleeper; our sleepq becomes the wait queue */
+		sq = mine;
+		sq->sq_addr = t->t_sleepaddr;
+		sq->sq_head = sq->sq_tail = t;
+		sq->sq_spares = NULL;
+		sq->sq_next = NULL;
+		*link = sq;
+		return;
+	}
+
+	mine->sq_next = sq->sq_spares;
+	sq->sq_spares = mine;
+	sq->sq_tail->t_sleepnext = t;
+	sq->sq_tail = t;
+}
+
+/*
+ * Take the first thread off wait queue SQ (found at *LINK in its hash
+ * chain) and give it back a sleepq. Returns the thread.
+ */
+static
+struct thread *
+sleepq_remhead(struct sleepq *sq, struct sleepq **link)
+{
+	struct thread *t = sq->sq_head;
+
+	assert(t != NULL);
+
+	sq->sq_head = t->t_sleepnext;
+	t->t_sleepnext = NULL;
+
+	if (sq->sq_head == NULL) {
+		/* Last one; it gets the wait queue itself */
+		assert(sq->sq_spares == NULL);
+		*link = sq->sq_next;
+		sq->sq_next = NULL;
+		sq->sq_tail = NULL;
+		t->t_sleepq = sq;
+	}
+	else {
+		t->t_sleepq = sq->sq_spares;
+		sq->sq_spares = t->t_sleepq->sq_next;
+		t->t_sleepq->sq_next = NULL;
+	}
+	return t;
+}
+
 /*
  * Wake up one or more threads who are sleeping on "sleep address"
  * ADDR.
@@ -738,85 +1165,165 @@ thread_sleep(const void *addr)
 void
 thread_wakeup(const void *addr)
 {
-	int i, result;
+	struct sleepq *sq, **link;
+	struct thread *t;
+	int result, done;
 	
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	// This is inefficient. Feel free to improve it.
-	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			
-			// Remove from list
-			array_remove(sleepers, i);
-			
-			// must look at the same sleepers[i] again
-			i--;
-
-			/*
-			 * Because we preallocate during thread_fork,
-			 * this should never fail.
-			 */
-			result = make_runnable(t);
-			assert(result==0);
-		}
+
+	sq = sleepq_lookup(addr, &link);
+	if (sq == NULL) {
+		return;
 	}
+
+	do {
+		done = (sq->sq_head == sq->sq_tail);
+		t = sleepq_remhead(sq, link);
+
+		/*
+		 * Because we preallocate during thread_fork,
+		 * this should never fail.
+		 */
+		result = wake_thread(t);
+		assert(result==0);
+	} while (!done);
 }
 
 #if OPT_A1
 /*
- *Wake up a single thread that is sleeping on a "sleep address" 
+ * Wake up the single thread that has been sleeping longest on "sleep
+ * address" ADDR.
  */
 
 void
 thread_wakeup_one(const void *addr)
 {
-	int i, result;
+	struct sleepq *sq, **link;
+	struct thread *t;
+	int result;
 	
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	// This is inefficient. Feel free to improve it.	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			// Remove from list
-			array_remove(sleepers, i);
-			/*
-			 * Because we preallocate during thread_fork,
-			 * this should never fail.
-			 */
-			result = make_runnable(t);
-			assert(result==0);
-			
-			//we found out thread to wake, return to program
-			return;
-		}
+
+	sq = sleepq_lookup(addr, &link);
+	if (sq == NULL) {
+		return;
 	}
+
+	t = sleepq_remhead(sq, link);
+
+	/*
+	 * Because we preallocate during thread_fork,
+	 * this should never fail.
+	 */
+	result = wake_thread(t);
+	assert(result==0);
 }
 #endif
 
 /*
- * Return nonzero if there are any threads who are sleeping on "sleep address"
- * ADDR. This is meant to be used only for diagnostic purposes.
+ * Threadlists: FIFO wait queues owned by synchronization primitives.
+ * The links are the same t_sleepnext used by the sleep queues; a
+ * thread can only be waiting for one thing at a time.
+ */
+void
+threadlist_init(struct threadlist *tl)
+{
+	tl->tl_head = NULL;
+	tl->tl_tail = NULL;
+	tl->tl_count = 0;
+}
+
+int
+threadlist_isempty(struct threadlist *tl)
+{
+	return tl->tl_count == 0;
+}
+
+/*
+ * Put the current thread at the end of TL and switch away until some
+ * other thread takes it off with thread_unblock_one or
+ * thread_unblock_all. Interrupts must be off.
+ */
+void
+thread_block(struct threadlist *tl)
+{
+	// may not sleep in an interrupt handler
+	assert(in_interrupt==0);
+	assert(curspl>0);
+
+	curthread->t_sleepnext = NULL;
+	if (tl->tl_tail == NULL) {
+		tl->tl_head = curthread;
+	}
+	else {
+		tl->tl_tail->t_sleepnext = curthread;
+	}
+	tl->tl_tail = curthread;
+	tl->tl_count++;
+
+	/* so print_run_queue and friends can see what we were waiting on */
+	curthread->t_sleepaddr = tl;
+	mi_switch(S_BLOCK);
+	curthread->t_sleepaddr = NULL;
+}
+
+/*
+ * Make the first thread on TL runnable and return it, or return NULL
+ * if TL is empty. Interrupts must be off.
+ */
+struct thread *
+thread_unblock_one(struct threadlist *tl)
+{
+	struct thread *t;
+	int result;
+
+	assert(curspl>0);
+
+	t = tl->tl_head;
+	if (t == NULL) {
+		return NULL;
+	}
+	tl->tl_head = t->t_sleepnext;
+	if (tl->tl_head == NULL) {
+		tl->tl_tail = NULL;
+	}
+	tl->tl_count--;
+	t->t_sleepnext = NULL;
+
+	/*
+	 * Because we preallocate during thread_fork,
+	 * this should never fail.
+	 */
+	result = wake_thread(t);
+	assert(result==0);
+
+	return t;
+}
+
+/*
+ * Make every thread on TL runnable, in order. Interrupts must be off.
+ */
+void
+thread_unblock_all(struct threadlist *tl)
+{
+	while (thread_unblock_one(tl) != NULL) {
+		/* nothing */
+	}
+}
+
+/*
+ * Return nonzero if there are any threads sleeping on the specified
+ * address. Meant only for diagnostic purposes.
  */
 int
 thread_hassleepers(const void *addr)
 {
-	int i;
-	
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			return 1;
-		}
-	}
-	return 0;
+
+	return sleepq_lookup(addr, NULL) != NULL;
 }
 
 /*
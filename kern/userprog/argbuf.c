@@ -0,0 +1,116 @@
+/*
+ * Argument buffers. See argbuf.h for details.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <lib.h>
+#include <argbuf.h>
+
+/* Bytes left for strings once argv (with NARGS entries and a NULL) fits */
+#define ARGBUF_ROOM(ab, nargs) \
+	((int)ARG_MAX - (int)(ab)->ab_len - \
+	 (int)(((nargs) + 1) * sizeof(userptr_t)))
+
+int
+argbuf_init(struct argbuf *ab)
+{
+	ab->ab_buf = kmalloc(ARG_MAX);
+	if (ab->ab_buf == NULL) {
+		return ENOMEM;
+	}
+	ab->ab_len = 0;
+	ab->ab_nargs = 0;
+	return 0;
+}
+
+void
+argbuf_cleanup(struct argbuf *ab)
+{
+	if (ab->ab_buf != NULL) {
+		kfree(ab->ab_buf);
+		ab->ab_buf = NULL;
+	}
+}
+
+int
+argbuf_copyin(struct argbuf *ab, const_userptr_t argv)
+{
+	userptr_t uarg;
+	size_t actual;
+	int room, result;
+
+	for (;;) {
+		result = copyin(argv + ab->ab_nargs * sizeof(userptr_t),
+				&uarg, sizeof(uarg));
+		if (result) {
+			return result;
+		}
+		if (uarg == NULL) {
+			return 0;
+		}
+
+		room = ARGBUF_ROOM(ab, ab->ab_nargs + 1);
+		if (room <= 0) {
+			return E2BIG;
+		}
+		result = copyinstr(uarg, ab->ab_buf + ab->ab_len, room,
+				   &actual);
+		if (result == ENAMETOOLONG) {
+			return E2BIG;
+		}
+		if (result) {
+			return result;
+		}
+		ab->ab_len += actual;
+		ab->ab_nargs++;
+	}
+}
+
+int
+argbuf_fromkernel(struct argbuf *ab, int nargs, char **args)
+{
+	size_t len;
+	int i;
+
+	for (i=0; i<nargs; i++) {
+		len = strlen(args[i]) + 1;
+		if ((int)len > ARGBUF_ROOM(ab, ab->ab_nargs + 1)) {
+			return E2BIG;
+		}
+		memcpy(ab->ab_buf + ab->ab_len, args[i], len);
+		ab->ab_len += len;
+		ab->ab_nargs++;
+	}
+	return 0;
+}
+
+int
+argbuf_copyout(struct argbuf *ab, vaddr_t *stackptr, userptr_t *argv)
+{
+	userptr_t *uargv = (userptr_t *)ab->ab_buf;
+	size_t hdr, total, off;
+	vaddr_t base;
+	int i;
+
+	/* Slide the strings up to make room for argv in front of them */
+	hdr = (ab->ab_nargs + 1) * sizeof(userptr_t);
+	total = hdr + ab->ab_len;
+	assert(total <= ARG_MAX);
+	memmove(ab->ab_buf + hdr, ab->ab_buf, ab->ab_len);
+
+	/* keep the stack pointer 8-byte aligned */
+	base = (*stackptr - total) & ~(vaddr_t)7;
+
+	off = hdr;
+	for (i=0; i<ab->ab_nargs; i++) {
+		uargv[i] = (userptr_t)(base + off);
+		off += strlen(ab->ab_buf + off) + 1;
+	}
+	uargv[ab->ab_nargs] = NULL;
+
+	*stackptr = base;
+	*argv = (userptr_t)base;
+	return copyout(ab->ab_buf, (userptr_t)base, total);
+}
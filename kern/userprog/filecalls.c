@@ -22,6 +22,21 @@ Implementation of all file related system calls:
 #include <kern/limits.h>
 #include <synch.h>
 #include <addrspace.h>
+#include <objcache.h>
+
+/* Cache of struct fd, shared by open/close and fork/exit */
+#define FD_CACHE_LIMIT 32
+static struct objcache *fd_cache;
+
+void
+fd_bootstrap(void)
+{
+	fd_cache = objcache_create("fd", sizeof(struct fd), FD_CACHE_LIMIT,
+				   NULL, NULL);
+	if (fd_cache == NULL) {
+		panic("fd_bootstrap: Out of memory\n");
+	}
+}
 
 static
 int
@@ -216,25 +231,33 @@ fd_init(char *fname, int flag, struct fd **retval)
 {
 	
 	int ret;
-	struct fd* new_fd = kmalloc(sizeof(struct fd));
+	struct fd* new_fd = objcache_alloc(fd_cache);
 	
 	if(new_fd == NULL){
 		return ENOMEM;
 	}
 	
+	// vfs_open may modify the path, so give it a copy
 	char * name = kstrdup(fname);
+	if(name == NULL){
+		objcache_free(fd_cache, new_fd);
+		return ENOMEM;
+	}
 	
 	struct vnode *vnode;
 	ret = vfs_open(name, flag, &vnode);
 	if(ret){
 		kfree(name);
+		objcache_free(fd_cache, new_fd);
 		return ret;
 	}
 	
 	new_fd->filename = fname;
 	new_fd->vnode = vnode;
 	new_fd->offset = 0;
-	new_fd->flags = flag;
+	// fd_copy re-opens with these, so don't create or truncate again
+	new_fd->flags = flag & ~(O_CREAT | O_EXCL | O_TRUNC);
+	new_fd->refcount = 1;
 		
 	*retval = new_fd;
 	kfree(name);
@@ -323,11 +346,58 @@ fd_copy(struct fd *master, struct fd **retval)
 	return 0;
 }
 
+int
+fd_copytable(struct fd **from, struct fd **to)
+{
+	int i, j, ret;
+
+	for(i = 0; i < MAX_FD; i++){
+		to[i] = NULL;
+		if(from[i] == NULL){
+			continue;
+		}
+
+		// a dup of an earlier slot stays a dup in the copy
+		for(j = 0; j < i; j++){
+			if(from[j] == from[i]){
+				break;
+			}
+		}
+		if(j < i){
+			fd_incref(to[j]);
+			to[i] = to[j];
+			continue;
+		}
+
+		ret = fd_copy(from[i], &to[i]);
+		if(ret){
+			for(j = 0; j < i; j++){
+				fd_destroy(to[j]);
+				to[j] = NULL;
+			}
+			return ret;
+		}
+	}
+	return 0;
+}
+
+void
+fd_incref(struct fd *des)
+{
+	assert(des->refcount > 0);
+	des->refcount++;
+}
+
 void
 fd_destroy(struct fd *des)
 {
 	if(des == NULL){ return; }
 
+	assert(des->refcount > 0);
+	if(--des->refcount > 0){
+		return;
+	}
+
 	if(des->filename != NULL){
 		kfree(des->filename);
 		des->filename = NULL;
@@ -338,5 +408,5 @@ fd_destroy(struct fd *des)
 		des->vnode = NULL;
 	}
 	
-	kfree(des);
+	objcache_free(fd_cache, des);
 }
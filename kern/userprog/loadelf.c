@@ -100,6 +100,49 @@ load_segment(struct vnode *v, off_t offset, vaddr_t vaddr,
 	return result;
 }
 
+#if OPT_A3
+/*
+ * Load one page of a segment into the physical frame PADDR. The page
+ * on disk is at file offset OFFSET and has FILESIZE bytes (at most a
+ * page); the rest of the frame is zero-filled.
+ *
+ * This goes through the frame's kernel address, so it doesn't need a
+ * TLB entry for the user address, and the fault handler can keep
+ * interrupts on while the disk is read.
+ */
+int
+load_page(struct vnode *v, off_t offset, paddr_t paddr, size_t filesize)
+{
+	struct uio u;
+	char *kbuf = (char *)PADDR_TO_KVADDR(paddr);
+	int result;
+
+	if (filesize > PAGE_SIZE) {
+		filesize = PAGE_SIZE;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to paddr 0x%lx\n", 
+	      (unsigned long) filesize, (unsigned long) paddr);
+
+	mk_kuio(&u, kbuf, filesize, offset, UIO_READ);
+	result = VOP_READ(v, &u);
+	if (result) {
+		return result;
+	}
+
+	/* Zero whatever the read didn't fill */
+	bzero(kbuf + (filesize - u.uio_resid), 
+	      PAGE_SIZE - (filesize - u.uio_resid));
+
+	// incement Page Faults (Disk) for stat tracking
+	vmstats_inc(6);
+	//this one was fixed from elf file
+	vmstats_inc(7);
+
+	return 0;
+}
+#endif /* OPT_A3 */
+
 /*
  * Load an ELF executable user program into the current address space.
  *
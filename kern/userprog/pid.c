@@ -1,37 +1,107 @@
+/*
+ * Process IDs and per-process records.
+ *
+ * Every thread with a pid has a struct pidrec, found through
+ * pid_table. A record lives on after its thread exits, holding the
+ * exit code, until the parent collects it with pid_wait or exits
+ * itself. Threads created with thread_fork have no parent: nobody
+ * can wait for them and their record goes away as soon as they exit.
+ *
+ * Each record keeps two lists of its children, the ones still running
+ * and the ones that have exited (oldest first), so waiting for any
+ * child, or for a given one, takes constant time. A parent waits on
+ * the CV in its own record; a child exiting signals only its parent.
+ *
+ * Free pids are handed out in FIFO order from a ring, so a pid is
+ * reused as late as possible.
+ *
+ * All of this is protected by pid_mutex.
+ */
+
 #include <types.h>
 #include <lib.h>
 #include <kern/errno.h>
 #include <kern/limits.h>
-#include <array.h>
+#include <kern/unistd.h>
 #include <machine/spl.h>
-#include <machine/pcb.h>
 #include <thread.h>
 #include <curthread.h>
 #include <synch.h>
+#include <objcache.h>
 #include <pid.h>
 
+struct pidrec {
+	pid_t pr_pid;
+	struct thread *pr_thread;	/* NULL once exited */
+	int pr_exitcode;
+
+	struct pidrec *pr_parent;	/* NULL if detached */
+	struct pidrec *pr_next;		/* on the parent's pr_live/pr_dead */
+	struct pidrec **pr_prevp;
+
+	struct pidrec *pr_live;		/* children still running */
+	struct pidrec *pr_dead;		/* exited children, oldest first */
+	struct pidrec **pr_deadtail;
+
+	struct cv *pr_childexit;	/* signalled when a child exits */
+};
+
 static struct lock *pid_mutex;
-static struct thread *pid_table[PID_MAX];
-static int exitcodes[PID_MAX];
+static struct pidrec *pid_table[PID_MAX];
+
+/* Free pids, a ring in the order they were freed */
+static pid_t pid_free[PID_MAX];
+static int pid_freehead;
+static int pid_nfree;
+
+#define PIDREC_CACHE_LIMIT 16
+static struct objcache *pidrec_cache;
+
+static
+int
+pidrec_ctor(void *obj)
+{
+	struct pidrec *pr = obj;
+
+	pr->pr_childexit = cv_create("pr_childexit");
+	if (pr->pr_childexit == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+pidrec_dtor(void *obj)
+{
+	struct pidrec *pr = obj;
+
+	cv_destroy(pr->pr_childexit);
+}
 
 void
 pid_setuptable()
 {
 	int i;
-	
-	if(pid_table == NULL){
-		panic("unable to allocate pid table");
-	}
-	 
+
 	pid_mutex = lock_create("pid_mutex");
 	if(pid_mutex == NULL){
 		panic("unable to create pid lock");
 	}
-	
+
+	pidrec_cache = objcache_create("pidrec", sizeof(struct pidrec),
+				       PIDREC_CACHE_LIMIT,
+				       pidrec_ctor, pidrec_dtor);
+	if(pidrec_cache == NULL){
+		panic("unable to create pid record cache");
+	}
+
 	for (i = 0; i < PID_MAX; i++){
 		pid_table[i] = NULL;
-		exitcodes[i] = -1;
+		pid_free[i] = i + 1;
 	}
+	pid_freehead = 0;
+	pid_nfree = PID_MAX;
 }
 
 void
@@ -40,76 +110,288 @@ pid_destroy()
 	lock_destroy(pid_mutex);
 }
 
+/*
+ * List manipulation. pid_mutex must be held.
+ */
+static
+void
+pr_unlink(struct pidrec *pr)
+{
+	struct pidrec *parent = pr->pr_parent;
+
+	*pr->pr_prevp = pr->pr_next;
+	if (pr->pr_next != NULL) {
+		pr->pr_next->pr_prevp = pr->pr_prevp;
+	}
+	else if (parent != NULL && parent->pr_deadtail == &pr->pr_next) {
+		parent->pr_deadtail = pr->pr_prevp;
+	}
+	pr->pr_next = NULL;
+	pr->pr_prevp = NULL;
+}
+
+static
+void
+pr_addlive(struct pidrec *parent, struct pidrec *pr)
+{
+	pr->pr_next = parent->pr_live;
+	if (pr->pr_next != NULL) {
+		pr->pr_next->pr_prevp = &pr->pr_next;
+	}
+	pr->pr_prevp = &parent->pr_live;
+	parent->pr_live = pr;
+}
+
+static
+void
+pr_adddead(struct pidrec *parent, struct pidrec *pr)
+{
+	pr->pr_next = NULL;
+	pr->pr_prevp = parent->pr_deadtail;
+	*parent->pr_deadtail = pr;
+	parent->pr_deadtail = &pr->pr_next;
+}
+
+/*
+ * Give PR's pid back and free PR. It must be off any list.
+ * pid_mutex must be held.
+ */
+static
+void
+pr_free(struct pidrec *pr)
+{
+	pid_t pid = pr->pr_pid;
+
+	assert(pid_table[pid - 1] == pr);
+	pid_table[pid - 1] = NULL;
+
+	assert(pid_nfree < PID_MAX);
+	pid_free[(pid_freehead + pid_nfree) % PID_MAX] = pid;
+	pid_nfree++;
+
+	objcache_free(pidrec_cache, pr);
+}
+
+/*
+ * Assign a pid to MASTER, as a child of process PARENT, or detached
+ * if PARENT is 0. Returns 0 if out of pids or memory.
+ */
 pid_t
-pid_getnext(struct thread *master)
+pid_alloc(struct thread *master, pid_t parent)
 {
+	struct pidrec *pr;
+	pid_t pid;
+
 	assert(master != NULL);
-	
-	int i, retval = 0;
-	int search = random() % PID_MAX;
-	
+
+	pr = objcache_alloc(pidrec_cache);
+	if (pr == NULL) {
+		return 0;
+	}
+
 	lock_acquire(pid_mutex);
-	for(i = 0; pid_table[search] != NULL && i < PID_MAX; i++){
-		search++;
-		if(search == PID_MAX){
-			search = 1;
-		}
+	if (pid_nfree == 0) {
+		lock_release(pid_mutex);
+		objcache_free(pidrec_cache, pr);
+		return 0;
 	}
-	 
-	if(i < PID_MAX){
-		pid_table[search] = master;
-		exitcodes[search] = -1;
-		retval = search + 1;
+	pid = pid_free[pid_freehead];
+	pid_freehead = (pid_freehead + 1) % PID_MAX;
+	pid_nfree--;
+
+	pr->pr_pid = pid;
+	pr->pr_thread = master;
+	pr->pr_exitcode = 0;
+	pr->pr_live = NULL;
+	pr->pr_dead = NULL;
+	pr->pr_deadtail = &pr->pr_dead;
+	pr->pr_next = NULL;
+	pr->pr_prevp = NULL;
+
+	pr->pr_parent = NULL;
+	if (parent > 0 && parent <= PID_MAX) {
+		pr->pr_parent = pid_table[parent - 1];
 	}
+	if (pr->pr_parent != NULL) {
+		pr_addlive(pr->pr_parent, pr);
+	}
+
+	assert(pid_table[pid - 1] == NULL);
+	pid_table[pid - 1] = pr;
+	lock_release(pid_mutex);
+
+	return pid;
+}
+
+/*
+ * Take back a pid from pid_alloc whose thread never ran.
+ */
+void
+pid_unalloc(pid_t pid)
+{
+	struct pidrec *pr;
+
+	if (pid <= 0 || pid > PID_MAX) return;
+
+	lock_acquire(pid_mutex);
+	pr = pid_table[pid - 1];
+	assert(pr != NULL && pr->pr_live == NULL && pr->pr_dead == NULL);
+	if (pr->pr_parent != NULL) {
+		pr_unlink(pr);
+	}
+	pr_free(pr);
 	lock_release(pid_mutex);
-	
-	return retval;
 }
 
 struct thread*
 pid_getthread(pid_t pid)
 {
-	struct thread *retval;
-	
+	struct thread *retval = NULL;
+
+	if (pid <= 0 || pid > PID_MAX) return NULL;
+
 	lock_acquire(pid_mutex);
-	retval = pid_table[pid - 1];
+	if (pid_table[pid - 1] != NULL) {
+		retval = pid_table[pid - 1]->pr_thread;
+	}
 	lock_release(pid_mutex);
-	
+
 	return retval;
 }
 
+/*
+ * Copy out the scheduler accounting for a running process. The
+ * thread can't finish exiting while we hold pid_mutex.
+ */
 int
-pid_getexitcode(pid_t pid)
+pid_getstats(pid_t pid, struct schedstats *stats)
 {
-	int retval;
-	retval = exitcodes[pid - 1];
-	
-	return retval;
+	struct thread *thread = NULL;
+
+	if (pid <= 0 || pid > PID_MAX) return EINVAL;
+
+	lock_acquire(pid_mutex);
+	if (pid_table[pid - 1] != NULL) {
+		thread = pid_table[pid - 1]->pr_thread;
+	}
+	if (thread == NULL) {
+		lock_release(pid_mutex);
+		return EINVAL;
+	}
+	thread_getstats(thread, stats);
+	lock_release(pid_mutex);
+
+	return 0;
 }
 
+/*
+ * Set the code pid_wait will report once process PID has exited.
+ */
 void
 pid_setexitcode(pid_t pid, int exitcode)
 {
-	exitcodes[pid - 1] = exitcode;
+	if (pid <= 0 || pid > PID_MAX) return;
+
+	lock_acquire(pid_mutex);
+	assert(pid_table[pid - 1] != NULL);
+	pid_table[pid - 1]->pr_exitcode = exitcode;
+	lock_release(pid_mutex);
 }
 
-int pid_is_child(struct thread *thread, pid_t pid2) {
-	while(thread->t_ppid != 0) {
-		if(thread->t_ppid == pid2)
-			return 1;
+/*
+ * Process PID has exited. Called from thread_exit once nothing else
+ * is keyed by the pid, since it may be reused right away.
+ */
+void
+pid_exit(pid_t pid)
+{
+	struct pidrec *pr, *child;
+
+	if (pid <= 0 || pid > PID_MAX) return;
 
-		thread = pid_getthread(thread->t_ppid);
+	lock_acquire(pid_mutex);
+	pr = pid_table[pid - 1];
+	assert(pr != NULL && pr->pr_thread != NULL);
+	pr->pr_thread = NULL;
+
+	/* Nobody is going to wait for our children now */
+	while ((child = pr->pr_live) != NULL) {
+		pr_unlink(child);
+		child->pr_parent = NULL;
+	}
+	while ((child = pr->pr_dead) != NULL) {
+		pr_unlink(child);
+		pr_free(child);
 	}
 
-	return 0;
+	if (pr->pr_parent != NULL) {
+		pr_unlink(pr);
+		pr_adddead(pr->pr_parent, pr);
+		cv_signal(pr->pr_parent->pr_childexit, pid_mutex);
+	}
+	else {
+		pr_free(pr);
+	}
+	lock_release(pid_mutex);
 }
 
-void
-pid_clear(pid_t pid)
+/*
+ * Wait for a child of the current process to exit and collect its
+ * exit code: child PID, or any child if PID is -1. With WNOHANG in
+ * OPTIONS, return at once with *RETPID set to 0 if none has exited
+ * yet. Returns EINVAL if PID is not a child of the caller, or if it
+ * has no children at all.
+ */
+int
+pid_wait(pid_t pid, int options, int *exitcode, pid_t *retpid)
 {
-	if (pid <= 0 || pid > PID_MAX) return;
-	
+	struct pidrec *me, *pr;
+
+	assert(pid == -1 || (pid > 0 && pid <= PID_MAX));
+
+	if (curthread->t_pid <= 0) {
+		return EINVAL;
+	}
+
 	lock_acquire(pid_mutex);
-	pid_table[pid - 1] = NULL;
+	me = pid_table[curthread->t_pid - 1];
+	assert(me != NULL);
+
+	for (;;) {
+		if (pid == -1) {
+			if (me->pr_live == NULL && me->pr_dead == NULL) {
+				lock_release(pid_mutex);
+				return EINVAL;
+			}
+			pr = me->pr_dead;
+		}
+		else {
+			pr = pid_table[pid - 1];
+			if (pr == NULL || pr->pr_parent != me) {
+				lock_release(pid_mutex);
+				return EINVAL;
+			}
+			if (pr->pr_thread != NULL) {
+				pr = NULL;
+			}
+		}
+
+		if (pr != NULL) {
+			break;
+		}
+		if (options & WNOHANG) {
+			lock_release(pid_mutex);
+			*retpid = 0;
+			return 0;
+		}
+		cv_wait(me->pr_childexit, pid_mutex);
+	}
+
+	*exitcode = pr->pr_exitcode;
+	*retpid = pr->pr_pid;
+	pr_unlink(pr);
+	pr_free(pr);
 	lock_release(pid_mutex);
+
+	return 0;
 }
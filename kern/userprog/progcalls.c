@@ -6,36 +6,28 @@ Implementation of all process related system calls:
 	- fork
 	- getpid
 	- waitpid
+	- nanosleep
+	- schedstats
 */
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/unistd.h>
+#include <kern/limits.h>
 #include <lib.h>
 #include <syscall.h>
 #include <thread.h>
 #include <curthread.h>
 #include <synch.h>
 #include <pid.h>
-
-//TODO: need to find a good place to destroy this guy
-struct lock *mutex;
-
-void
-sys_init() {
-	mutex = lock_create("sys_mutex");
-}
+#include <clock.h>
+#include <callout.h>
 
 int
 sys__exit(int exitcode)
 {
-	lock_acquire(mutex);
-	
-	//kprintf("exit pid: %d\n", curthread->t_pid);
+	/* thread_exit tells the parent */
 	pid_setexitcode(curthread->t_pid, exitcode);
-	cv_broadcast(curthread->t_cvwaitpid, mutex);
-
-	lock_release(mutex);
-
 	thread_exit();
 
 	return 0;
@@ -48,76 +40,88 @@ sys_getpid(int *retval)
 	return 0;
 }
 
+/*
+ * Wait for child PID, or any child if PID is -1, to exit. With
+ * WNOHANG, return 0 instead of waiting if it hasn't exited yet.
+ */
 int
 sys_waitpid(pid_t pid, userptr_t status, int options, int *retval)
 {
-	int result;
+	int result, exitcode;
+	pid_t childpid;
 
 	if((void *)status == NULL)
 		return EFAULT;
 
-	if(pid == curthread->t_pid || pid <= 0 || pid > PID_MAX || options != 0) {
+	if((options & ~WNOHANG) != 0) {
 		return EINVAL;
 	}
-
-	lock_acquire(mutex);
-
-	if(options != 0) {
-		lock_release(mutex);
+	if(pid != -1 && (pid == curthread->t_pid || pid <= 0 || pid > PID_MAX)) {
 		return EINVAL;
 	}
 
-	int exitcode = pid_getexitcode(pid);
-	if(exitcode != -1) {
+	result = pid_wait(pid, options, &exitcode, &childpid);
+	if(result) {
+		return result;
+	}
+
+	if(childpid != 0) {
 		result = copyout(&exitcode, status, sizeof(int));
 		if(result) {
-			lock_release(mutex);
 			return result;
 		}
-
-		*retval = (int)pid;
-		lock_release(mutex);
-		return 0;
 	}
-	struct thread *thread = pid_getthread(pid);
 
-	if(thread == NULL) {
-		lock_release(mutex);
+	*retval = (int)childpid;
+	return 0;
+}
+
+/*
+ * Sleep for the given time, rounded up to whole clock ticks. A zero
+ * time just gives up the processor.
+ */
+int
+sys_nanosleep(time_t seconds, unsigned long nanoseconds)
+{
+	const unsigned long nsecpertick = 1000000000 / HZ;
+	int ticks;
+
+	if(seconds < 0 || nanoseconds >= 1000000000) {
 		return EINVAL;
 	}
-	if(pid_is_child(curthread, pid)) {
-		lock_release(mutex);
+	/* callout ticks are an int; don't overflow them */
+	if(seconds > (0x7fffffff / HZ) - 1) {
 		return EINVAL;
 	}
 
-	//kprintf("%d waitpid pid: %d\n", curthread->t_pid, pid);
-	cv_wait(thread->t_cvwaitpid, mutex);
-	//kprintf("%d got pid: %d\n", curthread->t_pid, pid);
-
-	exitcode = pid_getexitcode(pid);
-
-	result = copyout(&exitcode, status, sizeof(int));
-	if(result) {
-		lock_release(mutex);
-		return result;
+	ticks = seconds * HZ + (nanoseconds + nsecpertick - 1) / nsecpertick;
+	if(ticks == 0) {
+		thread_yield();
+		return 0;
 	}
 
-	*retval = (int)pid;
-
-	lock_release(mutex);
-
-	return 0;
+	return callout_sleep(ticks);
 }
 
+/*
+ * Copy out the scheduler accounting for process PID, or for the
+ * calling process if PID is 0.
+ */
+int
+sys_schedstats(pid_t pid, userptr_t buf)
+{
+	struct schedstats stats;
+	int result;
 
+	if(pid == 0) {
+		thread_getstats(curthread, &stats);
+	}
+	else {
+		result = pid_getstats(pid, &stats);
+		if(result) {
+			return result;
+		}
+	}
 
-
-
-
-
-
-
-
-
-
-
+	return copyout(&stats, buf, sizeof(stats));
+}
@@ -14,28 +14,25 @@
 #include <vm.h>
 #include <vfs.h>
 #include <test.h>
+#include <argbuf.h>
 #include "opt-A2.h"
 #include "opt-A3.h"
 
 /*
- * Load program "progname" and start running it in usermode.
- * Does not return except on error.
+ * Load the program open on V into a new address space for the current
+ * thread, which must not have one yet, and set up a user stack
+ * holding the arguments in ARGS as argv. Hands back the entry
+ * point, the initial stack pointer, and the user address of argv.
+ * On error the address space is left for thread_exit to destroy.
  *
- * Calls vfs_open on progname and thus may destroy it.
+ * Takes over the caller's reference to V.
  */
 int
-runprogram(char *progname, int nargs, char **args)
+progload_vnode(struct vnode *v, struct argbuf *args,
+	       vaddr_t *entrypoint, vaddr_t *stackptr, userptr_t *argv)
 {
-	struct vnode *v;
-	vaddr_t entrypoint, stackptr;
 	int result;
 
-	/* Open the file. */
-	result = vfs_open(progname, O_RDONLY, &v);
-	if (result) {
-		return result;
-	}
-
 	/* We should be a new thread. */
 	assert(curthread->t_vmspace == NULL);
 
@@ -50,7 +47,7 @@ runprogram(char *progname, int nargs, char **args)
 	as_activate(curthread->t_vmspace);
 
 	/* Load the executable. */
-	result = load_elf(v, &entrypoint);
+	result = load_elf(v, entrypoint);
 	if (result) {
 		/* thread_exit destroys curthread->t_vmspace */
 		vfs_close(v);
@@ -66,64 +63,77 @@ runprogram(char *progname, int nargs, char **args)
 	#endif
 
 	/* Define the user stack in the address space */
-	result = as_define_stack(curthread->t_vmspace, &stackptr);
+	result = as_define_stack(curthread->t_vmspace, stackptr);
 	if (result) {
 		/* thread_exit destroys curthread->t_vmspace */
 		return result;
 	}
 
-	#if OPT_A2
-	vaddr_t addrOfCharPtrs[nargs];
-
-	/* First put all the strings args on the users stack  while 
-	keeping track of the starting chars user stack address*/
-	int i;
-	for(i = nargs - 1; i >= 0; i--) {
-		size_t str_len = 1;
-		char *str = args[i];
-		int j = 0;
-		while(str[j] != '\0') {
-			str_len++;
-			j++;
-		}
-		
-		size_t actual;
-		stackptr -= str_len;
-		addrOfCharPtrs[i] = stackptr;
-		copyoutstr(args[i], (userptr_t) stackptr, str_len, &actual);		
+	/* Put the arguments on it */
+	result = argbuf_copyout(args, stackptr, argv);
+	if (result) {
+		return result;
 	}
 
-	/* put the 0's on the stack */
-	int null_len = 4 + stackptr % 4;
-	int zeros = 0;
-	stackptr -= null_len;
-	copyout(&zeros, (userptr_t) stackptr, null_len);
+	return 0;
+}
 
-	/* put all the *char on the user stack */
-    	for(i = nargs-1; i >= 0; i--) {
-		stackptr -= 4;
-		copyout(&addrOfCharPtrs[i], (userptr_t) stackptr, 4);
-    	}
+/*
+ * As progload_vnode, for program "progname".
+ *
+ * Calls vfs_open on progname and thus may destroy it.
+ */
+int
+progload(char *progname, struct argbuf *args,
+	 vaddr_t *entrypoint, vaddr_t *stackptr, userptr_t *argv)
+{
+	struct vnode *v;
+	int result;
 
-	/* this is the new **argv address, put that on the user stack */
-	vaddr_t newArgsPtr = stackptr;
-	stackptr -= 4;
-	copyout(&newArgsPtr, (userptr_t) stackptr, 4);
+	/* Open the file. */
+	result = vfs_open(progname, O_RDONLY, &v);
+	if (result) {
+		return result;
+	}
+
+	return progload_vnode(v, args, entrypoint, stackptr, argv);
+}
+
+/*
+ * Load program "progname" and start running it in usermode.
+ * Does not return except on error.
+ *
+ * Calls vfs_open on progname and thus may destroy it.
+ */
+int
+runprogram(char *progname, int nargs, char **args)
+{
+	struct argbuf ab;
+	vaddr_t entrypoint, stackptr;
+	userptr_t argv;
+	int result;
 
-	/* make sure the new user stackptr is divisible by 8 */
-	stackptr -= (stackptr % 8);
+	result = argbuf_init(&ab);
+	if (result) {
+		return result;
+	}
+	result = argbuf_fromkernel(&ab, nargs, args);
+	if (result == 0) {
+		result = progload(progname, &ab, &entrypoint, &stackptr, &argv);
+	}
+	argbuf_cleanup(&ab);
+	if (result) {
+		return result;
+	}
 
 	/* Warp to user mode. */
-	md_usermode(nargs,(userptr_t) newArgsPtr,
-		    stackptr, entrypoint);
+	#if OPT_A2
+	md_usermode(nargs, argv, stackptr, entrypoint);
 	#else
-	/* Warp to user mode. */
-	md_usermode(0,NULL,
-		    stackptr, entrypoint);
+	md_usermode(0, argv, stackptr, entrypoint);
 	#endif /* OPT_A2 */
 	
 	/* md_usermode does not return */
 	panic("md_usermode returned\n");
 	return EINVAL;
 }
-
@@ -0,0 +1,309 @@
+/*
+ * spawn: create a child process running a new program.
+ *
+ * fork followed by execv copies the whole address space of the parent
+ * only to throw it away again. spawn instead starts the child with no
+ * address space at all and loads the program straight into it. The
+ * parent's file table is still inherited, and the caller can adjust
+ * it for the child with a list of file actions (see <kern/spawn.h>),
+ * which is what a shell needs for redirection.
+ *
+ * Everything the child needs is copied into the kernel by the parent
+ * first. The parent then waits until the child has applied the file
+ * actions and loaded the program, so errors come back from spawn
+ * itself rather than as an exit code.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <kern/spawn.h>
+#include <lib.h>
+#include <addrspace.h>
+#include <thread.h>
+#include <curthread.h>
+#include <synch.h>
+#include <vm.h>
+#include <test.h>
+#include <argbuf.h>
+#include <pid.h>
+#include <filecalls.h>
+#include <syscall.h>
+#include "opt-A2.h"
+
+#if OPT_A2
+
+/* Handed from sys_spawn to the child, on the parent's stack */
+struct spawnargs {
+	char *sa_path;
+	struct argbuf sa_args;
+	struct spawn_fdaction *sa_actions;
+	int sa_nactions;
+
+	struct semaphore *sa_done;	/* child has loaded (or failed) */
+	int sa_result;
+	pid_t sa_pid;
+};
+
+/*
+ * Carry out one file action on the current thread's file table.
+ */
+static
+int
+spawn_fdaction(const struct spawn_fdaction *sfa)
+{
+	struct fd **table = curthread->t_filetable;
+	struct fd *newfd;
+	char *name;
+	int result;
+
+	if (sfa->sfa_fd < 0 || sfa->sfa_fd >= MAX_FD) {
+		return EBADF;
+	}
+
+	switch (sfa->sfa_op) {
+	    case SPAWN_FD_CLOSE:
+		if (table[sfa->sfa_fd] == NULL) {
+			return EBADF;
+		}
+		newfd = NULL;
+		break;
+
+	    case SPAWN_FD_OPEN:
+		/* fd_init keeps the name */
+		name = kstrdup(sfa->sfa_path);
+		if (name == NULL) {
+			return ENOMEM;
+		}
+		result = fd_init(name, sfa->sfa_flags, &newfd);
+		if (result) {
+			kfree(name);
+			return result;
+		}
+		break;
+
+	    case SPAWN_FD_DUP2:
+		if (sfa->sfa_srcfd < 0 || sfa->sfa_srcfd >= MAX_FD ||
+		    table[sfa->sfa_srcfd] == NULL) {
+			return EBADF;
+		}
+		if (sfa->sfa_srcfd == sfa->sfa_fd) {
+			return 0;
+		}
+		/* same open file, so the two share an offset */
+		newfd = table[sfa->sfa_srcfd];
+		fd_incref(newfd);
+		break;
+
+	    default:
+		return EINVAL;
+	}
+
+	fd_destroy(table[sfa->sfa_fd]);
+	table[sfa->sfa_fd] = newfd;
+	return 0;
+}
+
+/*
+ * The child's side: set up the file table, load the program, tell
+ * the parent how it went, and start running it.
+ */
+static
+void
+spawn_start(void *data1, unsigned long unused)
+{
+	struct spawnargs *sa = data1;
+	vaddr_t entrypoint, stackptr;
+	userptr_t argv;
+	int i, nargs, result = 0;
+
+	(void)unused;
+
+	sa->sa_pid = curthread->t_pid;
+
+	for (i=0; i<sa->sa_nactions && result == 0; i++) {
+		result = spawn_fdaction(&sa->sa_actions[i]);
+	}
+
+	if (result == 0) {
+		result = progload(sa->sa_path, &sa->sa_args, &entrypoint,
+				  &stackptr, &argv);
+	}
+
+	/* After this SA belongs to the parent again */
+	nargs = sa->sa_args.ab_nargs;
+	sa->sa_result = result;
+	V(sa->sa_done);
+
+	if (result) {
+		thread_exit();
+	}
+
+	/* Warp to user mode. */
+	md_usermode(nargs, argv, stackptr, entrypoint);
+
+	/* md_usermode does not return */
+	panic("md_usermode returned\n");
+}
+
+static
+void
+spawn_freeargs(struct spawnargs *sa)
+{
+	int i;
+
+	for (i=0; i<sa->sa_nactions; i++) {
+		if (sa->sa_actions[i].sfa_op == SPAWN_FD_OPEN) {
+			kfree((char *)sa->sa_actions[i].sfa_path);
+		}
+	}
+	if (sa->sa_actions != NULL) {
+		kfree(sa->sa_actions);
+	}
+	argbuf_cleanup(&sa->sa_args);
+	if (sa->sa_path != NULL) {
+		kfree(sa->sa_path);
+	}
+}
+
+/*
+ * Copy in a user string of at most PATH_MAX bytes into a new kernel
+ * string.
+ */
+static
+int
+spawn_copyinstr(const_userptr_t ustr, char *scratch, char **ret)
+{
+	size_t actual;
+	int result;
+
+	result = copyinstr(ustr, scratch, PATH_MAX, &actual);
+	if (result) {
+		return result;
+	}
+	*ret = kstrdup(scratch);
+	if (*ret == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Copy the path, argv and file actions from the user. The argument
+ * buffer has already been set up.
+ */
+static
+int
+spawn_copyin(struct spawnargs *sa, const_userptr_t path, userptr_t argv,
+	     const_userptr_t actions, int nactions)
+{
+	char *scratch;
+	int result, i;
+
+	if (nactions < 0 || nactions > SPAWN_MAX_FDACTIONS) {
+		return EINVAL;
+	}
+
+	scratch = kmalloc(PATH_MAX);
+	if (scratch == NULL) {
+		return ENOMEM;
+	}
+
+	result = spawn_copyinstr(path, scratch, &sa->sa_path);
+	if (result) {
+		goto done;
+	}
+	if (*sa->sa_path == '\0') {
+		result = EINVAL;
+		goto done;
+	}
+
+	result = argbuf_copyin(&sa->sa_args, argv);
+	if (result) {
+		goto done;
+	}
+
+	if (nactions > 0) {
+		sa->sa_actions = kmalloc(nactions * sizeof(*sa->sa_actions));
+		if (sa->sa_actions == NULL) {
+			result = ENOMEM;
+			goto done;
+		}
+		result = copyin(actions, sa->sa_actions,
+				nactions * sizeof(*sa->sa_actions));
+		if (result) {
+			goto done;
+		}
+	}
+	/* sa_nactions counts the actions whose paths are ours to free */
+	for (i=0; i<nactions; i++) {
+		struct spawn_fdaction *sfa = &sa->sa_actions[i];
+
+		if (sfa->sfa_op == SPAWN_FD_OPEN) {
+			result = spawn_copyinstr((const_userptr_t)sfa->sfa_path,
+						 scratch, (char **)&sfa->sfa_path);
+			if (result) {
+				goto done;
+			}
+		}
+		sa->sa_nactions = i + 1;
+	}
+
+ done:
+	kfree(scratch);
+	return result;
+}
+
+int
+sys_spawn(const_userptr_t path, userptr_t argv, const_userptr_t actions,
+	  int nactions, int *retval)
+{
+	struct spawnargs sa;
+	int result, exitcode;
+	pid_t pid;
+
+	sa.sa_path = NULL;
+	sa.sa_actions = NULL;
+	sa.sa_nactions = 0;
+	sa.sa_pid = 0;
+	sa.sa_result = 0;
+
+	result = argbuf_init(&sa.sa_args);
+	if (result) {
+		return result;
+	}
+	result = spawn_copyin(&sa, path, argv, actions, nactions);
+	if (result) {
+		spawn_freeargs(&sa);
+		return result;
+	}
+
+	sa.sa_done = sem_create("spawn", 0);
+	if (sa.sa_done == NULL) {
+		spawn_freeargs(&sa);
+		return ENOMEM;
+	}
+
+	result = thread_fork_child(sa.sa_path, &sa, 0, spawn_start, NULL);
+	if (result) {
+		sem_destroy(sa.sa_done);
+		spawn_freeargs(&sa);
+		return result;
+	}
+
+	P(sa.sa_done);
+	sem_destroy(sa.sa_done);
+	spawn_freeargs(&sa);
+
+	result = sa.sa_result;
+	if (result) {
+		/* collect the child so its pid isn't left behind */
+		pid_wait(sa.sa_pid, 0, &exitcode, &pid);
+		return result;
+	}
+
+	*retval = sa.sa_pid;
+	return 0;
+}
+
+#endif /* OPT_A2 */
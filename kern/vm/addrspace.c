@@ -35,6 +35,7 @@ void
 vm_bootstrap(void)
 {
 	coremap_bootstrap();
+	sd_bootstrap();
 }
 
 /* Allocate/free some kernel-space virtual pages */
@@ -115,16 +116,6 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 					return ENOMEM;
 				}
 
-				//need to be able to write to tlb until completely loaded
-				int storeloc;
-				
-				//Need to ensure nothing happens to this block until it is set up properly
-				spl = splhigh();
-				result = tlb_write(faultaddress, TLBLO_DIRTY, &storeloc);
-				if(result){
-					splx(spl);
-					return result;
-				}
 				size_t segsize = (segdef->sd_vbase + segdef->sd_segsz) - faultaddress; //rebase the size off of the current fault spot
 				int curpage = (faultaddress - segdef->sd_vbase) / PAGE_SIZE;
 				off_t offset = segdef->sd_offset + curpage * PAGE_SIZE;
@@ -135,17 +126,16 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 					segsize = PAGE_SIZE;
 				}
 			
-				//now that space for the segment has been allocated, put the segment in memory
-				result = load_segment(as->as_elfbin, offset, faultaddress, PAGE_SIZE,
-										segsize, 0);
+				//fill the frame through its kernel address, with interrupts
+				//on; it isn't in the TLB yet so the user can't see it half done
+				result = load_page(as->as_elfbin, offset, paddr, segsize);
 				if(result) {
-					splx(spl);
 					return result;
 				}
-				
-				if((segdef->sd_flags & TLBLO_DIRTY) == 0){
-					result = tlb_set_read_only(segdef, storeloc);
-				}
+
+				//only putting it in the TLB needs interrupts off
+				spl = splhigh();
+				result = tlb_write(faultaddress, (segdef->sd_flags & TLBLO_DIRTY), NULL);
 				splx(spl);
 			}else{
 				//stack
@@ -153,19 +143,24 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 					return EFAULT;
 				}
 				
-				paddr = pt_alloc_page(curthread->t_pid, faultaddress, 1, 0);
+				int zeroed;
+				paddr = pt_alloc_zeroed_page(curthread->t_pid, faultaddress, 1, 0, &zeroed);
 				if(!paddr) {
 					return ENOMEM;
 				}
 
-				spl = splhigh(); //dont want to let anyone do anything until block is zeroed
+				//frames from the idle loop's zero pool are already clear;
+				//otherwise zero it before it goes in the TLB
+				if(!zeroed) {
+					bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+				}
+
+				spl = splhigh();
 				result = tlb_write(faultaddress, 0, NULL);
+				splx(spl);
 				if(result){
-					splx(spl);
 					return result;
 				}
-				bzero((userptr_t)faultaddress, PAGE_SIZE);
-				splx(spl);
 				vmstats_inc(5);
 			}		
 		}	
@@ -256,7 +251,7 @@ as_destroy(struct addrspace *as)
 	if(as->as_segments != NULL){
 		int i, narr = array_getnum(as->as_segments);
 		for(i=0; i<narr; i++){
-			kfree(array_getguy(as->as_segments, i));
+			sd_destroy(array_getguy(as->as_segments, i));
 		}
 		array_destroy(as->as_segments);
 	}
@@ -8,12 +8,41 @@
 #include <synch.h>
 #include <coremap.h>
 #include <clock.h>
+#include <machine/spl.h>
 
 struct lock *coremap_mutex;
 struct coremap_entry *coremap;
 int total_pages;
 int coremap_init;
 
+/* physical address of coremap[0], used to find a frame's kernel address */
+static paddr_t coremap_base;
+
+/*
+ * Pool of free frames that the idle loop has already zeroed. Zero-fill
+ * faults take frames from here so they can skip the bzero. Frames in the
+ * pool are still free (in_use == 0) and can be handed out by the normal
+ * allocators too; whoever takes one removes it from the pool.
+ */
+#define ZERO_POOL_SIZE	16
+#define ZERO_CHUNK	(PAGE_SIZE/4)
+
+static int zero_pool[ZERO_POOL_SIZE];
+static int zero_pool_count;
+static int zero_cursor;
+
+static void zero_pool_remove(int page) {
+	int i;
+
+	for(i = 0; i < zero_pool_count; i++) {
+		if(zero_pool[i] == page) {
+			zero_pool[i] = zero_pool[--zero_pool_count];
+			break;
+		}
+	}
+	coremap[page].is_zeroed = 0;
+}
+
 static void set_coremap_entry_time(struct coremap_entry *entry) {
 	time_t secs;
 	u_int32_t nsecs;
@@ -43,6 +72,7 @@ void coremap_bootstrap() {
 	 * the total number of pages we can have */
 	ram_getsize(&lo, &hi);
 	ramsize = hi - lo;
+	coremap_base = lo;
 	total_pages = ramsize/PAGE_SIZE;
 
 	/* after we call ram_getsize we have to do all the managing. We need
@@ -64,7 +94,7 @@ void coremap_bootstrap() {
 			coremap[i].in_use = 0;
 			coremap[i].is_kernel = 0;
 		}
-		
+		coremap[i].is_zeroed = 0;
 	}
 
 	pt_size = pt_init(total_pages, coremap_size, lo, coremap_vaddr, pt_mutex);
@@ -118,27 +148,108 @@ int get_fifo_page() {
 	return page_index;
 }
 
-/* Gets a single page of memory */
+static void take_page(int page) {
+	if(coremap[page].is_zeroed) {
+		zero_pool_remove(page);
+	}
+	coremap[page].in_use = 1;
+	coremap[page].is_kernel = 0;
+
+	set_coremap_entry_time(&coremap[page]);
+}
+
+/* Gets a single page of memory. Frames that are already zeroed are left
+ * for get_zeroed_page unless nothing else is free. */
 int get_free_page() {
-	int i, page_index;
+	int i, page_index = -1;
 
 	lock_acquire(coremap_mutex);
 
 	for(i = 0; i < total_pages; i++) {
 		if(coremap[i].in_use == 0) {
-			coremap[i].in_use = 1;
-			coremap[i].is_kernel = 0;
+			if(!coremap[i].is_zeroed) {
+				page_index = i;
+				break;
+			}
+			if(page_index == -1) {
+				page_index = i;
+			}
+		}
+	}
 
-			set_coremap_entry_time(&coremap[i]);
+	if(page_index != -1) {
+		take_page(page_index);
+	}
 
-			page_index = i;
-			lock_release(coremap_mutex);
-			return page_index;
-		}
+	lock_release(coremap_mutex);
+	return page_index;
+}
+
+/* Gets a single page that is known to be filled with zeros, or -1 if
+ * the idle loop hasn't zeroed any. */
+int get_zeroed_page() {
+	int page_index = -1;
+
+	lock_acquire(coremap_mutex);
+
+	if(zero_pool_count > 0) {
+		page_index = zero_pool[zero_pool_count - 1];
+		assert(coremap[page_index].in_use == 0);
+		assert(coremap[page_index].is_zeroed);
+		take_page(page_index);
 	}
 
 	lock_release(coremap_mutex);
-	return -1;
+	return page_index;
+}
+
+/*
+ * Called from the idle loop in scheduler() with interrupts off. Zeros
+ * one free frame and adds it to the zero pool. The frame is cleared a
+ * chunk at a time with interrupts let in between chunks, so the idle
+ * loop stays responsive.
+ *
+ * No locks here: no thread can run while we're in the idle loop, and
+ * interrupt handlers don't touch the coremap. Returns 1 if a frame was
+ * zeroed, 0 if there was nothing to do.
+ */
+int coremap_zero_idle() {
+	int i, page, spl;
+	size_t off;
+	char *frame;
+
+	assert(curspl>0);
+
+	if(!coremap_init || zero_pool_count >= ZERO_POOL_SIZE) {
+		return 0;
+	}
+
+	page = -1;
+	for(i = 0; i < total_pages; i++) {
+		int j = (zero_cursor + i) % total_pages;
+		if(coremap[j].in_use == 0 && !coremap[j].is_zeroed) {
+			page = j;
+			break;
+		}
+	}
+	if(page == -1) {
+		return 0;
+	}
+	zero_cursor = (page + 1) % total_pages;
+
+	frame = (char *)PADDR_TO_KVADDR(coremap_base + page * PAGE_SIZE);
+	for(off = 0; off < PAGE_SIZE; off += ZERO_CHUNK) {
+		bzero(frame + off, ZERO_CHUNK);
+
+		/* take any pending interrupts */
+		spl = spl0();
+		splx(spl);
+	}
+
+	coremap[page].is_zeroed = 1;
+	zero_pool[zero_pool_count++] = page;
+
+	return 1;
 }
 
 /* Gets a chunk of memory memory */
@@ -172,6 +283,9 @@ int get_free_kpages(int n) {
 	}
 
 	for(i=0; i<n; i++) {
+		if(coremap[i + page_index].is_zeroed) {
+			zero_pool_remove(i + page_index);
+		}
 		coremap[i + page_index].in_use = 1;
 		coremap[i + page_index].is_kernel = 1;
 
@@ -59,6 +59,16 @@ int pt_init(int pages, int coremap_size, paddr_t starting_paddr, vaddr_t coremap
 	return pt_size;
 }
 
+static paddr_t assign_page(int page_index, pid_t pid, vaddr_t vaddr, int writeable, int dirty) {
+	page_table[page_index].vaddr = vaddr;
+	page_table[page_index].pid = pid;
+	page_table[page_index].npages = 1;
+	page_table[page_index].writeable = writeable;
+	page_table[page_index].dirty = dirty;
+
+	return page_table[page_index].paddr;
+}
+
 static paddr_t alloc_page(pid_t pid, vaddr_t vaddr, int writeable, int dirty) {
 	int page_index;
 
@@ -73,13 +83,7 @@ static paddr_t alloc_page(pid_t pid, vaddr_t vaddr, int writeable, int dirty) {
 		tlb_invalidate();
 	}
 
-	page_table[page_index].vaddr = vaddr;
-	page_table[page_index].pid = pid;
-	page_table[page_index].npages = 1;
-	page_table[page_index].writeable = writeable;
-	page_table[page_index].dirty = dirty;
-
-	return page_table[page_index].paddr;
+	return assign_page(page_index, pid, vaddr, writeable, dirty);
 }
 
 /* Gets the physical address from a virtual address for process pid.
@@ -121,6 +125,27 @@ paddr_t pt_alloc_page(pid_t pid, vaddr_t vaddr, int writeable, int dirty) {
 	return paddr;
 }
 
+/* Same as pt_alloc_page, but prefers a frame the idle loop already zeroed.
+ * *zeroed is set to 1 if the frame is known to be all zeros, in which case
+ * the caller doesn't need to clear it. */
+paddr_t pt_alloc_zeroed_page(pid_t pid, vaddr_t vaddr, int writeable, int dirty, int *zeroed) {
+	int page_index;
+	paddr_t paddr;
+
+	lock_acquire(pt_mutex);
+	page_index = get_zeroed_page();
+	if(page_index != -1) {
+		*zeroed = 1;
+		paddr = assign_page(page_index, pid, vaddr, writeable, dirty);
+	} else {
+		*zeroed = 0;
+		paddr = alloc_page(pid, vaddr, writeable, dirty);
+	}
+	lock_release(pt_mutex);
+
+	return paddr;
+}
+
 /* Allocates a chunk of memory for the kernel. It doesn't use page replacement either
  * but i don't know how that is suppose to work since it is expecting one chunk of memory
  * and if we don't have a chunk of memory large enough what are we suppose to replace? */
@@ -6,11 +6,29 @@
 #include <segments.h>
 #include <addrspace.h>
 #include <array.h>
+#include <objcache.h>
+
+/* every fork copies all of the parent's segdefs, so keep a few around */
+#define SD_CACHE_LIMIT 16
+static struct objcache *sd_cache;
+
+void
+sd_bootstrap()
+{
+	sd_cache = objcache_create("segdef", sizeof(struct segdef),
+				   SD_CACHE_LIMIT, NULL, NULL);
+	if(sd_cache == NULL){
+		panic("sd_bootstrap: Out of memory\n");
+	}
+}
 
 struct segdef*
 sd_create()
 {
-	struct segdef *segdef = kmalloc(sizeof(struct segdef));
+	struct segdef *segdef = objcache_alloc(sd_cache);
+	if(segdef == NULL){
+		return NULL;
+	}
 		
 	segdef->sd_vbase = 0;
 	segdef->sd_segsz = 0;
@@ -25,6 +43,9 @@ struct segdef*
 sd_copy(struct segdef *old)
 {
 	struct segdef* new = sd_create();
+	if(new == NULL){
+		return NULL;
+	}
 	
 	new->sd_vbase = old->sd_vbase;
 	new->sd_segsz = old->sd_segsz;
@@ -71,5 +92,5 @@ sd_get_by_addr(struct addrspace *as, vaddr_t vbase)
 void
 sd_destroy(struct segdef *segdef)
 {
-	kfree(segdef);
+	objcache_free(sd_cache, segdef);
 }
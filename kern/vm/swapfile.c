@@ -41,6 +41,9 @@ swap_bootstrap()
 	for (i = 0; i < SWAP_MAX; i++)
 	{
 		swap_array[i] = swap_entry_init(0, 0, 0);
+		if(swap_array[i] == NULL){
+			panic("swap_bootstrap: Out of memory\n");
+		}
 	}
 
 	lock_release(swap_mutex);
@@ -175,6 +178,9 @@ int swap_out(pid_t pid, paddr_t pa, vaddr_t va) {
 struct swap_entry * swap_entry_init(pid_t pid, vaddr_t va, off_t offset) {
 	struct swap_entry * result;
 	result = kmalloc(sizeof(struct swap_entry));
+	if(result == NULL){
+		return NULL;
+	}
 	
 	result->pid = pid;
 	result->va = va;
@@ -26,33 +26,94 @@
 
 #include "disk.h"
 
+static u_int32_t blocksize;
+
+/*
+ * Read the first LEN bytes of block BLOCK into DATA.
+ */
+static
+void
+readblock(void *data, size_t len, u_int32_t block)
+{
+	static char buf[SFS_MAXBLOCKSIZE];
+
+	assert(len <= blocksize);
+	diskread(buf, block);
+	memcpy(data, buf, len);
+}
+
 static
 u_int32_t
 dumpsb(void)
 {
 	struct sfs_super sp;
+
+	/* The superblock is at the very start, whatever the block size */
 	diskread(&sp, SFS_SB_LOCATION);
 	if (SWAPL(sp.sp_magic) != SFS_MAGIC) {
 		errx(1, "Not an sfs filesystem");
 	}
+
+	blocksize = SWAPL(sp.sp_blocksize);
+	if (blocksize == 0) {
+		blocksize = SFS_MINBLOCKSIZE;
+	}
+	if (blocksize < SFS_MINBLOCKSIZE || blocksize > SFS_MAXBLOCKSIZE ||
+	    (blocksize & (blocksize-1)) != 0) {
+		errx(1, "Bad block size %u", blocksize);
+	}
+	disksetblocksize(blocksize);
+
 	sp.sp_volname[sizeof(sp.sp_volname)-1] = 0;
 	printf("Volume name: %-40s  %u blocks\n", sp.sp_volname, 
 	       SWAPL(sp.sp_nblocks));
+	printf("Block size: %u\n", blocksize);
+	printf("Features: 0x%x%s\n", SWAPL(sp.sp_features),
+	       (SWAPL(sp.sp_features) & SFS_FEATURE_DIRHASH) ?
+	       " (hashed directories)" : "");
 
 	return SWAPL(sp.sp_nblocks);
 }
 
+static
+void
+doindexblock(const struct sfs_dirindex *di)
+{
+	const struct sfs_diridx *ents = SFS_DIRIDX(di);
+	int i, count = SWAPS(di->sdi_count);
+
+	printf("        [index, depth %u, %d entries]\n",
+	       SWAPS(di->sdi_depth), count);
+	if (count > (int)SFS_DIRINDEX_MAX(blocksize)) {
+		warnx("Warning: too many index entries");
+		count = SFS_DIRINDEX_MAX(blocksize);
+	}
+	for (i=0; i<count; i++) {
+		printf("        hash 0x%08x -> block %u\n",
+		       SWAPL(ents[i].sdx_hash),
+		       SWAPL(ents[i].sdx_block));
+	}
+}
+
 static
 void
 dodirblock(u_int32_t block)
 {
-	struct sfs_dir sds[SFS_BLOCKSIZE/sizeof(struct sfs_dir)];
-	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
+	union {
+		struct sfs_dir sds[SFS_DIRPERBLOCK(SFS_MAXBLOCKSIZE)];
+		struct sfs_dirindex di;
+	} u;
+	struct sfs_dir *sds = u.sds;
+	int nsds = SFS_DIRPERBLOCK(blocksize);
 	int i;
 
-	diskread(&sds, block);
+	diskread(&u, block);
 
 	printf("    [block %u]\n", block);
+	if (SWAPL(u.di.sdi_magic) == SFS_DIRINDEX_MAGIC) {
+		doindexblock(&u.di);
+		return;
+	}
 	for (i=0; i<nsds; i++) {
 		u_int32_t ino = SWAPL(sds[i].sfd_ino);
 		if (ino==SFS_NOINO) {
@@ -65,22 +126,50 @@ dodirblock(u_int32_t block)
 	}
 }
 
+/*
+ * Dump the directory blocks under indirect block IDBLOCK, which is
+ * LEVELS levels above them.
+ */
+static
+void
+doindirect(u_int32_t idblock, int levels, u_int32_t *nblocks)
+{
+	u_int32_t ib[SFS_DBPERIDB(SFS_MAXBLOCKSIZE)];
+	u_int32_t block;
+	int i;
+
+	diskread(&ib, idblock);
+	for (i=0; i<(int)SFS_DBPERIDB(blocksize); i++) {
+		block = SWAPL(ib[i]);
+		if (block == 0) {
+			continue;
+		}
+		if (levels > 1) {
+			doindirect(block, levels-1, nblocks);
+		}
+		else {
+			dodirblock(block);
+			(*nblocks)++;
+		}
+	}
+}
+
 static
 void
 dumpdir(u_int32_t ino)
 {
 	struct sfs_inode sfi;
-	u_int32_t ib[SFS_DBPERIDB];
 	int nentries, i;
 	u_int32_t block, nblocks=0;
 
-	diskread(&sfi, ino);
+	readblock(&sfi, sizeof(sfi), ino);
 
 	nentries = SWAPL(sfi.sfi_size) / sizeof(struct sfs_dir);
 	if (SWAPL(sfi.sfi_size) % sizeof(struct sfs_dir) != 0) {
 		warnx("Warning: dir size is not a multiple of dir entry size");
 	}
-	printf("Directory %u: %d entries\n", ino, nentries);
+	printf("Directory %u: %d entries%s\n", ino, nentries,
+	       (SWAPL(sfi.sfi_flags) & SFS_IFLAG_DIRHASH) ? ", hashed" : "");
 
 	for (i=0; i<SFS_NDIRECT; i++) {
 		block = SWAPL(sfi.sfi_direct[i]);
@@ -90,14 +179,13 @@ dumpdir(u_int32_t ino)
 		}
 	}
 	if (SWAPL(sfi.sfi_indirect)) {
-		diskread(&ib, SWAPL(sfi.sfi_indirect));
-		for (i=0; i<SFS_DBPERIDB; i++) {
-			block = SWAPL(ib[i]);
-			if (block) {
-				dodirblock(block);
-				nblocks++;
-			}
-		}
+		doindirect(SWAPL(sfi.sfi_indirect), 1, &nblocks);
+	}
+	if (SWAPL(sfi.sfi_dindirect)) {
+		doindirect(SWAPL(sfi.sfi_dindirect), 2, &nblocks);
+	}
+	if (SWAPL(sfi.sfi_tindirect)) {
+		doindirect(SWAPL(sfi.sfi_tindirect), 3, &nblocks);
 	}
 	printf("    %u blocks in directory\n", nblocks);
 }
@@ -106,15 +194,15 @@ static
 void
 dumpbits(u_int32_t fsblocks)
 {
-	u_int32_t nblocks = SFS_BITBLOCKS(fsblocks);
+	u_int32_t nblocks = SFS_BITBLOCKS(fsblocks, blocksize);
 	u_int32_t i, j;
-	char data[SFS_BLOCKSIZE];
+	char data[SFS_MAXBLOCKSIZE];
 
-	printf("Freemap: %u blocks (%u %u %u)\n", nblocks, SFS_BITMAPSIZE(fsblocks), fsblocks, SFS_BLOCKBITS);
+	printf("Freemap: %u blocks (%u %u %u)\n", nblocks, SFS_BITMAPSIZE(fsblocks, blocksize), fsblocks, SFS_BLOCKBITS(blocksize));
 
 	for (i=0; i<nblocks; i++) {
 		diskread(data, SFS_MAP_LOCATION+i);
-		for (j=0; j<SFS_BLOCKSIZE; j++) {
+		for (j=0; j<blocksize; j++) {
 			printf("%02x", (unsigned char)data[j]);
 			if (j%32==31) {
 				printf("\n");
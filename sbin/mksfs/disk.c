@@ -11,14 +11,15 @@
 #include "disk.h"
 
 #define HOSTSTRING "System/161 Disk Image"
-#define BLOCKSIZE  512
+#define SECTORSIZE 512
 
 #ifndef EINTR
 #define EINTR 0
 #endif
 
 static int fd=-1;
-static u_int32_t nblocks;
+static u_int32_t nsectors;
+static u_int32_t blocksize = SECTORSIZE;	/* unit of diskread/diskwrite */
 
 void
 opendisk(const char *path)
@@ -34,10 +35,10 @@ opendisk(const char *path)
 		err(1, "%s: fstat", path);
 	}
 
-	nblocks = statbuf.st_size / BLOCKSIZE;
+	nsectors = statbuf.st_size / SECTORSIZE;
 
 #ifdef HOST
-	nblocks--;
+	nsectors--;
 
 	{
 		char buf[64];
@@ -64,14 +65,41 @@ u_int32_t
 diskblocksize(void)
 {
 	assert(fd>=0);
-	return BLOCKSIZE;
+	return SECTORSIZE;
+}
+
+/*
+ * Set the size of the blocks diskread and diskwrite transfer, and
+ * diskblocks counts. It must be a multiple of diskblocksize(), which
+ * is what it starts out as.
+ */
+void
+disksetblocksize(u_int32_t size)
+{
+	assert(size >= SECTORSIZE && size % SECTORSIZE == 0);
+	blocksize = size;
 }
 
 u_int32_t
 diskblocks(void)
 {
 	assert(fd>=0);
-	return nblocks;
+	return nsectors / (blocksize / SECTORSIZE);
+}
+
+/* Where block BLOCK is in the disk file. */
+static
+off_t
+diskoffset(u_int32_t block)
+{
+	off_t offset = (off_t)block * blocksize;
+
+#ifdef HOST
+	// skip over disk file header
+	offset += SECTORSIZE;
+#endif
+
+	return offset;
 }
 
 void
@@ -83,17 +111,12 @@ diskwrite(const void *data, u_int32_t block)
 
 	assert(fd>=0);
 
-#ifdef HOST
-	// skip over disk file header
-	block++;
-#endif
-
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
+	if (lseek(fd, diskoffset(block), SEEK_SET)<0) {
 		err(1, "lseek");
 	}
 
-	while (tot < BLOCKSIZE) {
-		len = write(fd, cdata + tot, BLOCKSIZE - tot);
+	while (tot < blocksize) {
+		len = write(fd, cdata + tot, blocksize - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -116,17 +139,12 @@ diskread(void *data, u_int32_t block)
 
 	assert(fd>=0);
 
-#ifdef HOST
-	// skip over disk file header
-	block++;
-#endif
-
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
+	if (lseek(fd, diskoffset(block), SEEK_SET)<0) {
 		err(1, "lseek");
 	}
 
-	while (tot < BLOCKSIZE) {
-		len = read(fd, cdata + tot, BLOCKSIZE - tot);
+	while (tot < blocksize) {
+		len = read(fd, cdata + tot, blocksize - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
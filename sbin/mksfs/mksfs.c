@@ -1,4 +1,5 @@
 #include <sys/types.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
@@ -25,20 +26,39 @@
 
 #include "disk.h"
 
-#define MAXBITBLOCKS 32
+#define MAXBITMAP (32*SFS_MINBLOCKSIZE)	/* bytes */
+
+static u_int32_t blocksize = SFS_MINBLOCKSIZE;
 
 static
 void
 check(void)
 {
-	assert(sizeof(struct sfs_super)==SFS_BLOCKSIZE);
-	assert(sizeof(struct sfs_inode)==SFS_BLOCKSIZE);
-	assert(SFS_BLOCKSIZE % sizeof(struct sfs_dir) == 0);
+	assert(sizeof(struct sfs_super)==SFS_MINBLOCKSIZE);
+	assert(sizeof(struct sfs_inode)==SFS_MINBLOCKSIZE);
+	assert(SFS_MINBLOCKSIZE % sizeof(struct sfs_dir) == 0);
+	assert(sizeof(struct sfs_dirindex) % sizeof(struct sfs_diridx) == 0);
+}
+
+/*
+ * Write LEN bytes of DATA to block BLOCK, padding it out to the block
+ * size with zeros.
+ */
+static
+void
+writeblock(const void *data, size_t len, u_int32_t block)
+{
+	static char buf[SFS_MAXBLOCKSIZE];
+
+	assert(len <= blocksize);
+	bzero(buf, blocksize);
+	memcpy(buf, data, len);
+	diskwrite(buf, block);
 }
 
 static
 void
-writesuper(const char *volname, u_int32_t nblocks)
+writesuper(const char *volname, u_int32_t nblocks, u_int32_t features)
 {
 	struct sfs_super sp;
 
@@ -50,16 +70,27 @@ writesuper(const char *volname, u_int32_t nblocks)
 
 	sp.sp_magic = SWAPL(SFS_MAGIC);
 	sp.sp_nblocks = SWAPL(nblocks);
+	sp.sp_features = SWAPL(features);
+	sp.sp_blocksize = SWAPL(blocksize);
 	strcpy(sp.sp_volname, volname);
 
-	diskwrite(&sp, SFS_SB_LOCATION);
+	writeblock(&sp, sizeof(sp), SFS_SB_LOCATION);
 }
 
+/*
+ * Write the root directory. A hashed one gets its index block at
+ * DIRBLOCK, pointing at one empty leaf after it; returns the number
+ * of blocks used that way.
+ */
 static
-void
-writerootdir(void)
+u_int32_t
+writerootdir(int hashed, u_int32_t dirblock)
 {
 	struct sfs_inode sfi;
+	struct {
+		struct sfs_dirindex di;
+		struct sfs_diridx ents[1];
+	} index;
 
 	bzero((void *)&sfi, sizeof(sfi));
 
@@ -67,10 +98,32 @@ writerootdir(void)
 	sfi.sfi_type = SWAPS(SFS_TYPE_DIR);
 	sfi.sfi_linkcount = SWAPS(1);
 
-	diskwrite(&sfi, SFS_ROOT_LOCATION);
+	if (!hashed) {
+		writeblock(&sfi, sizeof(sfi), SFS_ROOT_LOCATION);
+		return 0;
+	}
+
+	bzero((void *)&index, sizeof(index));
+	index.di.sdi_magic = SWAPL(SFS_DIRINDEX_MAGIC);
+	index.di.sdi_depth = SWAPS(0);
+	index.di.sdi_count = SWAPS(1);
+	index.ents[0].sdx_hash = SWAPL(0);
+	index.ents[0].sdx_block = SWAPL(1);
+	writeblock(&index, sizeof(index), dirblock);
+
+	/* an empty leaf */
+	writeblock(NULL, 0, dirblock+1);
+
+	sfi.sfi_size = SWAPL(2*blocksize);
+	sfi.sfi_direct[0] = SWAPL(dirblock);
+	sfi.sfi_direct[1] = SWAPL(dirblock+1);
+	sfi.sfi_flags = SWAPL(SFS_IFLAG_DIRHASH);
+	writeblock(&sfi, sizeof(sfi), SFS_ROOT_LOCATION);
+
+	return 2;
 }
 
-static char bitbuf[MAXBITBLOCKS*SFS_BLOCKSIZE];
+static char bitbuf[MAXBITMAP];
 
 static
 void
@@ -83,19 +136,23 @@ doallocbit(u_int32_t bit)
 	bitbuf[byte] |= mask;
 }
 
+/*
+ * Write the free block bitmap, with the NDIRBLOCKS blocks after it
+ * used by the root directory.
+ */
 static
 void
-writebitmap(u_int32_t fsblocks)
+writebitmap(u_int32_t fsblocks, u_int32_t ndirblocks)
 {
 
-	u_int32_t nbits = SFS_BITMAPSIZE(fsblocks);
-	u_int32_t nblocks = SFS_BITBLOCKS(fsblocks);
+	u_int32_t nbits = SFS_BITMAPSIZE(fsblocks, blocksize);
+	u_int32_t nblocks = SFS_BITBLOCKS(fsblocks, blocksize);
 	char *ptr;
 	u_int32_t i;
 
-	if (nblocks > MAXBITBLOCKS) {
+	if (nblocks*blocksize > MAXBITMAP) {
 		errx(1, "Filesystem too large "
-		     "- increase MAXBITBLOCKS and recompile");
+		     "- increase MAXBITMAP and recompile");
 	}
 
 	doallocbit(SFS_SB_LOCATION);
@@ -103,12 +160,15 @@ writebitmap(u_int32_t fsblocks)
 	for (i=0; i<nblocks; i++) {
 		doallocbit(SFS_MAP_LOCATION+i);
 	}
+	for (i=0; i<ndirblocks; i++) {
+		doallocbit(SFS_MAP_LOCATION+nblocks+i);
+	}
 	for (i=fsblocks; i<nbits; i++) {
 		doallocbit(i);
 	}
 
 	for (i=0; i<nblocks; i++) {
-		ptr = bitbuf + i*SFS_BLOCKSIZE;
+		ptr = bitbuf + i*blocksize;
 		diskwrite(ptr, SFS_MAP_LOCATION+i);
 	}
 }
@@ -116,15 +176,40 @@ writebitmap(u_int32_t fsblocks)
 int
 main(int argc, char **argv)
 {
-	u_int32_t size, blocksize;
+	u_int32_t size, features = 0, ndirblocks;
 	char *volname, *s;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	/* -i: hashed (indexed) directories; -b size: block size */
+	while (argc > 1 && argv[1][0] == '-') {
+		if (!strcmp(argv[1], "-i")) {
+			features |= SFS_FEATURE_DIRHASH;
+		}
+		else if (!strcmp(argv[1], "-b") && argc > 2) {
+			blocksize = atoi(argv[2]);
+			argc--;
+			argv++;
+		}
+		else {
+			argc = 0;	/* force the usage message */
+			break;
+		}
+		argc--;
+		argv++;
+	}
+
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, "Usage: mksfs [-i] [-b blocksize] "
+		     "device/diskfile volume-name");
+	}
+
+	if (blocksize < SFS_MINBLOCKSIZE || blocksize > SFS_MAXBLOCKSIZE ||
+	    (blocksize & (blocksize-1)) != 0) {
+		errx(1, "Block size must be a power of 2 from %u to %u",
+		     SFS_MINBLOCKSIZE, SFS_MAXBLOCKSIZE);
 	}
 
 	check();
@@ -147,17 +232,22 @@ main(int argc, char **argv)
 	}
 
 	opendisk(argv[1]);
-	blocksize = diskblocksize();
 
-	if (blocksize!=SFS_BLOCKSIZE) {
-		errx(1, "Device has wrong blocksize %u (should be %u)\n",
-		     blocksize, SFS_BLOCKSIZE);
+	if (blocksize % diskblocksize() != 0) {
+		errx(1, "Device has blocksize %u, which doesn't divide %u\n",
+		     diskblocksize(), blocksize);
 	}
+	disksetblocksize(blocksize);
 	size = diskblocks();
 
-	writesuper(volname, size);
-	writerootdir();
-	writebitmap(size);
+	if (SFS_MAP_LOCATION + SFS_BITBLOCKS(size, blocksize) + 2 > size) {
+		errx(1, "Device too small");
+	}
+
+	writesuper(volname, size, features);
+	ndirblocks = writerootdir(features & SFS_FEATURE_DIRHASH,
+			SFS_MAP_LOCATION + SFS_BITBLOCKS(size, blocksize));
+	writebitmap(size, ndirblocks);
 
 	closedisk();
 
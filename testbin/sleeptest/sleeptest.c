@@ -0,0 +1,115 @@
+/*
+ * sleeptest - test nanosleep() and schedstats().
+ *
+ * Sleeps for a few different lengths of time and checks with
+ * __time() that at least that much time went by, checks that bad
+ * times are rejected, and checks that schedstats() saw the sleeping.
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+/*
+ * Microseconds between two times.
+ */
+static
+long
+usecs(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+	return (long)(s1 - s0) * 1000000L + ((long)ns1 - (long)ns0) / 1000L;
+}
+
+/*
+ * Sleep for SECS seconds and NSECS nanoseconds and make sure it
+ * took at least that long. Returns how long it actually took.
+ */
+static
+long
+timedsleep(time_t secs, unsigned long nsecs)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	long want, took;
+
+	__time(&s0, &ns0);
+	if (nanosleep(secs, nsecs)) {
+		err(1, "nanosleep(%d, %lu)", (int)secs, nsecs);
+	}
+	__time(&s1, &ns1);
+
+	want = (long)secs * 1000000L + (long)(nsecs / 1000);
+	took = usecs(s0, ns0, s1, ns1);
+	if (took < want) {
+		errx(1, "nanosleep(%d, %lu) returned after %ld us",
+		     (int)secs, nsecs, took);
+	}
+	printf("sleeptest: asked for %ld us, slept %ld us\n", want, took);
+	return took;
+}
+
+static
+void
+sleepfail(const char *desc, time_t secs, unsigned long nsecs)
+{
+	if (nanosleep(secs, nsecs) == 0) {
+		errx(1, "%s: nanosleep succeeded", desc);
+	}
+	if (errno != EINVAL) {
+		err(1, "%s: wrong error", desc);
+	}
+	printf("sleeptest: %s: ok\n", desc);
+}
+
+int
+main(void)
+{
+	struct schedstats before, after;
+	long slept = 0;
+
+	if (schedstats(0, &before)) {
+		err(1, "schedstats");
+	}
+
+	/* zero just yields */
+	if (nanosleep(0, 0)) {
+		err(1, "nanosleep(0, 0)");
+	}
+
+	slept += timedsleep(0, 10000000);
+	slept += timedsleep(0, 250000000);
+	slept += timedsleep(1, 0);
+	slept += timedsleep(1, 500000000);
+
+	sleepfail("nanoseconds too big", 0, 1000000000);
+	sleepfail("negative seconds", -1, 0);
+
+	if (schedstats(0, &after)) {
+		err(1, "schedstats");
+	}
+	if (after.ss_sleepusecs - before.ss_sleepusecs < 2000000) {
+		errx(1, "schedstats counted %lu us asleep, slept %ld us",
+		     (unsigned long)(after.ss_sleepusecs -
+				     before.ss_sleepusecs), slept);
+	}
+	if (after.ss_nvoluntary - before.ss_nvoluntary < 4) {
+		errx(1, "schedstats counted only %lu voluntary switches",
+		     (unsigned long)(after.ss_nvoluntary -
+				     before.ss_nvoluntary));
+	}
+	printf("sleeptest: schedstats: ok\n");
+
+	if (schedstats(getpid(), &after)) {
+		err(1, "schedstats on own pid");
+	}
+	if (schedstats(-1, &after) == 0) {
+		errx(1, "schedstats on pid -1 succeeded");
+	}
+	printf("sleeptest: schedstats errors: ok\n");
+
+	printf("sleeptest: passed\n");
+	return 0;
+}
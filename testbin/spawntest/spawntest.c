@@ -0,0 +1,258 @@
+/*
+ * spawntest - test spawn() and its file actions.
+ *
+ * Runs /bin/cat with its input and output redirected by file actions
+ * and checks that the data came through, runs itself with stdout and
+ * stderr sent to one file to check that DUP2 shares the offset, then
+ * checks that bad arguments are rejected with the right error.
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define INFILE  "spawntest.in"
+#define OUTFILE "spawntest.out"
+#define SELF    "/testbin/spawntest"
+
+static const char message[] = "spawn file actions work\n";
+static const char outline[] = "out\n";
+static const char errline[] = "err\n";
+static const char mixed[] = "out\nerr\nout\nerr\n";
+
+/*
+ * Spawn PATH with the given file actions and return the result,
+ * leaving errno set if it failed.
+ */
+static
+pid_t
+dospawn(const char *path, const struct spawn_fdaction *actions,
+	int nactions)
+{
+	char *args[2];
+
+	args[0] = (char *)path;
+	args[1] = NULL;
+	return spawn(path, args, actions, nactions);
+}
+
+/*
+ * Wait for PID and make sure it exited with 0.
+ */
+static
+void
+reap(pid_t pid, const char *desc)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) != pid) {
+		err(1, "waitpid");
+	}
+	if (status != 0) {
+		errx(1, "%s exited with %d", desc, status);
+	}
+}
+
+/*
+ * Check that spawning with the given actions fails with WANTERR.
+ */
+static
+void
+spawnfail(const char *desc, const char *path,
+	  const struct spawn_fdaction *actions, int nactions, int wanterr)
+{
+	pid_t pid;
+
+	pid = dospawn(path, actions, nactions);
+	if (pid >= 0) {
+		errx(1, "%s: spawn succeeded (pid %d)", desc, pid);
+	}
+	if (errno != wanterr) {
+		err(1, "%s: wrong error", desc);
+	}
+	printf("spawntest: %s: ok\n", desc);
+}
+
+static
+void
+writefile(const char *name, const char *data)
+{
+	int fd;
+	size_t len = strlen(data);
+
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open for write", name);
+	}
+	if (write(fd, data, len) != (int)len) {
+		err(1, "%s: write", name);
+	}
+	close(fd);
+}
+
+static
+void
+checkfile(const char *name, const char *data)
+{
+	char buf[128];
+	int fd, len;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open for read", name);
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len < 0) {
+		err(1, "%s: read", name);
+	}
+	close(fd);
+	buf[len] = 0;
+	if (strcmp(buf, data)) {
+		errx(1, "%s: got <%s>, expected <%s>", name, buf, data);
+	}
+}
+
+/*
+ * Redirect cat's stdin from INFILE and its stdout to OUTFILE, close
+ * and re-dup stderr on the way, and make sure the file comes out
+ * the other side.
+ */
+static
+void
+redirect(void)
+{
+	struct spawn_fdaction fa[4];
+	pid_t pid;
+
+	writefile(INFILE, message);
+
+	fa[0].sfa_op = SPAWN_FD_OPEN;
+	fa[0].sfa_fd = STDIN_FILENO;
+	fa[0].sfa_flags = O_RDONLY;
+	fa[0].sfa_path = INFILE;
+
+	fa[1].sfa_op = SPAWN_FD_OPEN;
+	fa[1].sfa_fd = STDOUT_FILENO;
+	fa[1].sfa_flags = O_WRONLY|O_CREAT|O_TRUNC;
+	fa[1].sfa_path = OUTFILE;
+
+	fa[2].sfa_op = SPAWN_FD_CLOSE;
+	fa[2].sfa_fd = STDERR_FILENO;
+
+	fa[3].sfa_op = SPAWN_FD_DUP2;
+	fa[3].sfa_fd = STDERR_FILENO;
+	fa[3].sfa_srcfd = STDOUT_FILENO;
+
+	pid = dospawn("/bin/cat", fa, 4);
+	if (pid < 0) {
+		err(1, "spawn /bin/cat");
+	}
+	reap(pid, "/bin/cat");
+
+	checkfile(OUTFILE, message);
+	remove(INFILE);
+	remove(OUTFILE);
+	printf("spawntest: redirect: ok\n");
+}
+
+/*
+ * The child side of sharedfd: write to stdout and stderr in turn.
+ */
+static
+void
+writeboth(void)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		write(STDOUT_FILENO, outline, strlen(outline));
+		write(STDERR_FILENO, errline, strlen(errline));
+	}
+}
+
+/*
+ * Send the child's stdout to a new file and make stderr a dup of it
+ * (2>&1). Both must share one offset, so the writes come out
+ * interleaved rather than on top of each other.
+ */
+static
+void
+sharedfd(void)
+{
+	struct spawn_fdaction fa[2];
+	char *args[3];
+	pid_t pid;
+
+	fa[0].sfa_op = SPAWN_FD_OPEN;
+	fa[0].sfa_fd = STDOUT_FILENO;
+	fa[0].sfa_flags = O_WRONLY|O_CREAT|O_TRUNC;
+	fa[0].sfa_path = OUTFILE;
+
+	fa[1].sfa_op = SPAWN_FD_DUP2;
+	fa[1].sfa_fd = STDERR_FILENO;
+	fa[1].sfa_srcfd = STDOUT_FILENO;
+
+	args[0] = (char *)SELF;
+	args[1] = (char *)"-c";
+	args[2] = NULL;
+	pid = spawn(SELF, args, fa, 2);
+	if (pid < 0) {
+		err(1, "spawn %s", SELF);
+	}
+	reap(pid, SELF);
+
+	checkfile(OUTFILE, mixed);
+	remove(OUTFILE);
+	printf("spawntest: shared dup2 fd: ok\n");
+}
+
+static
+void
+errors(void)
+{
+	struct spawn_fdaction fa[SPAWN_MAX_FDACTIONS + 1];
+	int i;
+
+	for (i = 0; i < SPAWN_MAX_FDACTIONS + 1; i++) {
+		fa[i].sfa_op = SPAWN_FD_DUP2;
+		fa[i].sfa_fd = STDOUT_FILENO;
+		fa[i].sfa_srcfd = STDOUT_FILENO;
+	}
+	spawnfail("too many actions", "/bin/true", fa,
+		  SPAWN_MAX_FDACTIONS + 1, EINVAL);
+	spawnfail("negative action count", "/bin/true", fa, -1, EINVAL);
+
+	fa[0].sfa_op = SPAWN_FD_CLOSE;
+	fa[0].sfa_fd = -1;
+	spawnfail("close of bad fd", "/bin/true", fa, 1, EBADF);
+
+	fa[0].sfa_op = SPAWN_FD_DUP2;
+	fa[0].sfa_fd = STDOUT_FILENO;
+	fa[0].sfa_srcfd = 99;
+	spawnfail("dup2 from bad fd", "/bin/true", fa, 1, EBADF);
+
+	fa[0].sfa_op = 42;
+	fa[0].sfa_fd = STDOUT_FILENO;
+	spawnfail("unknown action", "/bin/true", fa, 1, EINVAL);
+
+	spawnfail("empty path", "", NULL, 0, EINVAL);
+	spawnfail("missing program", "/bin/no-such-program", NULL, 0, ENOENT);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc == 2 && !strcmp(argv[1], "-c")) {
+		writeboth();
+		return 0;
+	}
+
+	redirect();
+	sharedfd();
+	errors();
+	printf("spawntest: passed\n");
+	return 0;
+}
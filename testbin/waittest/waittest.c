@@ -0,0 +1,144 @@
+/*
+ * waittest - test waitpid() with WNOHANG and with pid -1.
+ *
+ * Checks that WNOHANG returns 0 for a child that is still running,
+ * that waitpid(-1) reaps every child exactly once with the right
+ * exit code, and that bad calls are rejected.
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NCHILDREN 5
+
+/*
+ * Fork a child that sleeps for SECS seconds and exits with CODE.
+ */
+static
+pid_t
+child(time_t secs, int code)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (secs > 0) {
+			nanosleep(secs, 0);
+		}
+		_exit(code);
+	}
+	return pid;
+}
+
+static
+void
+waitfail(const char *desc, pid_t pid, int options, int wanterr)
+{
+	int status;
+
+	if (waitpid(pid, &status, options) >= 0) {
+		errx(1, "%s: waitpid succeeded", desc);
+	}
+	if (errno != wanterr) {
+		err(1, "%s: wrong error", desc);
+	}
+	printf("waittest: %s: ok\n", desc);
+}
+
+/*
+ * A child that is still asleep: WNOHANG must come back with 0, and
+ * a blocking wait must then collect it.
+ */
+static
+void
+nohang(void)
+{
+	pid_t pid, ret;
+	int status;
+
+	pid = child(2, 7);
+
+	ret = waitpid(pid, &status, WNOHANG);
+	if (ret != 0) {
+		errx(1, "WNOHANG on running child returned %d", ret);
+	}
+	ret = waitpid(-1, &status, WNOHANG);
+	if (ret != 0) {
+		errx(1, "WNOHANG on any running child returned %d", ret);
+	}
+
+	ret = waitpid(pid, &status, 0);
+	if (ret != pid) {
+		err(1, "waitpid");
+	}
+	if (status != 7) {
+		errx(1, "child exited with %d, expected 7", status);
+	}
+	printf("waittest: WNOHANG: ok\n");
+}
+
+/*
+ * Several children exiting in no particular order: waitpid(-1) must
+ * return each of them once, with its own exit code.
+ */
+static
+void
+any(void)
+{
+	pid_t pids[NCHILDREN];
+	int seen[NCHILDREN];
+	pid_t ret;
+	int i, n, status;
+
+	for (i = 0; i < NCHILDREN; i++) {
+		/* some exit at once, some after a second */
+		pids[i] = child(i % 2, 10 + i);
+		seen[i] = 0;
+	}
+
+	for (n = 0; n < NCHILDREN; n++) {
+		ret = waitpid(-1, &status, 0);
+		if (ret < 0) {
+			err(1, "waitpid(-1) after %d children", n);
+		}
+		for (i = 0; i < NCHILDREN; i++) {
+			if (pids[i] == ret) {
+				break;
+			}
+		}
+		if (i == NCHILDREN) {
+			errx(1, "waitpid(-1) returned unknown pid %d", ret);
+		}
+		if (seen[i]) {
+			errx(1, "waitpid(-1) returned pid %d twice", ret);
+		}
+		if (status != 10 + i) {
+			errx(1, "pid %d exited with %d, expected %d",
+			     ret, status, 10 + i);
+		}
+		seen[i] = 1;
+	}
+	printf("waittest: waitpid(-1): ok\n");
+}
+
+int
+main(void)
+{
+	nohang();
+	any();
+
+	waitfail("waitpid(-1) with no children", -1, 0, EINVAL);
+	waitfail("WNOHANG with no children", -1, WNOHANG, EINVAL);
+	waitfail("waitpid on self", getpid(), 0, EINVAL);
+	waitfail("bad options", -1, 0x40, EINVAL);
+
+	printf("waittest: passed\n");
+	return 0;
+}